@@ -0,0 +1,512 @@
+/**
+ * allocation profiler, to be preloaded
+ *
+ * Interposes malloc, calloc, realloc, free, the aligned allocators and the
+ * C++ operator new/delete. Every thread counts calls, bytes and latency per
+ * size class and per call site in its own table, the allocations are passed
+ * on to the __libc_* entry points so the profiler neither recurses nor locks.
+ * A report is printed at exit.
+ *
+ * usage:  LD_PRELOAD=./liballoc-profiler.so <application>
+ * env:    ALLOC_PROFILER_FILE  report file (default stderr)
+ *         ALLOC_PROFILER_TOP   number of call sites in the report (default 20)
+ */
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <errno.h>
+#include <time.h>
+#include <dlfcn.h>
+#include <malloc.h>
+#include <pthread.h>
+#include <sys/mman.h>
+#include <sys/prctl.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+
+#define AP_SITES                1024        /* call sites per thread, power of two */
+#define AP_CLASSES              48          /* log2 size classes */
+#define AP_BUCKETS              32          /* log2 ns latency buckets */
+#define AP_DEFAULT_TOP          20
+#define AP_CALIBRATE_NS         10000000    /* 10ms */
+
+#define AP_UNLIKELY(x)          __builtin_expect(!!(x), 0)
+
+enum ap_op {
+    AP_MALLOC,
+    AP_CALLOC,
+    AP_REALLOC,
+    AP_MEMALIGN,
+    AP_NEW,
+    AP_FREE,
+    AP_OPS
+};
+
+static const char* ap_op_names[AP_OPS] = { "malloc", "calloc", "realloc", "memalign", "new", "free" };
+
+struct ap_stats {
+    uint64_t calls;
+    uint64_t bytes;
+    uint64_t ns;
+    uint64_t max_ns;
+    uint32_t hist[AP_BUCKETS];
+};
+
+struct ap_site {
+    const void* caller;         /* NULL: free slot */
+    uint32_t op;
+    struct ap_stats stats;
+};
+
+struct ap_thread {
+    struct ap_thread* next;
+    uint32_t tid;
+    char name[16];
+    uint64_t overflow;          /* calls of call sites not recorded, table full */
+    struct ap_stats ops[AP_OPS];
+    struct ap_stats classes[AP_CLASSES];
+    struct ap_site sites[AP_SITES];
+};
+
+extern void* __libc_malloc(size_t size);
+extern void* __libc_calloc(size_t nmemb, size_t size);
+extern void* __libc_realloc(void* ptr, size_t size);
+extern void* __libc_memalign(size_t alignment, size_t size);
+extern void __libc_free(void* ptr);
+
+static struct ap_thread* ap_threads;
+static __thread struct ap_thread* ap_tls_thread __attribute__((tls_model("initial-exec")));
+static __thread int ap_tls_busy __attribute__((tls_model("initial-exec")));
+static int ap_active;
+static uint64_t ap_ns_mult;     /* ns per tick << 32 */
+
+static inline uint64_t ap_ticks(void)
+{
+#if defined(__x86_64__) || defined(__i386__)
+    uint32_t lo, hi;
+
+    __asm__ __volatile__("rdtsc" : "=a"(lo), "=d"(hi));
+
+    return ((uint64_t)hi << 32) | lo;
+#else
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+
+    return (uint64_t)ts.tv_sec * 1000000000ull + ts.tv_nsec;
+#endif
+}
+
+static uint64_t ap_calibrate(void)
+{
+#if defined(__x86_64__) || defined(__i386__)
+    struct timespec req = { .tv_sec = 0, .tv_nsec = AP_CALIBRATE_NS };
+    struct timespec t0, t1;
+    uint64_t c0, c1;
+
+    clock_gettime(CLOCK_MONOTONIC, &t0);
+    c0 = ap_ticks();
+    while (nanosleep(&req, &req) && (errno == EINTR));
+    c1 = ap_ticks();
+    clock_gettime(CLOCK_MONOTONIC, &t1);
+
+    const double ns = (t1.tv_sec - t0.tv_sec) * 1e9 + (t1.tv_nsec - t0.tv_nsec);
+
+    return (uint64_t)(ns / (double)(c1 - c0) * 4294967296.0);
+#else
+    return 1ull << 32;
+#endif
+}
+
+static inline uint32_t ap_log2(uint64_t value, uint32_t limit)
+{
+    const uint32_t bucket = value ? 64 - __builtin_clzll(value) : 0;
+
+    return bucket < limit ? bucket : limit - 1;
+}
+
+static struct ap_thread* ap_thread_get(void)
+{
+    struct ap_thread* thread = ap_tls_thread;
+
+    if (AP_UNLIKELY(thread == NULL)) {
+        if (!__atomic_load_n(&ap_active, __ATOMIC_ACQUIRE)) {
+            return NULL;
+        }
+
+        thread = mmap(NULL, sizeof(struct ap_thread), PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+        if (thread == MAP_FAILED) {
+            return NULL;
+        }
+
+        thread->tid = (uint32_t)syscall(SYS_gettid);
+        thread->next = __atomic_load_n(&ap_threads, __ATOMIC_RELAXED);
+        while (!__atomic_compare_exchange_n(&ap_threads, &thread->next, thread, 1, __ATOMIC_RELEASE, __ATOMIC_RELAXED));
+
+        ap_tls_thread = thread;
+    }
+
+    return thread;
+}
+
+static inline void ap_stats_add(struct ap_stats* stats, uint64_t bytes, uint64_t ns)
+{
+    stats->calls++;
+    stats->bytes += bytes;
+    stats->ns += ns;
+    stats->max_ns = ns > stats->max_ns ? ns : stats->max_ns;
+    stats->hist[ap_log2(ns, AP_BUCKETS)]++;
+}
+
+static inline void ap_record(enum ap_op op, const void* caller, size_t bytes, uint64_t start)
+{
+    const uint64_t ns = ((ap_ticks() - start) * ap_ns_mult) >> 32;
+    struct ap_thread* thread = ap_thread_get();
+
+    if (thread == NULL) {
+        return;
+    }
+
+    ap_stats_add(&thread->ops[op], bytes, ns);
+    ap_stats_add(&thread->classes[ap_log2(bytes, AP_CLASSES)], bytes, ns);
+
+    /* threads are often named after they started, pick the name up now and then */
+    if ((thread->ops[op].calls & (thread->ops[op].calls - 1)) == 0) {
+        prctl(PR_GET_NAME, thread->name, 0, 0, 0);
+    }
+
+    uintptr_t hash = (((uintptr_t)caller * 0x9e3779b97f4a7c15ull) >> 20) ^ op;
+
+    for (uint32_t probe = 0; probe < AP_SITES; probe++, hash++) {
+        struct ap_site* site = &thread->sites[hash & (AP_SITES - 1)];
+
+        if ((site->caller == caller) && (site->op == op)) {
+            ap_stats_add(&site->stats, bytes, ns);
+            return;
+        }
+
+        if (site->caller == NULL) {
+            site->caller = caller;
+            site->op = op;
+            ap_stats_add(&site->stats, bytes, ns);
+            return;
+        }
+    }
+
+    thread->overflow++;
+}
+
+#define AP_ENTER()                                              \
+    const int ap_record_call = !ap_tls_busy;                    \
+    const uint64_t ap_start = ap_record_call ? ap_ticks() : 0;  \
+    ap_tls_busy = 1
+
+#define AP_LEAVE(op, bytes)                                     \
+    if (ap_record_call) {                                       \
+        ap_record(op, __builtin_return_address(0), bytes, ap_start); \
+        ap_tls_busy = 0;                                        \
+    }
+
+void* malloc(size_t size)
+{
+    AP_ENTER();
+    void* ptr = __libc_malloc(size);
+    AP_LEAVE(AP_MALLOC, size);
+
+    return ptr;
+}
+
+void* calloc(size_t nmemb, size_t size)
+{
+    AP_ENTER();
+    void* ptr = __libc_calloc(nmemb, size);
+    AP_LEAVE(AP_CALLOC, nmemb * size);
+
+    return ptr;
+}
+
+void* realloc(void* ptr, size_t size)
+{
+    AP_ENTER();
+    void* ret = __libc_realloc(ptr, size);
+    AP_LEAVE(AP_REALLOC, size);
+
+    return ret;
+}
+
+void free(void* ptr)
+{
+    if (ptr == NULL) {
+        return;
+    }
+
+    AP_ENTER();
+    /* accounted with the usable size, the requested size is not known */
+    const size_t size = ap_record_call ? malloc_usable_size(ptr) : 0;
+    __libc_free(ptr);
+    AP_LEAVE(AP_FREE, size);
+}
+
+void* memalign(size_t alignment, size_t size)
+{
+    AP_ENTER();
+    void* ptr = __libc_memalign(alignment, size);
+    AP_LEAVE(AP_MEMALIGN, size);
+
+    return ptr;
+}
+
+void* aligned_alloc(size_t alignment, size_t size)
+{
+    AP_ENTER();
+    void* ptr = __libc_memalign(alignment, size);
+    AP_LEAVE(AP_MEMALIGN, size);
+
+    return ptr;
+}
+
+int posix_memalign(void** memptr, size_t alignment, size_t size)
+{
+    if ((alignment % sizeof(void*)) || (alignment & (alignment - 1))) {
+        return EINVAL;
+    }
+
+    AP_ENTER();
+    void* ptr = __libc_memalign(alignment, size);
+    AP_LEAVE(AP_MEMALIGN, size);
+
+    if (ptr == NULL) {
+        return ENOMEM;
+    }
+
+    *memptr = ptr;
+
+    return 0;
+}
+
+/**
+ * operator new/delete, otherwise every C++ allocation has its call site in libstdc++
+ */
+static void* ap_new_failed(const char* symbol, size_t size)
+{
+    /* let the real operator new run the new handler or throw */
+    void* (*real_new)(size_t) = (void* (*)(size_t))dlsym(RTLD_NEXT, symbol);
+
+    return real_new(size);
+}
+
+void* _Znwm(size_t size)
+{
+    AP_ENTER();
+    void* ptr = __libc_malloc(size);
+    AP_LEAVE(AP_NEW, size);
+
+    return ptr ? ptr : ap_new_failed("_Znwm", size);
+}
+
+void* _Znam(size_t size)
+{
+    AP_ENTER();
+    void* ptr = __libc_malloc(size);
+    AP_LEAVE(AP_NEW, size);
+
+    return ptr ? ptr : ap_new_failed("_Znam", size);
+}
+
+#define AP_DELETE(symbol, ...)                  \
+    void symbol(void* ptr, ##__VA_ARGS__)       \
+    {                                           \
+        if (ptr == NULL) {                      \
+            return;                             \
+        }                                       \
+        AP_ENTER();                             \
+        const size_t size = ap_record_call ? malloc_usable_size(ptr) : 0; \
+        __libc_free(ptr);                       \
+        AP_LEAVE(AP_FREE, size);                \
+    }
+
+AP_DELETE(_ZdlPv)
+AP_DELETE(_ZdaPv)
+AP_DELETE(_ZdlPvm, size_t sized)
+AP_DELETE(_ZdaPvm, size_t sized)
+
+/**
+ * report
+ */
+static uint64_t ap_percentile(const uint32_t* hist, uint64_t count, double percentile)
+{
+    const uint64_t rank = (uint64_t)(count * percentile / 100.0);
+    uint64_t sum = 0;
+
+    for (uint32_t bucket = 0; bucket < AP_BUCKETS; bucket++) {
+        sum += hist[bucket];
+        if (sum > rank) {
+            return bucket ? (1ull << bucket) - 1 : 0;
+        }
+    }
+
+    return UINT64_MAX;
+}
+
+static void ap_caller_name(const void* caller, char* name, size_t size)
+{
+    Dl_info info;
+
+    if (dladdr(caller, &info) && info.dli_fname) {
+        const char* base = strrchr(info.dli_fname, '/');
+
+        base = base ? base + 1 : info.dli_fname;
+        if (info.dli_sname) {
+            snprintf(name, size, "%s+0x%lx (%s)", info.dli_sname, (unsigned long)((uintptr_t)caller - (uintptr_t)info.dli_saddr), base);
+        }
+        else {
+            /* offset for addr2line -e <file> */
+            snprintf(name, size, "%s+0x%lx", base, (unsigned long)((uintptr_t)caller - (uintptr_t)info.dli_fbase));
+        }
+    }
+    else {
+        snprintf(name, size, "%p", caller);
+    }
+}
+
+static void ap_stats_print(FILE* out, const char* label, const struct ap_stats* stats)
+{
+    fprintf(out, "%-24s %12lu %14lu %10.1f %10lu %10lu", label, (unsigned long)stats->calls, (unsigned long)stats->bytes,
+            stats->calls ? (double)stats->ns / stats->calls : 0.0,
+            (unsigned long)ap_percentile(stats->hist, stats->calls, 99.0), (unsigned long)stats->max_ns);
+}
+
+struct ap_site_ref {
+    const struct ap_thread* thread;
+    const struct ap_site* site;
+};
+
+static int ap_site_compare(const void* a, const void* b)
+{
+    const struct ap_stats* sa = &((const struct ap_site_ref*)a)->site->stats;
+    const struct ap_stats* sb = &((const struct ap_site_ref*)b)->site->stats;
+
+    if (sa->max_ns != sb->max_ns) {
+        return sa->max_ns < sb->max_ns ? 1 : -1;
+    }
+
+    return sa->calls < sb->calls ? 1 : (sa->calls > sb->calls ? -1 : 0);
+}
+
+static void ap_report(FILE* out, uint32_t top)
+{
+    const char* header = "%-24s %12s %14s %10s %10s %10s";
+    struct ap_stats classes[AP_CLASSES];
+    struct ap_site_ref* refs;
+    uint32_t capacity = 0;
+    uint32_t count = 0;
+    char label[64];
+
+    memset(classes, 0, sizeof(classes));
+
+    fprintf(out, "\nallocations of pid %d, latency in ns\n", getpid());
+    fprintf(out, header, "thread / call", "calls", "bytes", "avg", "p99", "max");
+    fprintf(out, "\n");
+
+    for (struct ap_thread* thread = __atomic_load_n(&ap_threads, __ATOMIC_ACQUIRE); thread; thread = thread->next) {
+        capacity += AP_SITES;
+
+        for (uint32_t op = 0; op < AP_OPS; op++) {
+            if (thread->ops[op].calls) {
+                snprintf(label, sizeof(label), "%.15s/%u %s", thread->name[0] ? thread->name : "?", thread->tid, ap_op_names[op]);
+                ap_stats_print(out, label, &thread->ops[op]);
+                fprintf(out, "\n");
+            }
+        }
+
+        for (uint32_t cls = 0; cls < AP_CLASSES; cls++) {
+            const struct ap_stats* stats = &thread->classes[cls];
+
+            classes[cls].calls += stats->calls;
+            classes[cls].bytes += stats->bytes;
+            classes[cls].ns += stats->ns;
+            classes[cls].max_ns = stats->max_ns > classes[cls].max_ns ? stats->max_ns : classes[cls].max_ns;
+            for (uint32_t bucket = 0; bucket < AP_BUCKETS; bucket++) {
+                classes[cls].hist[bucket] += stats->hist[bucket];
+            }
+        }
+
+        if (thread->overflow) {
+            fprintf(out, "%u: %lu calls of call sites not recorded, raise AP_SITES\n", thread->tid, (unsigned long)thread->overflow);
+        }
+    }
+
+    fprintf(out, "\n");
+    fprintf(out, header, "size class", "calls", "bytes", "avg", "p99", "max");
+    fprintf(out, "\n");
+    for (uint32_t cls = 0; cls < AP_CLASSES; cls++) {
+        if (classes[cls].calls) {
+            snprintf(label, sizeof(label), "<= %lu", cls ? (unsigned long)((1ull << cls) - 1) : 0ul);
+            ap_stats_print(out, label, &classes[cls]);
+            fprintf(out, "\n");
+        }
+    }
+
+    /* call sites per thread, the slowest first */
+    if ((capacity == 0) || ((refs = __libc_calloc(capacity, sizeof(struct ap_site_ref))) == NULL)) {
+        return;
+    }
+
+    for (struct ap_thread* thread = __atomic_load_n(&ap_threads, __ATOMIC_ACQUIRE); thread; thread = thread->next) {
+        for (uint32_t index = 0; index < AP_SITES; index++) {
+            if (thread->sites[index].caller) {
+                refs[count].thread = thread;
+                refs[count].site = &thread->sites[index];
+                count++;
+            }
+        }
+    }
+
+    qsort(refs, count, sizeof(struct ap_site_ref), ap_site_compare);
+
+    fprintf(out, "\n");
+    fprintf(out, header, "thread / call", "calls", "bytes", "avg", "p99", "max");
+    fprintf(out, "  call site\n");
+    for (uint32_t cnt = 0; (cnt < count) && (cnt < top); cnt++) {
+        const struct ap_thread* thread = refs[cnt].thread;
+        const struct ap_site* site = refs[cnt].site;
+        char name[256];
+
+        ap_caller_name(site->caller, name, sizeof(name));
+        snprintf(label, sizeof(label), "%.15s/%u %s", thread->name[0] ? thread->name : "?", thread->tid, ap_op_names[site->op]);
+        ap_stats_print(out, label, &site->stats);
+        fprintf(out, "  %s\n", name);
+    }
+
+    __libc_free(refs);
+}
+
+static __attribute__((constructor)) void ap_init(void)
+{
+    ap_ns_mult = ap_calibrate();
+    __atomic_store_n(&ap_active, 1, __ATOMIC_RELEASE);
+}
+
+static __attribute__((destructor)) void ap_fini(void)
+{
+    const char* path = getenv("ALLOC_PROFILER_FILE");
+    const char* top = getenv("ALLOC_PROFILER_TOP");
+    FILE* out = stderr;
+
+    /* the report allocates itself, e.g. in stdio */
+    ap_tls_busy = 1;
+    __atomic_store_n(&ap_active, 0, __ATOMIC_RELEASE);
+
+    if (path && ((out = fopen(path, "w")) == NULL)) {
+        perror("alloc-profiler: fopen() failed");
+        out = stderr;
+    }
+
+    ap_report(out, top ? (uint32_t)strtoul(top, NULL, 0) : AP_DEFAULT_TOP);
+
+    if (out != stderr) {
+        fclose(out);
+    }
+}
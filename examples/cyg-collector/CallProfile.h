@@ -0,0 +1,297 @@
+#pragma once
+
+#include <cstdint>
+#include <cstdio>
+#include <string>
+#include <vector>
+#include <unordered_map>
+#include <algorithm>
+
+#include "Symbolizer.h"
+
+/**
+ * Rebuilds the call stacks of each thread from a stream of enter/exit
+ * events and accumulates
+ *   - calls, inclusive and exclusive time per function
+ *   - exclusive time per call path (folded stacks for flame graphs)
+ * Memory grows with the number of functions and distinct call paths, not
+ * with the number of events, so the input is processed in one pass.
+ */
+class CallProfile
+{
+    public:
+        CallProfile(Symbolizer& symbolizer, bool threadRoots = false)
+            : m_symbolizer(symbolizer), m_threadRoots{threadRoots}
+        {
+            /* node 0 is the root of all call paths */
+            m_nodes.push_back(Node{0, UINT32_MAX, UINT32_MAX, 0, 0});
+        }
+
+        virtual ~CallProfile()
+        {
+        }
+
+        inline void enter(uint32_t tid, uint64_t ts, uint64_t fn)
+        {
+            Thread& thread = getThread(tid);
+            const uint32_t sym = m_symbolizer.resolve(fn);
+            const uint32_t parent = thread.stack.empty() ? thread.root : thread.stack.back().node;
+
+            if (sym >= thread.active.size()) {
+                thread.active.resize(m_symbolizer.size(), 0);
+            }
+            if (sym >= m_functions.size()) {
+                m_functions.resize(m_symbolizer.size());
+            }
+
+            thread.stack.push_back(Frame{fn, sym, child(parent, sym), ts, 0});
+            thread.active[sym]++;
+            thread.last = ts;
+            m_functions[sym].calls++;
+            m_events++;
+        }
+
+        inline void exit(uint32_t tid, uint64_t ts, uint64_t fn)
+        {
+            Thread& thread = getThread(tid);
+
+            thread.last = ts;
+            m_events++;
+
+            /* lttng_ust_cyg_profile_fast:func_exit carries no address */
+            if ((fn == 0) && !thread.stack.empty()) {
+                fn = thread.stack.back().fn;
+            }
+
+            if (thread.stack.empty() || (thread.stack.back().fn != fn)) {
+                /* lost events or a longjmp: unwind to the matching frame, if there is one */
+                auto it = std::find_if(thread.stack.rbegin(), thread.stack.rend(), [fn](const Frame& frame) { return frame.fn == fn; });
+                if (it == thread.stack.rend()) {
+                    m_unmatched++;
+                    return;
+                }
+                while (thread.stack.back().fn != fn) {
+                    pop(thread, ts);
+                    m_unwound++;
+                }
+            }
+
+            pop(thread, ts);
+        }
+
+        /**
+         * a thread lost events, its stack may be off until the next unwind
+         */
+        void dropped(uint64_t count)
+        {
+            m_dropped += count;
+        }
+
+        /**
+         * close the frames still open at the last event of each thread
+         */
+        void finish()
+        {
+            for (auto& entry : m_threads) {
+                Thread& thread = entry.second;
+
+                m_open += thread.stack.size();
+                while (!thread.stack.empty()) {
+                    pop(thread, thread.last);
+                }
+            }
+        }
+
+        /**
+         * functions ranked by inclusive (or exclusive) time, times are scaled by nsPerTick
+         */
+        void dump(size_t top, bool byExclusive, double nsPerTick)
+        {
+            std::vector<uint32_t> order;
+            uint64_t total = 0;
+
+            for (uint32_t sym = 0; sym < m_functions.size(); sym++) {
+                if (m_functions[sym].calls) {
+                    order.push_back(sym);
+                    total += m_functions[sym].exclusive;
+                }
+            }
+
+            std::sort(order.begin(), order.end(), [this, byExclusive](uint32_t a, uint32_t b) {
+                return byExclusive ? m_functions[a].exclusive > m_functions[b].exclusive
+                                   : m_functions[a].inclusive > m_functions[b].inclusive;
+            });
+
+            printf("events : %lu threads : %zu functions : %zu call paths : %zu addresses : %zu\n",
+                   (unsigned long)m_events, m_threads.size(), order.size(), m_nodes.size() - 1, m_symbolizer.addresses());
+            if (m_dropped || m_unmatched || m_unwound || m_open) {
+                printf("dropped : %lu unmatched exits : %lu unwound frames : %lu open at end : %lu\n",
+                       (unsigned long)m_dropped, (unsigned long)m_unmatched, (unsigned long)m_unwound, (unsigned long)m_open);
+            }
+
+            printf("%12s %14s %14s %7s %12s  %s\n", "calls", "incl ms", "excl ms", "excl %", "incl ns/call", "function");
+            for (size_t cnt = 0; (cnt < order.size()) && (cnt < top); cnt++) {
+                const Function& function = m_functions[order[cnt]];
+
+                printf("%12lu %14.3f %14.3f %7.2f %12.1f  %s\n", (unsigned long)function.calls,
+                       function.inclusive * nsPerTick / 1e6, function.exclusive * nsPerTick / 1e6,
+                       total ? 100.0 * function.exclusive / total : 0.0, function.inclusive * nsPerTick / function.calls,
+                       m_symbolizer.name(order[cnt]).c_str());
+            }
+        }
+
+        /**
+         * one line per call path "root;caller;callee <exclusive ns>", input of flamegraph.pl
+         */
+        bool writeFolded(const char* path, double nsPerTick)
+        {
+            FILE* file = fopen(path, "w");
+            std::vector<uint32_t> stack;
+            std::string line;
+
+            if (file == NULL) {
+                perror("CallProfile: fopen() failed");
+                return false;
+            }
+
+            for (uint32_t id = 1; id < m_nodes.size(); id++) {
+                const uint64_t ns = (uint64_t)(m_nodes[id].self * nsPerTick);
+
+                if (ns == 0) {
+                    continue;
+                }
+
+                stack.clear();
+                for (uint32_t node = id; node != 0; node = m_nodes[node].parent) {
+                    stack.push_back(m_nodes[node].sym);
+                }
+
+                line.clear();
+                for (auto it = stack.rbegin(); it != stack.rend(); it++) {
+                    if (!line.empty()) {
+                        line += ';';
+                    }
+                    line += m_symbolizer.name(*it);
+                }
+
+                fprintf(file, "%s %lu\n", line.c_str(), (unsigned long)ns);
+            }
+
+            fclose(file);
+
+            return true;
+        }
+
+    private:
+        struct Frame
+        {
+            uint64_t fn;
+            uint32_t sym;
+            uint32_t node;
+            uint64_t start;
+            uint64_t children;  /* inclusive time of the callees */
+        };
+
+        struct Node
+        {
+            uint32_t parent;
+            uint32_t sym;
+            uint32_t lastChildSym;      /* most recent child, saves the lookup in tight loops and recursion */
+            uint32_t lastChild;
+            uint64_t self;
+        };
+
+        struct Function
+        {
+            uint64_t calls = 0;
+            uint64_t inclusive = 0;     /* recursive calls are counted once */
+            uint64_t exclusive = 0;
+        };
+
+        struct Thread
+        {
+            std::vector<Frame> stack;
+            std::vector<uint32_t> active;       /* frames per function on the stack */
+            uint32_t root = 0;
+            uint64_t last = 0;
+        };
+
+        Thread& getThread(uint32_t tid)
+        {
+            if ((m_lastThread != nullptr) && (m_lastTid == tid)) {
+                return *m_lastThread;
+            }
+
+            auto it = m_threads.find(tid);
+            if (it == m_threads.end()) {
+                it = m_threads.emplace(tid, Thread()).first;
+                if (m_threadRoots) {
+                    it->second.root = child(0, m_symbolizer.intern("[" + std::to_string(tid) + "]"));
+                }
+            }
+
+            m_lastTid = tid;
+            m_lastThread = &it->second;
+
+            return it->second;
+        }
+
+        inline uint32_t child(uint32_t parent, uint32_t sym)
+        {
+            if (m_nodes[parent].lastChildSym == sym) {
+                return m_nodes[parent].lastChild;
+            }
+
+            const uint64_t key = ((uint64_t)parent << 32) | sym;
+            auto it = m_children.find(key);
+            uint32_t id;
+
+            if (it != m_children.end()) {
+                id = it->second;
+            }
+            else {
+                id = (uint32_t)m_nodes.size();
+                m_nodes.push_back(Node{parent, sym, UINT32_MAX, UINT32_MAX, 0});
+                m_children.emplace(key, id);
+            }
+
+            m_nodes[parent].lastChildSym = sym;
+            m_nodes[parent].lastChild = id;
+
+            return id;
+        }
+
+        inline void pop(Thread& thread, uint64_t ts)
+        {
+            const Frame& frame = thread.stack.back();
+            const uint64_t duration = ts > frame.start ? ts - frame.start : 0;
+            const uint64_t self = duration > frame.children ? duration - frame.children : 0;
+            Function& function = m_functions[frame.sym];
+
+            function.exclusive += self;
+            m_nodes[frame.node].self += self;
+            if (--thread.active[frame.sym] == 0) {
+                function.inclusive += duration;
+            }
+
+            thread.stack.pop_back();
+            if (!thread.stack.empty()) {
+                thread.stack.back().children += duration;
+            }
+        }
+
+    private:
+        Symbolizer& m_symbolizer;
+        const bool m_threadRoots;
+        std::vector<Node> m_nodes;
+        std::unordered_map<uint64_t, uint32_t> m_children;
+        std::vector<Function> m_functions;
+        std::unordered_map<uint32_t, Thread> m_threads;
+        uint32_t m_lastTid = 0;
+        Thread* m_lastThread = nullptr;
+        uint64_t m_events = 0;
+        uint64_t m_dropped = 0;
+        uint64_t m_unmatched = 0;
+        uint64_t m_unwound = 0;
+        uint64_t m_open = 0;
+};
@@ -0,0 +1,319 @@
+#pragma once
+
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <string>
+#include <vector>
+#include <unordered_map>
+#include <algorithm>
+#include <iterator>
+#include <cxxabi.h>
+#include <elf.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+/**
+ * Resolves function addresses of a traced process to names
+ *
+ * Modules are registered from a copy of /proc/<pid>/maps or from LTTng
+ * statedump events, the ELF symbol table of each file is read once. Every
+ * address is resolved only once, names are interned so an id stands for
+ * one function.
+ */
+class Symbolizer
+{
+    public:
+        Symbolizer()
+        {
+        }
+
+        virtual ~Symbolizer()
+        {
+        }
+
+        /**
+         * register a whole object loaded at baseAddress, as reported by the
+         * lttng_ust_statedump:bin_info and lttng_ust_dl:dlopen events
+         */
+        void addObject(const std::string& path, uint64_t baseAddress, uint64_t memSize)
+        {
+            Module module;
+
+            module.lo = baseAddress;
+            module.hi = baseAddress + memSize;
+            module.image = loadImage(path);
+            module.bias = m_images[module.image].dynamic ? baseAddress : 0;
+            m_modules.push_back(module);
+        }
+
+        /**
+         * parse the text of /proc/<pid>/maps, only executable file mappings are used
+         */
+        void addMaps(const char* text, size_t len)
+        {
+            std::string maps(text, len);
+            size_t pos = 0;
+
+            while (pos < maps.size()) {
+                size_t end = maps.find('\n', pos);
+                if (end == std::string::npos) {
+                    end = maps.size();
+                }
+
+                const std::string line = maps.substr(pos, end - pos);
+                unsigned long long lo, hi, offset;
+                char perms[8];
+                int pathPos = 0;
+
+                pos = end + 1;
+
+                if ((sscanf(line.c_str(), "%llx-%llx %7s %llx %*s %*s %n", &lo, &hi, perms, &offset, &pathPos) < 4) ||
+                    (perms[2] != 'x') || (pathPos == 0) || (line[pathPos] != '/')) {
+                    continue;
+                }
+
+                const std::string path = line.substr(pathPos);
+                const uint32_t image = loadImage(path);
+                Module module;
+
+                module.lo = lo;
+                module.hi = hi;
+                module.bias = lo - m_images[image].offsetToVaddr(offset);
+                module.image = image;
+                m_modules.push_back(module);
+            }
+        }
+
+        /**
+         * returns the id of the function containing address
+         */
+        inline uint32_t resolve(uint64_t address)
+        {
+            auto it = m_cache.find(address);
+            if (it != m_cache.end()) {
+                return it->second;
+            }
+
+            const uint32_t id = intern(lookup(address));
+            m_cache.emplace(address, id);
+
+            return id;
+        }
+
+        /**
+         * intern a name which is not a symbol, e.g. a thread label
+         */
+        uint32_t intern(const std::string& name)
+        {
+            auto it = m_ids.find(name);
+            if (it != m_ids.end()) {
+                return it->second;
+            }
+
+            const uint32_t id = (uint32_t)m_names.size();
+            m_names.push_back(name);
+            m_ids.emplace(name, id);
+
+            return id;
+        }
+
+        const std::string& name(uint32_t id) const
+        {
+            return m_names[id];
+        }
+
+        size_t size() const
+        {
+            return m_names.size();
+        }
+
+        size_t addresses() const
+        {
+            return m_cache.size();
+        }
+
+    private:
+        struct Symbol
+        {
+            uint64_t address;
+            uint64_t size;
+            uint32_t name;      /* offset into Image::strings */
+        };
+
+        struct Segment
+        {
+            uint64_t offset;
+            uint64_t vaddr;
+            uint64_t size;
+        };
+
+        struct Image
+        {
+            std::string path;
+            bool dynamic = false;       /* ET_DYN, addresses relative to the load base */
+            std::vector<Segment> segments;
+            std::vector<Symbol> symbols;
+            std::string strings;
+
+            uint64_t offsetToVaddr(uint64_t offset) const
+            {
+                for (const Segment& segment : segments) {
+                    /* mappings start page aligned, segments need not */
+                    if ((offset >= (segment.offset & ~(uint64_t)0xfff)) && (offset < segment.offset + segment.size)) {
+                        return offset - segment.offset + segment.vaddr;
+                    }
+                }
+
+                return offset;
+            }
+        };
+
+        struct Module
+        {
+            uint64_t lo;
+            uint64_t hi;
+            uint64_t bias;
+            uint32_t image;
+        };
+
+        uint32_t loadImage(const std::string& path)
+        {
+            for (uint32_t cnt = 0; cnt < m_images.size(); cnt++) {
+                if (m_images[cnt].path == path) {
+                    return cnt;
+                }
+            }
+
+            m_images.emplace_back();
+            Image& image = m_images.back();
+            image.path = path;
+            readElf(image);
+
+            return (uint32_t)(m_images.size() - 1);
+        }
+
+        static void readElf(Image& image)
+        {
+            struct stat st;
+            int fd;
+
+            if (((fd = open(image.path.c_str(), O_RDONLY | O_CLOEXEC)) == -1) || (fstat(fd, &st) == -1)) {
+                fprintf(stderr, "Symbolizer: cannot open %s, addresses stay unresolved\n", image.path.c_str());
+                if (fd != -1) {
+                    close(fd);
+                }
+                return;
+            }
+
+            const uint8_t* mem = (const uint8_t*)mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+            close(fd);
+            if (mem == MAP_FAILED) {
+                return;
+            }
+
+            const Elf64_Ehdr* ehdr = (const Elf64_Ehdr*)mem;
+            if (((size_t)st.st_size < sizeof(*ehdr)) || (memcmp(ehdr->e_ident, ELFMAG, SELFMAG) != 0) ||
+                (ehdr->e_ident[EI_CLASS] != ELFCLASS64)) {
+                munmap((void*)mem, st.st_size);
+                return;
+            }
+
+            image.dynamic = ehdr->e_type == ET_DYN;
+
+            const Elf64_Phdr* phdr = (const Elf64_Phdr*)&mem[ehdr->e_phoff];
+            for (uint32_t cnt = 0; cnt < ehdr->e_phnum; cnt++) {
+                if (phdr[cnt].p_type == PT_LOAD) {
+                    image.segments.push_back({phdr[cnt].p_offset, phdr[cnt].p_vaddr, phdr[cnt].p_filesz});
+                }
+            }
+
+            const Elf64_Shdr* shdr = (const Elf64_Shdr*)&mem[ehdr->e_shoff];
+            const Elf64_Shdr* symtab = NULL;
+
+            for (uint32_t cnt = 0; (ehdr->e_shoff != 0) && (cnt < ehdr->e_shnum); cnt++) {
+                if (shdr[cnt].sh_type == SHT_SYMTAB) {
+                    symtab = &shdr[cnt];
+                    break;
+                }
+                if ((shdr[cnt].sh_type == SHT_DYNSYM) && (symtab == NULL)) {
+                    symtab = &shdr[cnt];
+                }
+            }
+
+            if (symtab != NULL) {
+                const Elf64_Sym* sym = (const Elf64_Sym*)&mem[symtab->sh_offset];
+                const Elf64_Shdr& strtab = shdr[symtab->sh_link];
+                const size_t count = symtab->sh_size / sizeof(Elf64_Sym);
+
+                image.strings.assign((const char*)&mem[strtab.sh_offset], strtab.sh_size);
+
+                for (size_t cnt = 0; cnt < count; cnt++) {
+                    const int type = ELF64_ST_TYPE(sym[cnt].st_info);
+
+                    if (((type == STT_FUNC) || (type == STT_GNU_IFUNC)) && (sym[cnt].st_value != 0) &&
+                        (sym[cnt].st_name < strtab.sh_size)) {
+                        image.symbols.push_back({sym[cnt].st_value, sym[cnt].st_size, sym[cnt].st_name});
+                    }
+                }
+
+                std::sort(image.symbols.begin(), image.symbols.end(),
+                          [](const Symbol& a, const Symbol& b) { return a.address < b.address; });
+            }
+
+            munmap((void*)mem, st.st_size);
+        }
+
+        std::string lookup(uint64_t address) const
+        {
+            char hex[32];
+
+            snprintf(hex, sizeof(hex), "0x%llx", (unsigned long long)address);
+
+            for (const Module& module : m_modules) {
+                if ((address < module.lo) || (address >= module.hi)) {
+                    continue;
+                }
+
+                const Image& image = m_images[module.image];
+                const uint64_t vaddr = address - module.bias;
+                auto it = std::upper_bound(image.symbols.begin(), image.symbols.end(), vaddr,
+                                           [](uint64_t value, const Symbol& symbol) { return value < symbol.address; });
+
+                if ((it == image.symbols.begin()) ||
+                    ((std::prev(it)->size != 0) && (vaddr >= std::prev(it)->address + std::prev(it)->size))) {
+                    const char* base = strrchr(image.path.c_str(), '/');
+                    snprintf(hex, sizeof(hex), "0x%llx", (unsigned long long)vaddr);
+                    return std::string(base ? base + 1 : image.path.c_str()) + "+" + hex;
+                }
+
+                return demangle(&image.strings[std::prev(it)->name]);
+            }
+
+            return hex;
+        }
+
+        static std::string demangle(const char* mangled)
+        {
+            int status = 0;
+            char* demangled = abi::__cxa_demangle(mangled, NULL, NULL, &status);
+            std::string name = (status == 0) && demangled ? demangled : mangled;
+
+            free(demangled);
+
+            /* folded stacks use ';' as separator */
+            std::replace(name.begin(), name.end(), ';', ':');
+
+            return name;
+        }
+
+    private:
+        std::vector<Image> m_images;
+        std::vector<Module> m_modules;
+        std::unordered_map<uint64_t, uint32_t> m_cache;
+        std::unordered_map<std::string, uint32_t> m_ids;
+        std::vector<std::string> m_names;
+};
@@ -0,0 +1,87 @@
+/**
+ * overhead of the cyg-collector per instrumented call, using the
+ * fibonacci of lttng-ust/func-entry-exit
+ * build with make, compiled with -finstrument-functions and linked with the collector
+ *
+ * usage: CYG_COLLECTOR_RING=4194304 cyg-bench [n] [runs]   (default 25 10)
+ * the ring must hold a whole run, otherwise events are dropped (see cyg-dump -s)
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <time.h>
+
+#include "cyg-collector.h"
+
+__attribute__((noinline)) int fibonacci(int i)
+{
+    if (i == 0) {
+        return 0;
+    }
+
+    if (i == 1) {
+        return 1;
+    }
+
+    return fibonacci(i-1) + fibonacci(i-2);
+}
+
+/* same function without the enter/exit hooks as reference */
+__attribute__((noinline, no_instrument_function)) int fibonacci_plain(int i)
+{
+    if (i == 0) {
+        return 0;
+    }
+
+    if (i == 1) {
+        return 1;
+    }
+
+    return fibonacci_plain(i-1) + fibonacci_plain(i-2);
+}
+
+static __attribute__((no_instrument_function)) uint64_t now_ns(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+
+    return (uint64_t)ts.tv_sec * 1000000000ull + ts.tv_nsec;
+}
+
+int main(int argc, char *argv[])
+{
+    int n = argc > 1 ? atoi(argv[1]) : 25;
+    int runs = argc > 2 ? atoi(argv[2]) : 10;
+    uint64_t best_plain = UINT64_MAX;
+    uint64_t best_instr = UINT64_MAX;
+    volatile int sink;
+
+    /* calls of the recursion: 2 * fib(n + 1) - 1 */
+    const uint64_t calls = 2 * (uint64_t)fibonacci_plain(n + 1) - 1;
+
+    for (int run = 0; run < runs; run++) {
+        uint64_t start = now_ns();
+        sink = fibonacci_plain(n);
+        uint64_t plain = now_ns() - start;
+
+        start = now_ns();
+        sink = fibonacci(n);
+        uint64_t instr = now_ns() - start;
+
+        /* drain outside of the measured section */
+        cyg_collector_flush();
+
+        best_plain = plain < best_plain ? plain : best_plain;
+        best_instr = instr < best_instr ? instr : best_instr;
+    }
+
+    (void)sink;
+
+    printf("fibonacci(%d) : %lu calls\n", n, (unsigned long)calls);
+    printf("plain         : %8.2f ns/call\n", (double)best_plain / calls);
+    printf("instrumented  : %8.2f ns/call\n", (double)best_instr / calls);
+    printf("overhead      : %8.2f ns/call (enter + exit)\n", ((double)best_instr - best_plain) / calls);
+
+    return 0;
+}
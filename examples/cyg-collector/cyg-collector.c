@@ -0,0 +1,423 @@
+/**
+ * In-process collector for -finstrument-functions
+ *
+ * Implements __cyg_profile_func_enter/exit. Every thread gets its own
+ * lock-free single producer ring of (tsc, function address | exit) events,
+ * a background thread drains all rings into a compact file.
+ *
+ * build:  see Makefile, link with -lcyg-collector or LD_PRELOAD=libcyg-collector.so
+ * env:    CYG_COLLECTOR_FILE    output file (default cyg-<pid>.trace)
+ *         CYG_COLLECTOR_RING    events per thread ring, power of two (default 65536)
+ *         CYG_COLLECTOR_FILTER  allow/deny rules (see cyg-filter.h), reloaded on
+ *                               CYG_COLLECTOR_SIGNAL (default SIGUSR2)
+ */
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <errno.h>
+#include <time.h>
+#include <pthread.h>
+#include <signal.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+
+#include "cyg-collector.h"
+#include "cyg-filter.h"
+
+#define CYG_NOINSTR             __attribute__((no_instrument_function))
+#define CYG_LIKELY(x)           __builtin_expect(!!(x), 1)
+#define CYG_UNLIKELY(x)         __builtin_expect(!!(x), 0)
+
+#define CYG_DEFAULT_RING        (1 << 16)   /* events per thread */
+#define CYG_FLUSH_INTERVAL_US   1000
+#define CYG_MAX_EVENT_BYTES     20          /* two varints of at most 10 bytes */
+#define CYG_MAX_MAPS            (1 << 20)
+#define CYG_CALIBRATE_NS        10000000    /* 10ms */
+
+struct cyg_event {
+    uint64_t tsc;
+    uintptr_t fn;               /* bit 0 set on exit */
+};
+
+struct cyg_ring {
+    struct cyg_ring* next;
+    uint32_t tid;
+    uint64_t dropped;           /* written by the owning thread */
+    uint64_t dropped_flushed;   /* written by the flusher       */
+    uint64_t head __attribute__((aligned(64)));
+    uint64_t tail __attribute__((aligned(64)));
+    struct cyg_event events[] __attribute__((aligned(64)));
+};
+
+static struct cyg_ring* cyg_rings;
+static __thread struct cyg_ring* cyg_tls_ring __attribute__((tls_model("initial-exec")));
+static uint64_t cyg_ring_size = CYG_DEFAULT_RING;
+static int cyg_active;
+static int cyg_running;
+static int cyg_fd = -1;
+static uint64_t cyg_tsc_hz;
+static pthread_t cyg_flusher;
+static pthread_mutex_t cyg_flush_lock = PTHREAD_MUTEX_INITIALIZER;
+static uint8_t* cyg_chunk;
+static struct cyg_filter* cyg_filter_active;
+static const char* cyg_filter_path;
+static volatile sig_atomic_t cyg_filter_reload;
+
+static inline CYG_NOINSTR uint64_t cyg_tsc(void)
+{
+#if defined(__x86_64__) || defined(__i386__)
+    uint32_t lo, hi;
+
+    __asm__ __volatile__("rdtsc" : "=a"(lo), "=d"(hi));
+
+    return ((uint64_t)hi << 32) | lo;
+#else
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+
+    return (uint64_t)ts.tv_sec * 1000000000ull + ts.tv_nsec;
+#endif
+}
+
+static CYG_NOINSTR uint64_t cyg_now_ns(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+
+    return (uint64_t)ts.tv_sec * 1000000000ull + ts.tv_nsec;
+}
+
+static CYG_NOINSTR uint64_t cyg_calibrate(void)
+{
+#if defined(__x86_64__) || defined(__i386__)
+    struct timespec req = { .tv_sec = 0, .tv_nsec = CYG_CALIBRATE_NS };
+    uint64_t t0 = cyg_now_ns();
+    uint64_t c0 = cyg_tsc();
+
+    while (nanosleep(&req, &req) && (errno == EINTR));
+
+    uint64_t c1 = cyg_tsc();
+    uint64_t t1 = cyg_now_ns();
+
+    return (uint64_t)((double)(c1 - c0) * 1e9 / (double)(t1 - t0));
+#else
+    return 1000000000ull;
+#endif
+}
+
+static CYG_NOINSTR struct cyg_ring* cyg_ring_register(void)
+{
+    size_t size = sizeof(struct cyg_ring) + cyg_ring_size * sizeof(struct cyg_event);
+    struct cyg_ring* ring;
+
+    /* no malloc, the allocator may be instrumented or interposed */
+    ring = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_POPULATE, -1, 0);
+    if (ring == MAP_FAILED) {
+        return NULL;
+    }
+
+    ring->tid = (uint32_t)syscall(SYS_gettid);
+
+    /* push only list, rings live until exit */
+    ring->next = __atomic_load_n(&cyg_rings, __ATOMIC_RELAXED);
+    while (!__atomic_compare_exchange_n(&cyg_rings, &ring->next, ring, 1, __ATOMIC_RELEASE, __ATOMIC_RELAXED));
+
+    return ring;
+}
+
+static inline CYG_NOINSTR void cyg_record(void* fn, uintptr_t exit)
+{
+    const struct cyg_filter* filter = __atomic_load_n(&cyg_filter_active, __ATOMIC_ACQUIRE);
+    struct cyg_ring* ring = cyg_tls_ring;
+
+    if (filter && !cyg_filter_enabled(filter, (uintptr_t)fn)) {
+        return;
+    }
+
+    if (CYG_UNLIKELY(ring == NULL)) {
+        if (!__atomic_load_n(&cyg_active, __ATOMIC_RELAXED)) {
+            return;
+        }
+        if ((ring = cyg_tls_ring = cyg_ring_register()) == NULL) {
+            return;
+        }
+    }
+
+    uint64_t head = ring->head;
+
+    if (CYG_UNLIKELY((head - __atomic_load_n(&ring->tail, __ATOMIC_ACQUIRE)) >= cyg_ring_size)) {
+        ring->dropped++;
+        return;
+    }
+
+    struct cyg_event* event = &ring->events[head & (cyg_ring_size - 1)];
+    event->tsc = cyg_tsc();
+    event->fn = (uintptr_t)fn | exit;
+
+    __atomic_store_n(&ring->head, head + 1, __ATOMIC_RELEASE);
+}
+
+CYG_NOINSTR void __cyg_profile_func_enter(void* fn, void* call_site)
+{
+    (void)call_site;
+    cyg_record(fn, 0);
+}
+
+CYG_NOINSTR void __cyg_profile_func_exit(void* fn, void* call_site)
+{
+    (void)call_site;
+    cyg_record(fn, 1);
+}
+
+static inline CYG_NOINSTR size_t cyg_put_varint(uint8_t* out, uint64_t value)
+{
+    size_t len = 0;
+
+    while (value >= 0x80) {
+        out[len++] = (uint8_t)(value | 0x80);
+        value >>= 7;
+    }
+    out[len++] = (uint8_t)value;
+
+    return len;
+}
+
+static CYG_NOINSTR void cyg_write_all(const void* buffer, size_t size)
+{
+    const char* ptr = buffer;
+
+    while (size > 0) {
+        ssize_t len = write(cyg_fd, ptr, size);
+        if (len == -1) {
+            if (errno == EINTR) {
+                continue;
+            }
+            perror("cyg-collector: write() failed");
+            return;
+        }
+        ptr += len;
+        size -= len;
+    }
+}
+
+static CYG_NOINSTR void cyg_flush_ring(struct cyg_ring* ring)
+{
+    struct cyg_chunk_header* chunk = (struct cyg_chunk_header*)cyg_chunk;
+    uint64_t head = __atomic_load_n(&ring->head, __ATOMIC_ACQUIRE);
+    uint64_t tail = ring->tail;
+    uint64_t dropped = __atomic_load_n(&ring->dropped, __ATOMIC_RELAXED);
+
+    if ((head == tail) && (dropped == ring->dropped_flushed)) {
+        return;
+    }
+
+    uint8_t* out = cyg_chunk + sizeof(struct cyg_chunk_header);
+    size_t len = 0;
+    uint64_t prev_tsc = head != tail ? ring->events[tail & (cyg_ring_size - 1)].tsc : 0;
+    uintptr_t prev_fn = 0;
+
+    chunk->magic = CYG_CHUNK_MAGIC;
+    chunk->tid = ring->tid;
+    chunk->count = (uint32_t)(head - tail);
+    chunk->base_tsc = prev_tsc;
+    chunk->dropped = dropped - ring->dropped_flushed;
+
+    for (; tail != head; tail++) {
+        const struct cyg_event* event = &ring->events[tail & (cyg_ring_size - 1)];
+        const uintptr_t fn = event->fn & ~(uintptr_t)1;
+        const int64_t fn_delta = (int64_t)(fn - prev_fn);
+
+        len += cyg_put_varint(&out[len], ((event->tsc - prev_tsc) << 1) | (event->fn & 1));
+        len += cyg_put_varint(&out[len], ((uint64_t)fn_delta << 1) ^ (uint64_t)(fn_delta >> 63));
+        prev_tsc = event->tsc;
+        prev_fn = fn;
+    }
+
+    /* events are copied, hand the slots back before the write */
+    __atomic_store_n(&ring->tail, tail, __ATOMIC_RELEASE);
+    ring->dropped_flushed = dropped;
+
+    chunk->bytes = (uint32_t)len;
+    cyg_write_all(cyg_chunk, sizeof(struct cyg_chunk_header) + len);
+}
+
+CYG_NOINSTR void cyg_collector_flush(void)
+{
+    pthread_mutex_lock(&cyg_flush_lock);
+
+    if (cyg_fd != -1) {
+        for (struct cyg_ring* ring = __atomic_load_n(&cyg_rings, __ATOMIC_ACQUIRE); ring; ring = ring->next) {
+            cyg_flush_ring(ring);
+        }
+    }
+
+    pthread_mutex_unlock(&cyg_flush_lock);
+}
+
+static CYG_NOINSTR void cyg_filter_signal(int signum)
+{
+    (void)signum;
+    cyg_filter_reload = 1;
+}
+
+/**
+ * called on the flusher thread, the old bitmap is retired and never freed as
+ * a hook may still be reading it
+ */
+static CYG_NOINSTR void cyg_filter_update(void)
+{
+    struct cyg_filter* filter = cyg_filter_load(cyg_filter_path);
+
+    if (filter == NULL) {
+        fprintf(stderr, "cyg-collector: filter %s not loaded, keeping the previous one\n", cyg_filter_path);
+        return;
+    }
+
+    fprintf(stderr, "cyg-collector: filter %s : %u rules, %u functions %s\n", cyg_filter_path, filter->rules,
+            filter->matched, filter->default_enabled ? "disabled" : "enabled");
+
+    filter->retired = cyg_filter_active;
+    __atomic_store_n(&cyg_filter_active, filter, __ATOMIC_RELEASE);
+}
+
+static CYG_NOINSTR void* cyg_flusher_func(void* arg)
+{
+    struct timespec req = { .tv_sec = 0, .tv_nsec = CYG_FLUSH_INTERVAL_US * 1000 };
+
+    (void)arg;
+    pthread_setname_np(pthread_self(), "cyg_flusher");
+
+    while (__atomic_load_n(&cyg_running, __ATOMIC_ACQUIRE)) {
+        nanosleep(&req, NULL);
+        if (cyg_filter_reload) {
+            cyg_filter_reload = 0;
+            cyg_filter_update();
+        }
+        cyg_collector_flush();
+    }
+
+    return NULL;
+}
+
+static CYG_NOINSTR char* cyg_read_maps(uint32_t* len)
+{
+    char* maps = malloc(CYG_MAX_MAPS);
+    int fd = open("/proc/self/maps", O_RDONLY);
+    ssize_t ret;
+
+    *len = 0;
+
+    if ((maps == NULL) || (fd == -1)) {
+        free(maps);
+        if (fd != -1) {
+            close(fd);
+        }
+        return NULL;
+    }
+
+    while ((*len < CYG_MAX_MAPS) && ((ret = read(fd, maps + *len, CYG_MAX_MAPS - *len)) > 0)) {
+        *len += ret;
+    }
+
+    close(fd);
+
+    return maps;
+}
+
+static CYG_NOINSTR __attribute__((constructor(101))) void cyg_collector_init(void)
+{
+    struct cyg_file_header header;
+    char path[256];
+    const char* env;
+    char* maps;
+
+    if ((env = getenv("CYG_COLLECTOR_RING")) != NULL) {
+        uint64_t size = strtoull(env, NULL, 0);
+        if ((size >= 2) && ((size & (size - 1)) == 0)) {
+            cyg_ring_size = size;
+        }
+        else {
+            fprintf(stderr, "cyg-collector: CYG_COLLECTOR_RING must be a power of two, using %lu\n",
+                    (unsigned long)cyg_ring_size);
+        }
+    }
+
+    if ((env = getenv("CYG_COLLECTOR_FILE")) != NULL) {
+        snprintf(path, sizeof(path), "%s", env);
+    }
+    else {
+        snprintf(path, sizeof(path), "cyg-%d.trace", getpid());
+    }
+
+    cyg_chunk = malloc(sizeof(struct cyg_chunk_header) + cyg_ring_size * CYG_MAX_EVENT_BYTES);
+    cyg_fd = open(path, O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+    if ((cyg_chunk == NULL) || (cyg_fd == -1)) {
+        perror("cyg-collector: init failed");
+        if (cyg_fd != -1) {
+            close(cyg_fd);
+            cyg_fd = -1;
+        }
+        return;
+    }
+
+    if ((cyg_filter_path = getenv("CYG_COLLECTOR_FILTER")) != NULL) {
+        struct sigaction action;
+        const char* signal_env = getenv("CYG_COLLECTOR_SIGNAL");
+
+        cyg_filter_update();
+
+        memset(&action, 0, sizeof(action));
+        action.sa_handler = cyg_filter_signal;
+        action.sa_flags = SA_RESTART;
+        sigemptyset(&action.sa_mask);
+        if (sigaction(signal_env ? atoi(signal_env) : SIGUSR2, &action, NULL) == -1) {
+            perror("cyg-collector: sigaction() failed");
+        }
+    }
+
+    cyg_tsc_hz = cyg_calibrate();
+    maps = cyg_read_maps(&header.maps_len);
+
+    header.magic = CYG_FILE_MAGIC;
+    header.version = CYG_FILE_VERSION;
+    header.tsc_hz = cyg_tsc_hz;
+    header.pid = getpid();
+    cyg_write_all(&header, sizeof(header));
+    if (maps) {
+        cyg_write_all(maps, header.maps_len);
+        free(maps);
+    }
+
+    __atomic_store_n(&cyg_running, 1, __ATOMIC_RELEASE);
+    if (pthread_create(&cyg_flusher, NULL, cyg_flusher_func, NULL) != 0) {
+        perror("cyg-collector: pthread_create() failed");
+        __atomic_store_n(&cyg_running, 0, __ATOMIC_RELEASE);
+    }
+
+    __atomic_store_n(&cyg_active, 1, __ATOMIC_RELEASE);
+}
+
+static CYG_NOINSTR __attribute__((destructor(101))) void cyg_collector_fini(void)
+{
+    __atomic_store_n(&cyg_active, 0, __ATOMIC_RELEASE);
+
+    if (__atomic_load_n(&cyg_running, __ATOMIC_ACQUIRE)) {
+        __atomic_store_n(&cyg_running, 0, __ATOMIC_RELEASE);
+        pthread_join(cyg_flusher, NULL);
+    }
+
+    cyg_collector_flush();
+
+    pthread_mutex_lock(&cyg_flush_lock);
+    if (cyg_fd != -1) {
+        close(cyg_fd);
+        cyg_fd = -1;
+    }
+    pthread_mutex_unlock(&cyg_flush_lock);
+}
@@ -0,0 +1,51 @@
+/**
+ * in-process collector for -finstrument-functions
+ *
+ * file layout:
+ *   struct cyg_file_header
+ *   maps text (header.maps_len bytes, copy of /proc/self/maps for symbolization)
+ *   chunks, each struct cyg_chunk_header followed by header.bytes of events
+ *
+ * events of a chunk belong to one thread and are encoded as
+ *   varint(((tsc - prev_tsc) << 1) | exit)
+ *   varint(zigzag(fn - prev_fn))
+ * prev_tsc starts at chunk.base_tsc, prev_fn at 0.
+ */
+#ifndef _CYG_COLLECTOR_H
+#define _CYG_COLLECTOR_H
+
+#include <stdint.h>
+
+#define CYG_FILE_MAGIC          0x46475943  /* 'CYGF' */
+#define CYG_CHUNK_MAGIC         0x43475943  /* 'CYGC' */
+#define CYG_FILE_VERSION        1
+
+struct cyg_file_header {
+    uint32_t magic;
+    uint32_t version;
+    uint64_t tsc_hz;            /* ticks per second, calibrated at startup */
+    int32_t pid;
+    uint32_t maps_len;
+};
+
+struct cyg_chunk_header {
+    uint32_t magic;
+    uint32_t tid;
+    uint32_t count;
+    uint32_t bytes;
+    uint64_t base_tsc;
+    uint64_t dropped;           /* events lost on this thread since the previous chunk */
+};
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/* drain all thread rings to the file now, also done periodically and at exit */
+void cyg_collector_flush(void);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* _CYG_COLLECTOR_H */
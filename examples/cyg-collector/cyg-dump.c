@@ -0,0 +1,118 @@
+/**
+ * prints the events of a file written by the cyg-collector
+ * build with make
+ *
+ * usage: cyg-dump [-s] <file>   (-s: per thread summary only)
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include "cyg-collector.h"
+
+static uint64_t get_varint(const uint8_t* in, size_t* offset)
+{
+    uint64_t value = 0;
+    int shift = 0;
+    uint8_t byte;
+
+    do {
+        byte = in[(*offset)++];
+        value |= (uint64_t)(byte & 0x7f) << shift;
+        shift += 7;
+    } while ((byte & 0x80) && (shift < 64));
+
+    return value;
+}
+
+int main(int argc, char *argv[])
+{
+    int summary = 0;
+    const char* path;
+    struct stat st;
+    int fd;
+
+    if ((argc == 3) && (strcmp(argv[1], "-s") == 0)) {
+        summary = 1;
+        path = argv[2];
+    }
+    else if (argc == 2) {
+        path = argv[1];
+    }
+    else {
+        fprintf(stderr, "usage: %s [-s] <file>\n", argv[0]);
+        return 1;
+    }
+
+    if (((fd = open(path, O_RDONLY)) == -1) || (fstat(fd, &st) == -1)) {
+        perror("open() failed");
+        return 1;
+    }
+
+    const uint8_t* mem = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    if (mem == MAP_FAILED) {
+        perror("mmap() failed");
+        return 1;
+    }
+
+    const struct cyg_file_header* header = (const struct cyg_file_header*)mem;
+    if (((size_t)st.st_size < sizeof(*header)) || (header->magic != CYG_FILE_MAGIC) ||
+        (header->version != CYG_FILE_VERSION)) {
+        fprintf(stderr, "%s: not a cyg-collector file\n", path);
+        return 1;
+    }
+
+    printf("pid : %d tsc : %lu Hz maps : %u bytes\n", header->pid, (unsigned long)header->tsc_hz, header->maps_len);
+
+    size_t offset = sizeof(*header) + header->maps_len;
+    uint64_t events = 0;
+    uint64_t dropped = 0;
+    uint64_t chunks = 0;
+
+    while (offset + sizeof(struct cyg_chunk_header) <= (size_t)st.st_size) {
+        const struct cyg_chunk_header* chunk = (const struct cyg_chunk_header*)&mem[offset];
+
+        if (chunk->magic != CYG_CHUNK_MAGIC) {
+            fprintf(stderr, "corrupt chunk at offset %zu\n", offset);
+            break;
+        }
+
+        offset += sizeof(*chunk);
+        chunks++;
+        events += chunk->count;
+        dropped += chunk->dropped;
+
+        if (chunk->dropped && !summary) {
+            printf("%u: %lu events dropped\n", chunk->tid, (unsigned long)chunk->dropped);
+        }
+
+        if (!summary) {
+            size_t pos = offset;
+            uint64_t tsc = chunk->base_tsc;
+            uintptr_t fn = 0;
+
+            for (uint32_t cnt = 0; cnt < chunk->count; cnt++) {
+                uint64_t value = get_varint(mem, &pos);
+                uint64_t delta = get_varint(mem, &pos);
+
+                tsc += value >> 1;
+                fn += (uintptr_t)((int64_t)(delta >> 1) ^ -(int64_t)(delta & 1));
+                printf("%u %.9f %s %p\n", chunk->tid, (double)tsc / header->tsc_hz, (value & 1) ? "exit " : "enter", (void*)fn);
+            }
+        }
+
+        offset += chunk->bytes;
+    }
+
+    printf("chunks : %lu events : %lu dropped : %lu\n", (unsigned long)chunks, (unsigned long)events, (unsigned long)dropped);
+
+    munmap((void*)mem, st.st_size);
+    close(fd);
+
+    return 0;
+}
@@ -0,0 +1,246 @@
+/**
+ * Builds the per function enable bitmap of the cyg-collector
+ *
+ * The rules are matched against the function symbols of every loaded
+ * module (.symtab, .dynsym for stripped files), the result is a bitmap per
+ * executable segment so the hooks test a bit instead of looking up names.
+ */
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <fnmatch.h>
+#include <elf.h>
+#include <link.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include "cyg-filter.h"
+
+#define CYG_NOINSTR             __attribute__((no_instrument_function))
+
+#define CYG_FILTER_MAX_RULES    1024
+#define CYG_FILTER_MAX_LINE     1024
+
+struct cyg_filter_rule {
+    int allow;
+    char* glob;
+};
+
+struct cyg_filter_ctx {
+    struct cyg_filter* filter;
+    struct cyg_filter_rule* rules;
+    uint32_t rule_count;
+};
+
+static CYG_NOINSTR int cyg_filter_match(const struct cyg_filter_ctx* ctx, const char* name)
+{
+    int enabled = ctx->filter->default_enabled;
+
+    for (uint32_t cnt = 0; cnt < ctx->rule_count; cnt++) {
+        if (fnmatch(ctx->rules[cnt].glob, name, 0) == 0) {
+            enabled = ctx->rules[cnt].allow;
+        }
+    }
+
+    return enabled;
+}
+
+/**
+ * apply the rules to the function symbols of one module, returns the number
+ * of functions which differ from the default
+ */
+static CYG_NOINSTR uint32_t cyg_filter_module_symbols(const struct cyg_filter_ctx* ctx, struct cyg_filter_module* module,
+                                                      const char* path, uintptr_t base)
+{
+    struct stat st;
+    uint32_t matched = 0;
+    int fd;
+
+    if (((fd = open(path, O_RDONLY | O_CLOEXEC)) == -1) || (fstat(fd, &st) == -1)) {
+        if (fd != -1) {
+            close(fd);
+        }
+        return 0;
+    }
+
+    const uint8_t* mem = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (mem == MAP_FAILED) {
+        return 0;
+    }
+
+    const ElfW(Ehdr)* ehdr = (const ElfW(Ehdr)*)mem;
+    if (((size_t)st.st_size < sizeof(*ehdr)) || (memcmp(ehdr->e_ident, ELFMAG, SELFMAG) != 0) ||
+        (ehdr->e_shoff == 0) || (ehdr->e_shoff + (size_t)ehdr->e_shnum * sizeof(ElfW(Shdr)) > (size_t)st.st_size)) {
+        munmap((void*)mem, st.st_size);
+        return 0;
+    }
+
+    const ElfW(Shdr)* shdr = (const ElfW(Shdr)*)&mem[ehdr->e_shoff];
+    const ElfW(Shdr)* symtab = NULL;
+
+    for (uint32_t cnt = 0; cnt < ehdr->e_shnum; cnt++) {
+        if (shdr[cnt].sh_type == SHT_SYMTAB) {
+            symtab = &shdr[cnt];
+            break;
+        }
+        if ((shdr[cnt].sh_type == SHT_DYNSYM) && (symtab == NULL)) {
+            symtab = &shdr[cnt];
+        }
+    }
+
+    if ((symtab != NULL) && (symtab->sh_link < ehdr->e_shnum)) {
+        const ElfW(Sym)* sym = (const ElfW(Sym)*)&mem[symtab->sh_offset];
+        const char* strtab = (const char*)&mem[shdr[symtab->sh_link].sh_offset];
+        const size_t strsize = shdr[symtab->sh_link].sh_size;
+        const size_t count = symtab->sh_size / sizeof(ElfW(Sym));
+
+        for (size_t cnt = 0; cnt < count; cnt++) {
+            const uintptr_t fn = base + sym[cnt].st_value;
+
+            if ((ELF64_ST_TYPE(sym[cnt].st_info) != STT_FUNC) || (sym[cnt].st_value == 0) ||
+                (sym[cnt].st_name >= strsize) || (fn < module->lo) || (fn >= module->hi)) {
+                continue;
+            }
+
+            const int enabled = cyg_filter_match(ctx, &strtab[sym[cnt].st_name]);
+            const uintptr_t index = (fn - module->lo) >> CYG_FILTER_SHIFT;
+
+            if (enabled != ctx->filter->default_enabled) {
+                matched++;
+            }
+
+            if (enabled) {
+                module->bits[index >> 6] |= (uint64_t)1 << (index & 63);
+            }
+            else {
+                module->bits[index >> 6] &= ~((uint64_t)1 << (index & 63));
+            }
+        }
+    }
+
+    munmap((void*)mem, st.st_size);
+
+    return matched;
+}
+
+static CYG_NOINSTR int cyg_filter_module_cb(struct dl_phdr_info* info, size_t size, void* data)
+{
+    struct cyg_filter_ctx* ctx = data;
+    struct cyg_filter* filter = ctx->filter;
+    const char* path = info->dlpi_name[0] ? info->dlpi_name : "/proc/self/exe";
+
+    (void)size;
+
+    for (int cnt = 0; cnt < info->dlpi_phnum; cnt++) {
+        const ElfW(Phdr)* phdr = &info->dlpi_phdr[cnt];
+
+        if ((phdr->p_type != PT_LOAD) || !(phdr->p_flags & PF_X) || (phdr->p_memsz == 0)) {
+            continue;
+        }
+
+        if (filter->count == CYG_FILTER_MAX_MODULES) {
+            fprintf(stderr, "cyg-collector: more than %d executable segments, %s not filtered\n", CYG_FILTER_MAX_MODULES, path);
+            return 0;
+        }
+
+        struct cyg_filter_module* module = &filter->modules[filter->count];
+        const size_t words = ((phdr->p_memsz >> CYG_FILTER_SHIFT) + 64) / 64;
+
+        module->lo = info->dlpi_addr + phdr->p_vaddr;
+        module->hi = module->lo + phdr->p_memsz;
+        module->bits = malloc(words * sizeof(uint64_t));
+        if (module->bits == NULL) {
+            return 0;
+        }
+        memset(module->bits, filter->default_enabled ? 0xff : 0x00, words * sizeof(uint64_t));
+
+        const uint32_t matched = cyg_filter_module_symbols(ctx, module, path, info->dlpi_addr);
+        if (matched == 0) {
+            /* same as the default, the hooks need not look at it */
+            free(module->bits);
+            continue;
+        }
+
+        filter->matched += matched;
+        filter->count++;
+    }
+
+    return 0;
+}
+
+static CYG_NOINSTR uint32_t cyg_filter_read_rules(const char* path, struct cyg_filter_rule* rules)
+{
+    char line[CYG_FILTER_MAX_LINE];
+    uint32_t count = 0;
+    FILE* file;
+
+    if ((file = fopen(path, "re")) == NULL) {
+        perror("cyg-collector: cannot open filter");
+        return UINT32_MAX;
+    }
+
+    while (fgets(line, sizeof(line), file) != NULL) {
+        char* glob = line + strspn(line, " \t");
+        int allow = 1;
+
+        glob[strcspn(glob, "\r\n")] = '\0';
+        if ((glob[0] == '\0') || (glob[0] == '#')) {
+            continue;
+        }
+
+        if ((glob[0] == '+') || (glob[0] == '-')) {
+            allow = glob[0] == '+';
+            glob++;
+        }
+
+        if (count == CYG_FILTER_MAX_RULES) {
+            fprintf(stderr, "cyg-collector: more than %d rules in %s, ignoring the rest\n", CYG_FILTER_MAX_RULES, path);
+            break;
+        }
+
+        rules[count].allow = allow;
+        rules[count].glob = strdup(glob);
+        count++;
+    }
+
+    fclose(file);
+
+    return count;
+}
+
+CYG_NOINSTR struct cyg_filter* cyg_filter_load(const char* path)
+{
+    struct cyg_filter_ctx ctx;
+
+    ctx.filter = calloc(1, sizeof(struct cyg_filter));
+    ctx.rules = calloc(CYG_FILTER_MAX_RULES, sizeof(struct cyg_filter_rule));
+    if ((ctx.filter == NULL) || (ctx.rules == NULL)) {
+        free(ctx.filter);
+        free(ctx.rules);
+        return NULL;
+    }
+
+    ctx.rule_count = cyg_filter_read_rules(path, ctx.rules);
+    if (ctx.rule_count == UINT32_MAX) {
+        free(ctx.filter);
+        free(ctx.rules);
+        return NULL;
+    }
+
+    ctx.filter->rules = ctx.rule_count;
+    ctx.filter->default_enabled = (ctx.rule_count == 0) || !ctx.rules[0].allow;
+
+    dl_iterate_phdr(cyg_filter_module_cb, &ctx);
+
+    for (uint32_t cnt = 0; cnt < ctx.rule_count; cnt++) {
+        free(ctx.rules[cnt].glob);
+    }
+    free(ctx.rules);
+
+    return ctx.filter;
+}
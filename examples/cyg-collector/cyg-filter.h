@@ -0,0 +1,51 @@
+/**
+ * per function enable bitmap of the cyg-collector
+ *
+ * rules file, one rule per line, evaluated in order, the last match wins:
+ *   +glob   record functions whose symbol matches (fnmatch, mangled names)
+ *   -glob   do not record them
+ *   # ...   comment
+ * functions nobody matched are recorded unless the first rule is an allow rule.
+ */
+#ifndef _CYG_FILTER_H
+#define _CYG_FILTER_H
+
+#include <stdint.h>
+
+#define CYG_FILTER_MAX_MODULES  64
+#define CYG_FILTER_SHIFT        2       /* one bit per 4 bytes of text, functions start at least that far apart */
+
+struct cyg_filter_module {
+    uintptr_t lo;               /* executable segment [lo, hi) */
+    uintptr_t hi;
+    uint64_t* bits;             /* 1: record, indexed by (fn - lo) >> CYG_FILTER_SHIFT */
+};
+
+struct cyg_filter {
+    struct cyg_filter* retired;         /* previous filter, never freed as a hook may still read it */
+    int default_enabled;
+    uint32_t rules;
+    uint32_t matched;                   /* functions which differ from the default */
+    uint32_t count;
+    struct cyg_filter_module modules[CYG_FILTER_MAX_MODULES];
+};
+
+/* build the bitmap of all loaded modules from a rules file, NULL on error */
+struct cyg_filter* cyg_filter_load(const char* path);
+
+static inline __attribute__((no_instrument_function)) int cyg_filter_enabled(const struct cyg_filter* filter, uintptr_t fn)
+{
+    for (uint32_t cnt = 0; cnt < filter->count; cnt++) {
+        const struct cyg_filter_module* module = &filter->modules[cnt];
+
+        if ((fn >= module->lo) && (fn < module->hi)) {
+            const uintptr_t index = (fn - module->lo) >> CYG_FILTER_SHIFT;
+
+            return (module->bits[index >> 6] >> (index & 63)) & 1;
+        }
+    }
+
+    return filter->default_enabled;
+}
+
+#endif /* _CYG_FILTER_H */
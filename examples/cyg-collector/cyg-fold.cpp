@@ -0,0 +1,349 @@
+/**
+ * call profile and folded stacks from function enter/exit traces
+ * build with make
+ *
+ * input is either a file of the cyg-collector or, when built with
+ * babeltrace2, an LTTng trace directory recorded with liblttng-ust-cyg-profile.so
+ * (see lttng/lttng-ust/func-entry-exit/traceme.sh, needs the vtid context)
+ *
+ * usage: cyg-fold [-f folded] [-n top] [-x] [-t] <trace>
+ *        flamegraph.pl folded > flame.svg
+ */
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <getopt.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#ifdef HAVE_BABELTRACE2
+#include <babeltrace2/babeltrace.h>
+#endif
+
+#include "cyg-collector.h"
+#include "Symbolizer.h"
+#include "CallProfile.h"
+
+static uint64_t get_varint(const uint8_t* in, size_t* offset)
+{
+    uint64_t value = 0;
+    int shift = 0;
+    uint8_t byte;
+
+    do {
+        byte = in[(*offset)++];
+        value |= (uint64_t)(byte & 0x7f) << shift;
+        shift += 7;
+    } while ((byte & 0x80) && (shift < 64));
+
+    return value;
+}
+
+/**
+ * feeds a cyg-collector file chunk by chunk, returns ns per tick or 0 on error
+ */
+static double read_collector(const char* path, Symbolizer& symbolizer, CallProfile& profile)
+{
+    struct stat st;
+    int fd;
+
+    if (((fd = open(path, O_RDONLY)) == -1) || (fstat(fd, &st) == -1)) {
+        perror("open() failed");
+        return 0;
+    }
+
+    const uint8_t* mem = (const uint8_t*)mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (mem == MAP_FAILED) {
+        perror("mmap() failed");
+        return 0;
+    }
+    madvise((void*)mem, st.st_size, MADV_SEQUENTIAL);
+
+    const cyg_file_header* header = (const cyg_file_header*)mem;
+    if (((size_t)st.st_size < sizeof(*header)) || (header->magic != CYG_FILE_MAGIC) ||
+        (header->version != CYG_FILE_VERSION)) {
+        fprintf(stderr, "%s: not a cyg-collector file\n", path);
+        munmap((void*)mem, st.st_size);
+        return 0;
+    }
+
+    symbolizer.addMaps((const char*)&mem[sizeof(*header)], header->maps_len);
+
+    size_t offset = sizeof(*header) + header->maps_len;
+
+    while (offset + sizeof(cyg_chunk_header) <= (size_t)st.st_size) {
+        const cyg_chunk_header* chunk = (const cyg_chunk_header*)&mem[offset];
+
+        if ((chunk->magic != CYG_CHUNK_MAGIC) || (offset + sizeof(*chunk) + chunk->bytes > (size_t)st.st_size)) {
+            fprintf(stderr, "corrupt or truncated chunk at offset %zu\n", offset);
+            break;
+        }
+
+        if (chunk->dropped) {
+            profile.dropped(chunk->dropped);
+        }
+
+        size_t pos = offset + sizeof(*chunk);
+        uint64_t tsc = chunk->base_tsc;
+        uint64_t fn = 0;
+
+        for (uint32_t cnt = 0; cnt < chunk->count; cnt++) {
+            const uint64_t value = get_varint(mem, &pos);
+            const uint64_t delta = get_varint(mem, &pos);
+
+            tsc += value >> 1;
+            fn += (uint64_t)((int64_t)(delta >> 1) ^ -(int64_t)(delta & 1));
+
+            if (value & 1) {
+                profile.exit(chunk->tid, tsc, fn);
+            }
+            else {
+                profile.enter(chunk->tid, tsc, fn);
+            }
+        }
+
+        offset += sizeof(*chunk) + chunk->bytes;
+    }
+
+    const double nsPerTick = 1e9 / header->tsc_hz;
+
+    munmap((void*)mem, st.st_size);
+
+    return nsPerTick;
+}
+
+#ifdef HAVE_BABELTRACE2
+struct ctf_reader
+{
+    Symbolizer* symbolizer;
+    CallProfile* profile;
+    uint64_t missingTid;
+};
+
+static const bt_field* ctf_member(const bt_field* structure, const char* name)
+{
+    return structure ? bt_field_structure_borrow_member_field_by_name_const(structure, name) : NULL;
+}
+
+static bt_graph_simple_sink_component_consume_func_status ctf_consume(bt_message_iterator* iterator, void* data)
+{
+    ctf_reader* reader = (ctf_reader*)data;
+    bt_message_array_const messages;
+    uint64_t count;
+
+    switch (bt_message_iterator_next(iterator, &messages, &count)) {
+        case BT_MESSAGE_ITERATOR_NEXT_STATUS_OK:
+            break;
+        case BT_MESSAGE_ITERATOR_NEXT_STATUS_END:
+            return BT_GRAPH_SIMPLE_SINK_COMPONENT_CONSUME_FUNC_STATUS_END;
+        case BT_MESSAGE_ITERATOR_NEXT_STATUS_AGAIN:
+            return BT_GRAPH_SIMPLE_SINK_COMPONENT_CONSUME_FUNC_STATUS_AGAIN;
+        default:
+            return BT_GRAPH_SIMPLE_SINK_COMPONENT_CONSUME_FUNC_STATUS_ERROR;
+    }
+
+    for (uint64_t cnt = 0; cnt < count; cnt++) {
+        const bt_message* message = messages[cnt];
+
+        if (bt_message_get_type(message) == BT_MESSAGE_TYPE_EVENT) {
+            const bt_event* event = bt_message_event_borrow_event_const(message);
+            const char* name = bt_event_class_get_name(bt_event_borrow_class_const(event));
+            const bt_field* payload = bt_event_borrow_payload_field_const(event);
+            const bool entry = strstr(name, "cyg_profile") && strstr(name, ":func_entry");
+            const bool exit = strstr(name, "cyg_profile") && strstr(name, ":func_exit");
+
+            if (entry || exit) {
+                const bt_field* addr = ctf_member(payload, "addr");
+                const bt_field* vtid = ctf_member(bt_event_borrow_common_context_field_const(event), "vtid");
+                int64_t ns = 0;
+
+                bt_clock_snapshot_get_ns_from_origin(bt_message_event_borrow_default_clock_snapshot_const(message), &ns);
+
+                if (vtid == NULL) {
+                    reader->missingTid++;
+                }
+
+                const uint32_t tid = vtid ? (uint32_t)bt_field_integer_signed_get_value(vtid) : 0;
+                const uint64_t fn = addr ? bt_field_integer_unsigned_get_value(addr) : 0;
+
+                if (entry && addr) {
+                    reader->profile->enter(tid, (uint64_t)ns, fn);
+                }
+                else if (exit) {
+                    reader->profile->exit(tid, (uint64_t)ns, fn);
+                }
+            }
+            else if ((strcmp(name, "lttng_ust_statedump:bin_info") == 0) || (strcmp(name, "lttng_ust_dl:dlopen") == 0)) {
+                const bt_field* baddr = ctf_member(payload, "baddr");
+                const bt_field* memsz = ctf_member(payload, "memsz");
+                const bt_field* path = ctf_member(payload, "path");
+
+                if (baddr && memsz && path) {
+                    reader->symbolizer->addObject(bt_field_string_get_value(path), bt_field_integer_unsigned_get_value(baddr),
+                                                  bt_field_integer_unsigned_get_value(memsz));
+                }
+            }
+        }
+
+        bt_message_put_ref(message);
+    }
+
+    return BT_GRAPH_SIMPLE_SINK_COMPONENT_CONSUME_FUNC_STATUS_OK;
+}
+
+/**
+ * source.ctf.fs -> filter.utils.muxer -> simple sink, returns 1 ns per tick or 0 on error
+ */
+static double read_ctf(const char* path, Symbolizer& symbolizer, CallProfile& profile)
+{
+    ctf_reader reader = { &symbolizer, &profile, 0 };
+    const bt_plugin* ctf = NULL;
+    const bt_plugin* utils = NULL;
+    const bt_component_source* source = NULL;
+    const bt_component_filter* muxer = NULL;
+    const bt_component_sink* sink = NULL;
+    bt_value* params = bt_value_map_create();
+    bt_value* inputs = NULL;
+    bt_graph* graph = bt_graph_create(0);
+    double nsPerTick = 0;
+
+    if ((bt_plugin_find("ctf", BT_TRUE, BT_TRUE, BT_TRUE, BT_TRUE, BT_TRUE, &ctf) != BT_PLUGIN_FIND_STATUS_OK) ||
+        (bt_plugin_find("utils", BT_TRUE, BT_TRUE, BT_TRUE, BT_TRUE, BT_TRUE, &utils) != BT_PLUGIN_FIND_STATUS_OK)) {
+        fprintf(stderr, "babeltrace2 plugins ctf and utils not found\n");
+        goto out;
+    }
+
+    bt_value_map_insert_empty_array_entry(params, "inputs", &inputs);
+    bt_value_array_append_string_element(inputs, path);
+
+    if ((bt_graph_add_source_component(graph, bt_plugin_borrow_source_component_class_by_name_const(ctf, "fs"), "source",
+                                       params, BT_LOGGING_LEVEL_WARNING, &source) != BT_GRAPH_ADD_COMPONENT_STATUS_OK) ||
+        (bt_graph_add_filter_component(graph, bt_plugin_borrow_filter_component_class_by_name_const(utils, "muxer"), "muxer",
+                                       NULL, BT_LOGGING_LEVEL_WARNING, &muxer) != BT_GRAPH_ADD_COMPONENT_STATUS_OK) ||
+        (bt_graph_add_simple_sink_component(graph, "cyg-fold", NULL, ctf_consume, NULL, &reader, &sink) != BT_GRAPH_ADD_COMPONENT_STATUS_OK)) {
+        fprintf(stderr, "%s: cannot set up the babeltrace2 graph\n", path);
+        goto out;
+    }
+
+    /* the muxer offers a new input port for each connection */
+    for (uint64_t cnt = 0; cnt < bt_component_source_get_output_port_count(source); cnt++) {
+        bt_graph_connect_ports(graph, bt_component_source_borrow_output_port_by_index_const(source, cnt),
+                               bt_component_filter_borrow_input_port_by_index_const(muxer, cnt), NULL);
+    }
+    bt_graph_connect_ports(graph, bt_component_filter_borrow_output_port_by_index_const(muxer, 0),
+                           bt_component_sink_borrow_input_port_by_index_const(sink, 0), NULL);
+
+    bt_graph_run_status status;
+    while ((status = bt_graph_run(graph)) == BT_GRAPH_RUN_STATUS_AGAIN);
+
+    if (status != BT_GRAPH_RUN_STATUS_OK) {
+        fprintf(stderr, "%s: reading the trace failed\n", path);
+        goto out;
+    }
+
+    if (reader.missingTid) {
+        fprintf(stderr, "%lu events without vtid context, threads are merged (lttng add-context -u -t vtid)\n",
+                (unsigned long)reader.missingTid);
+    }
+
+    nsPerTick = 1.0;
+
+out:
+    bt_graph_put_ref(graph);
+    bt_value_put_ref(params);
+    bt_plugin_put_ref(ctf);
+    bt_plugin_put_ref(utils);
+
+    return nsPerTick;
+}
+#endif
+
+static void display_help(const char* name)
+{
+    printf("usage: %s [options] <trace>\n"
+           "  -f, --folded=FILE     write folded stacks (exclusive ns per call path) for flamegraph.pl\n"
+           "  -n, --top=N           number of functions in the report (default 30)\n"
+           "  -x, --exclusive       rank by exclusive instead of inclusive time\n"
+           "  -t, --threads         one root per thread in the folded stacks\n"
+           "  -h, --help            this help\n"
+           "trace: cyg-collector file"
+#ifdef HAVE_BABELTRACE2
+           " or LTTng trace directory"
+#endif
+           "\n", name);
+}
+
+int main(int argc, char *argv[])
+{
+    const char* folded = NULL;
+    size_t top = 30;
+    bool byExclusive = false;
+    bool threadRoots = false;
+    struct stat st;
+
+    static struct option long_options[] = {
+        { "folded",    required_argument, 0, 'f' },
+        { "top",       required_argument, 0, 'n' },
+        { "exclusive", no_argument,       0, 'x' },
+        { "threads",   no_argument,       0, 't' },
+        { "help",      no_argument,       0, 'h' },
+        { 0, 0, 0, 0 }
+    };
+
+    int opt;
+    while ((opt = getopt_long(argc, argv, "f:n:xth", long_options, NULL)) != -1) {
+        switch (opt) {
+            case 'f':
+                folded = optarg;
+                break;
+            case 'n':
+                top = strtoul(optarg, NULL, 0);
+                break;
+            case 'x':
+                byExclusive = true;
+                break;
+            case 't':
+                threadRoots = true;
+                break;
+            default:
+                display_help(argv[0]);
+                return opt == 'h' ? 0 : 1;
+        }
+    }
+
+    if ((optind >= argc) || (stat(argv[optind], &st) == -1)) {
+        display_help(argv[0]);
+        return 1;
+    }
+
+    Symbolizer symbolizer;
+    CallProfile profile(symbolizer, threadRoots);
+    double nsPerTick = 0;
+
+    if (S_ISDIR(st.st_mode)) {
+#ifdef HAVE_BABELTRACE2
+        nsPerTick = read_ctf(argv[optind], symbolizer, profile);
+#else
+        fprintf(stderr, "%s: built without babeltrace2, LTTng traces are not supported\n", argv[0]);
+#endif
+    }
+    else {
+        nsPerTick = read_collector(argv[optind], symbolizer, profile);
+    }
+
+    if (nsPerTick == 0) {
+        return 1;
+    }
+
+    profile.finish();
+    profile.dump(top, byExclusive, nsPerTick);
+
+    if (folded && !profile.writeFolded(folded, nsPerTick)) {
+        return 1;
+    }
+
+    return 0;
+}
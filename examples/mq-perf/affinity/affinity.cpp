@@ -0,0 +1,385 @@
+#include <sched.h>
+#include <unistd.h>
+#include <errno.h>
+#include <stdio.h>
+#include <string.h>
+#include <stdlib.h>
+#include <ctype.h>
+#include <assert.h>
+
+#include "affinity.h"
+
+#define AFFINITY_LINE_SIZE      4096                /* a sysfs list of a few thousand CPUs */
+
+struct _affinity {
+    int ncpus;
+    size_t size;
+    cpu_set_t* set;
+};
+
+static bool affinity_add_list(affinity_t* self, char const* list, bool names);
+
+static bool affinity_read_sysfs(char const* path, char* buffer, size_t size)
+{
+    FILE* file = fopen(path, "r");
+    bool ok;
+
+    if (file == nullptr) {
+        return false;
+    }
+
+    ok = fgets(buffer, size, file) != nullptr;
+    fclose(file);
+
+    return ok;
+}
+
+/**
+ * number of CPU ids the kernel may hand out, sets must cover all of them
+ * or sched_getaffinity fails with EINVAL
+ */
+static int affinity_possible(void)
+{
+    char line[AFFINITY_LINE_SIZE];
+    int ncpus = sysconf(_SC_NPROCESSORS_CONF);
+
+    if (affinity_read_sysfs(AFFINITY_SYSFS "/possible", line, sizeof(line))) {
+        /* "0-127" or "0,2-5", the highest id is last */
+        char* last = strrchr(line, '-');
+        char* comma = strrchr(line, ',');
+
+        last = (last && (!comma || last > comma)) ? last : comma;
+        const int highest = atoi(last ? last + 1 : line);
+        ncpus = (highest + 1 > ncpus) ? highest + 1 : ncpus;
+    }
+
+    return (ncpus > 0) ? ncpus : 1;
+}
+
+affinity_t* affinity_new(void)
+{
+    affinity_t* self = (affinity_t*)malloc(sizeof(affinity_t));
+    assert(self != nullptr);
+
+    self->ncpus = affinity_possible();
+    self->size = CPU_ALLOC_SIZE(self->ncpus);
+    self->set = CPU_ALLOC(self->ncpus);
+    assert(self->set != nullptr);
+    CPU_ZERO_S(self->size, self->set);
+
+    return self;
+}
+
+void affinity_destroy(affinity_t* self)
+{
+    if (self) {
+        CPU_FREE(self->set);
+        free(self);
+    }
+}
+
+static bool affinity_has(const affinity_t* self, int cpu)
+{
+    return (cpu >= 0) && (cpu < self->ncpus) && CPU_ISSET_S(cpu, self->size, self->set);
+}
+
+static affinity_t* affinity_sysfs_list(char const* path)
+{
+    char line[AFFINITY_LINE_SIZE];
+    affinity_t* list;
+
+    if (!affinity_read_sysfs(path, line, sizeof(line))) {
+        return nullptr;
+    }
+
+    list = affinity_new();
+    if (!affinity_add_list(list, line, false)) {
+        affinity_destroy(list);
+        return nullptr;
+    }
+
+    return list;
+}
+
+/**
+ * cpus sharing the cache with the highest level, nullptr without cache info in sysfs
+ */
+static affinity_t* affinity_llc(int cpu)
+{
+    char path[256];
+    char line[32];
+    int best = -1;
+    int bestLevel = 0;
+
+    for (int index = 0; ; index++) {
+        snprintf(path, sizeof(path), AFFINITY_SYSFS "/cpu%d/cache/index%d/level", cpu, index);
+        if (!affinity_read_sysfs(path, line, sizeof(line))) {
+            break;
+        }
+        if (atoi(line) >= bestLevel) {
+            bestLevel = atoi(line);
+            best = index;
+        }
+    }
+
+    if (best == -1) {
+        return nullptr;
+    }
+
+    snprintf(path, sizeof(path), AFFINITY_SYSFS "/cpu%d/cache/index%d/shared_cpu_list", cpu, best);
+
+    return affinity_sysfs_list(path);
+}
+
+static int affinity_package(int cpu)
+{
+    char path[256];
+    char line[32];
+
+    snprintf(path, sizeof(path), AFFINITY_SYSFS "/cpu%d/topology/physical_package_id", cpu);
+
+    return affinity_read_sysfs(path, line, sizeof(line)) ? atoi(line) : -1;
+}
+
+/**
+ * lowest online CPU in the given relation to cpu, -1 if there is none
+ */
+static int affinity_resolve(char const* name, size_t len, int cpu)
+{
+    char path[256];
+    affinity_t* online = affinity_sysfs_list(AFFINITY_SYSFS "/online");
+    affinity_t* core;
+    affinity_t* llc = nullptr;
+    int found = -1;
+
+    snprintf(path, sizeof(path), AFFINITY_SYSFS "/cpu%d/topology/thread_siblings_list", cpu);
+    core = affinity_sysfs_list(path);
+
+    if ((online == nullptr) || (core == nullptr) || !affinity_has(online, cpu)) {
+        goto OUT;
+    }
+
+    if ((len == strlen(AFFINITY_NAME_SIBLING)) && (strncmp(name, AFFINITY_NAME_SIBLING, len) == 0)) {
+        for (int cnt = 0; (cnt < online->ncpus) && (found == -1); cnt++) {
+            if ((cnt != cpu) && affinity_has(online, cnt) && affinity_has(core, cnt)) {
+                found = cnt;
+            }
+        }
+    }
+    else if ((len == strlen(AFFINITY_NAME_LLC)) && (strncmp(name, AFFINITY_NAME_LLC, len) == 0)) {
+        if ((llc = affinity_llc(cpu)) == nullptr) {
+            goto OUT;
+        }
+        for (int cnt = 0; (cnt < online->ncpus) && (found == -1); cnt++) {
+            if (affinity_has(online, cnt) && affinity_has(llc, cnt) && !affinity_has(core, cnt)) {
+                found = cnt;
+            }
+        }
+    }
+    else if ((len == strlen(AFFINITY_NAME_REMOTE)) && (strncmp(name, AFFINITY_NAME_REMOTE, len) == 0)) {
+        const int package = affinity_package(cpu);
+
+        for (int cnt = 0; (cnt < online->ncpus) && (found == -1); cnt++) {
+            if (affinity_has(online, cnt) && (affinity_package(cnt) != package)) {
+                found = cnt;
+            }
+        }
+    }
+    else {
+        errno = EINVAL;
+        goto OUT;
+    }
+
+    if (found == -1) {
+        errno = ENODEV;
+    }
+
+OUT:
+    affinity_destroy(online);
+    affinity_destroy(core);
+    affinity_destroy(llc);
+
+    return found;
+}
+
+static bool affinity_add(affinity_t* self, long cpu)
+{
+    if ((cpu < 0) || (cpu >= self->ncpus)) {
+        errno = ERANGE;
+        return false;
+    }
+
+    CPU_SET_S(cpu, self->size, self->set);
+
+    return true;
+}
+
+/**
+ * elements: N, N-M, N-M:S and with names name:N
+ */
+static bool affinity_add_list(affinity_t* self, char const* list, bool names)
+{
+    char const* pos = list;
+
+    while (*pos && !isspace((unsigned char)*pos)) {
+        char* end;
+
+        if (isalpha((unsigned char)*pos)) {
+            char const* colon = strchr(pos, ':');
+            if (!names || (colon == nullptr)) {
+                errno = EINVAL;
+                return false;
+            }
+
+            const long ref = strtol(colon + 1, &end, 10);
+            if ((end == colon + 1) || (ref < 0) || (ref >= self->ncpus)) {
+                errno = EINVAL;
+                return false;
+            }
+
+            const int cpu = affinity_resolve(pos, colon - pos, ref);
+            if (cpu == -1) {
+                return false;
+            }
+            affinity_add(self, cpu);
+        }
+        else {
+            long first = strtol(pos, &end, 10);
+            long last = first;
+            long stride = 1;
+
+            if (end == pos) {
+                errno = EINVAL;
+                return false;
+            }
+            if (*end == '-') {
+                pos = end + 1;
+                last = strtol(pos, &end, 10);
+                if ((end == pos) || (last < first)) {
+                    errno = EINVAL;
+                    return false;
+                }
+                if (*end == ':') {
+                    pos = end + 1;
+                    stride = strtol(pos, &end, 10);
+                    if ((end == pos) || (stride < 1)) {
+                        errno = EINVAL;
+                        return false;
+                    }
+                }
+            }
+
+            for (long cpu = first; cpu <= last; cpu += stride) {
+                if (!affinity_add(self, cpu)) {
+                    return false;
+                }
+            }
+        }
+
+        pos = end;
+        if (*pos == ',') {
+            pos++;
+        }
+        else if (*pos && !isspace((unsigned char)*pos)) {
+            errno = EINVAL;
+            return false;
+        }
+    }
+
+    return true;
+}
+
+bool affinity_parse_list(affinity_t* self, char const* list)
+{
+    return affinity_add_list(self, list, true);
+}
+
+/**
+ * the lowest CPU is the last digit, commas as in /proc/<pid>/status are skipped
+ */
+bool affinity_parse_mask(affinity_t* self, char const* mask)
+{
+    int bit = 0;
+
+    if ((strncmp(mask, "0x", 2) == 0) || (strncmp(mask, "0X", 2) == 0)) {
+        mask += 2;
+    }
+
+    for (char const* pos = mask + strlen(mask); pos-- > mask; ) {
+        if (*pos == ',') {
+            continue;
+        }
+        if (!isxdigit((unsigned char)*pos)) {
+            errno = EINVAL;
+            return false;
+        }
+
+        const int digit = isdigit((unsigned char)*pos) ? *pos - '0' : tolower((unsigned char)*pos) - 'a' + 10;
+        for (int cnt = 0; cnt < 4; cnt++, bit++) {
+            if ((digit & (1 << cnt)) && !affinity_add(self, bit)) {
+                return false;
+            }
+        }
+    }
+
+    return true;
+}
+
+bool affinity_is_empty(const affinity_t* self)
+{
+    return CPU_COUNT_S(self->size, self->set) == 0;
+}
+
+int affinity_count(const affinity_t* self)
+{
+    return CPU_COUNT_S(self->size, self->set);
+}
+
+int affinity_next(const affinity_t* self, int cpu)
+{
+    for (cpu = (cpu < -1) ? 0 : cpu + 1; cpu < self->ncpus; cpu++) {
+        if (affinity_has(self, cpu)) {
+            return cpu;
+        }
+    }
+
+    return -1;
+}
+
+int affinity_apply(const affinity_t* self)
+{
+    return sched_setaffinity(0, self->size, self->set);
+}
+
+int affinity_get(affinity_t* self)
+{
+    return sched_getaffinity(0, self->size, self->set);
+}
+
+char const* affinity_format(const affinity_t* self, char* buffer, size_t size)
+{
+    size_t used = 0;
+
+    buffer[0] = '\0';
+
+    for (int cpu = 0; cpu < self->ncpus; cpu++) {
+        if (!affinity_has(self, cpu)) {
+            continue;
+        }
+
+        int last = cpu;
+        while (affinity_has(self, last + 1)) {
+            last++;
+        }
+
+        const int len = (last == cpu) ? snprintf(buffer + used, size - used, "%s%d", used ? "," : "", cpu)
+                                      : snprintf(buffer + used, size - used, "%s%d-%d", used ? "," : "", cpu, last);
+        if ((len < 0) || ((size_t)len >= size - used)) {
+            break;
+        }
+        used += len;
+        cpu = last;
+    }
+
+    return buffer;
+}
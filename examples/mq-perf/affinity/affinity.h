@@ -0,0 +1,39 @@
+#pragma once
+
+#include <stdbool.h>
+#include <stddef.h>
+
+#define AFFINITY_SYSFS          "/sys/devices/system/cpu"
+#define AFFINITY_NAME_SIBLING   "sibling"           /* other hardware thread of the same core      */
+#define AFFINITY_NAME_LLC       "llc"               /* other core sharing the last level cache     */
+#define AFFINITY_NAME_REMOTE    "remote"            /* core in another package (socket)            */
+
+/**
+ * dynamically sized cpu set, holds every possible CPU of the system
+ * (no limit of a machine word or of CPU_SETSIZE).
+ *
+ * lists are written like taskset -c: "2,4-7,16-31:2", an element may
+ * also name a CPU relative to another one by topology, "sibling:2",
+ * "llc:2" or "remote:2" add the lowest online CPU which is a hardware
+ * thread of the same core as CPU 2, shares its last level cache on a
+ * different core, or sits in another package.
+ */
+typedef struct _affinity affinity_t;
+
+affinity_t* affinity_new(void);
+void affinity_destroy(affinity_t* self);
+
+/* add CPUs, false on a malformed spec or unknown CPU */
+bool affinity_parse_list(affinity_t* self, char const* list);
+bool affinity_parse_mask(affinity_t* self, char const* mask);  /* hex, any length */
+
+bool affinity_is_empty(const affinity_t* self);
+int affinity_count(const affinity_t* self);
+int affinity_next(const affinity_t* self, int cpu);            /* first set CPU above cpu, -1 at the end */
+
+/* calling thread, 0 on success, -1 with errno */
+int affinity_apply(const affinity_t* self);
+int affinity_get(affinity_t* self);
+
+/* compact list as accepted by affinity_parse_list */
+char const* affinity_format(const affinity_t* self, char* buffer, size_t size);
@@ -0,0 +1,267 @@
+/**
+ * build with make, offline analysis of files written by mq-perf-recv --record
+ */
+
+/* local includes */
+#include "samplefile.h"
+#include "TimeProfiling.h"
+
+/* global includes */
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <getopt.h>
+#include <vector>
+#include <map>
+#include <algorithm>
+
+#define MEASURE_SAFETY_MARGIN   100 /* same default as mq-perf-recv */
+#define PROGRAM                 "mq-perf-analyze"
+#define PROGRAMVERSION          "0.0.1"
+
+static int optSafety = MEASURE_SAFETY_MARGIN;
+static int optInterval = 0;         /* no time series               */
+static int optPerCpu = 0;           /* no per cpu breakdown         */
+static char* optFile = nullptr;
+
+/**
+ * display version
+ */
+void display_version (void)
+{
+    printf(PROGRAM " " PROGRAMVERSION "\n"
+           "\n"
+           "\n"
+           PROGRAM " comes with NO WARRANTY\n"
+           "to the extent permitted by law.\n"
+           "\n");
+
+    exit(0);
+}
+
+/**
+ * display help
+ */
+void display_help (void)
+{
+    printf("Usage: " PROGRAM " [OPTIONS] <file>\n"
+           "offline analysis of samples recorded with mq-perf-recv --record\n"
+           "\n"
+           "example: " PROGRAM " --interval=1000 --per-cpu /tmp/mq-perf.rec\n"
+           "\n"
+           "  --help                              Show this menu\n"
+           "  --version                           Show version of this application\n"
+           "  -s, --safety                        Samples removed at start and end of the summary\n"
+           "  -i, --interval                      Time series with the given interval in milli seconds\n"
+           "  -c, --per-cpu                       Breakdown per receiving CPU\n");
+    exit(-1);
+}
+
+/**
+ *
+ */
+void process_options(int argc, char *argv[])
+{
+    int error = 0;
+
+    for (;;) {
+        int option_index = 0;
+        static const char *short_options = "s:i:c";
+
+        static const struct option long_options[] = {
+                { "help",          no_argument,       0,  0  },
+                { "version",       no_argument,       0,  0  },
+                { "safety",        required_argument, 0, 's' },
+                { "interval",      required_argument, 0, 'i' },
+                { "per-cpu",       no_argument,       0, 'c' },
+                { 0,               0,                 0,  0  },
+        };
+
+        int c = getopt_long(argc, argv, short_options,
+                            long_options, &option_index);
+        /* detect the end of the options. */
+        if (c == -1) {
+            break;
+        }
+
+        switch (c) {
+            case 0:
+                switch (option_index) {
+                    case 0:
+                        display_help();
+                        break;
+                    case 1:
+                        display_version();
+                        break;
+                }
+                break;
+            case 's':
+                optSafety = atoi(optarg);
+                break;
+            case 'i':
+                optInterval = atoi(optarg);
+                break;
+            case 'c':
+                optPerCpu = 1;
+                break;
+            case '?':
+                error = 1;
+                break;
+        }
+    }
+
+    if ((argc - optind) != 1) {
+        error = 1;
+    }
+    else {
+        optFile = argv[optind];
+    }
+
+    if (error) {
+        display_help();
+    }
+}
+
+/**
+ * count, average and a few percentiles of one group of latencies in us, reorders the vector
+ */
+static void print_summary_row(const char* label, std::vector<double>& latencies)
+{
+    if (latencies.empty()) {
+        printf("%-14s %10d\n", label, 0);
+        return;
+    }
+
+    const size_t count = latencies.size();
+    double sum = 0.0;
+    for (const double latency : latencies) {
+        sum += latency;
+    }
+
+    auto p50 = latencies.begin() + count / 2;
+    std::nth_element(latencies.begin(), p50, latencies.end());
+    auto p99 = latencies.begin() + std::min(count - 1, (size_t)(0.99 * count));
+    std::nth_element(p50, p99, latencies.end());
+    const double max = *std::max_element(p99, latencies.end());
+    const double min = *std::min_element(latencies.begin(), p50 + 1);
+
+    printf("%-14s %10zu %9.3f %9.3f %9.3f %9.3f %9.3f\n", label, count, min, sum / count, *p50, *p99, max);
+}
+
+static void print_summary_header(const char* label)
+{
+    printf("%-14s %10s %9s %9s %9s %9s %9s\n", label, "samples", "min us", "avg us", "p50 us", "p99 us", "max us");
+}
+
+static void time_series(samplefile_reader_t* reader)
+{
+    struct samplefile_record record;
+    std::vector<double> latencies;
+    int64_t originNs = 0;
+    int64_t bucket = -1;
+    char label[32];
+
+    printf("\nTime series (%d ms)\n", optInterval);
+    print_summary_header("time s");
+
+    samplefile_rewind(reader);
+    while (samplefile_next(reader, &record)) {
+        if (bucket < 0) {
+            originNs = record.recv_ns;
+            bucket = 0;
+        }
+
+        const int64_t current = (record.recv_ns - originNs) / ((int64_t)optInterval * 1000000);
+        if (current != bucket) {
+            snprintf(label, sizeof(label), "%.3f", (double)bucket * optInterval / 1000.0);
+            print_summary_row(label, latencies);
+            latencies.clear();
+            bucket = current;
+        }
+
+        latencies.push_back((record.recv_ns - record.sent_ns) * 1e-3);
+    }
+
+    if (!latencies.empty()) {
+        snprintf(label, sizeof(label), "%.3f", (double)bucket * optInterval / 1000.0);
+        print_summary_row(label, latencies);
+    }
+}
+
+static void per_cpu(samplefile_reader_t* reader)
+{
+    struct samplefile_record record;
+    std::map<uint32_t, std::vector<double>> cpus;
+    char label[32];
+
+    samplefile_rewind(reader);
+    while (samplefile_next(reader, &record)) {
+        cpus[record.cpu].push_back((record.recv_ns - record.sent_ns) * 1e-3);
+    }
+
+    printf("\nPer CPU\n");
+    print_summary_header("cpu");
+
+    for (auto& cpu : cpus) {
+        snprintf(label, sizeof(label), "%u", cpu.first);
+        print_summary_row(label, cpu.second);
+    }
+}
+
+int main(int argc, char **argv)
+{
+    struct samplefile_record record;
+    samplefile_reader_t* reader;
+    uint64_t records = 0;
+
+    /* parse given cmd line args */
+    process_options(argc, argv);
+
+    if ((reader = samplefile_open(optFile)) == nullptr) {
+        perror("samplefile_open() failed");
+        return 1;
+    }
+
+    const struct samplefile_header* header = samplefile_get_header(reader);
+
+    /* header is only complete if the receiver exited cleanly */
+    while (samplefile_next(reader, &record)) {
+        records++;
+    }
+
+    printf("file : %s pid : %d samples : %lu dropped : %lu\n", optFile, header->pid,
+           (unsigned long)records, (unsigned long)header->dropped);
+
+    if (records > 0) {
+        /* same statistics as mq-perf-recv prints at exit, over its --start/--duration window */
+        TimeProfiling timeProfiling(records);
+        if (header->window_origin_ns != 0) {
+            printf("window : start %d s duration %d s\n", header->window_start_sec, header->window_duration_sec);
+            timeProfiling.configure(header->window_start_sec, header->window_duration_sec);
+            timeProfiling.start(header->window_origin_ns);
+        }
+        else {
+            timeProfiling.start(std::numeric_limits<int64_t>::min());
+        }
+
+        samplefile_rewind(reader);
+        while (samplefile_next(reader, &record)) {
+            timeProfiling.add(record.sent_ns, record.recv_ns);
+        }
+
+        timeProfiling.process(optSafety);
+        timeProfiling.dump();
+    }
+
+    if (optInterval > 0) {
+        time_series(reader);
+    }
+
+    if (optPerCpu) {
+        per_cpu(reader);
+    }
+
+    samplefile_reader_close(reader);
+
+    return 0;
+}
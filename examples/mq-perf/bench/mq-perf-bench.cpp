@@ -0,0 +1,809 @@
+/**
+ * build with make, runs mq-perf-recv and mq-perf-xmit unattended over a scenario matrix
+ */
+
+/* local includes */
+#include "samplefile.h"
+#include "shmstats.h"
+#include "TimeProfiling.h"
+#include "ClockCheck.h"
+#include "SequenceTracking.h"
+#include "affinity.h"
+
+/* global includes */
+#include <algorithm>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <cerrno>
+#include <ctime>
+#include <string>
+#include <vector>
+#include <getopt.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <signal.h>
+#include <sys/wait.h>
+#include <sys/utsname.h>
+#include <mqueue.h>
+
+#define MEASURE_SAFETY_MARGIN   100     /* same default as mq-perf-recv */
+#define READY_TIMEOUT_MS        2000    /* receiver must have created its transport by then */
+#define STOP_TIMEOUT_MS         10000   /* receiver processes its samples before it exits */
+#define COUNT_TIMEOUT_S         600     /* upper bound of a cell with --count and no --duration */
+#define POLL_MS                 10
+#define NOISE_WARMUP_MS         500     /* noise threads have faulted in their working sets */
+#define UDS_FILE                "/tmp/sock.uds"
+#define QUEUE_NAME              "/mq-perf"
+#define SHMEM_FILE              "/dev/shm/gugus"
+#define PROGRAM                 "mq-perf-bench"
+#define PROGRAMVERSION          "0.0.1"
+
+static std::vector<std::string> optIPC = { "mq", "uds", "shmem" };
+static std::vector<std::string> optSizes = { "256" };
+static std::vector<std::string> optIntervals = { "6000" };
+static std::vector<std::string> optBursts = { "0" };
+static std::vector<std::string> optMasks = { "" };     /* recv:xmit, empty keeps the default */
+static std::vector<std::string> optNoise = { "" };     /* workloads@cpus/load, empty is none */
+static std::string optPrio = "50:40";
+static std::string optClock;         /* recv and xmit default        */
+static int optClockTolerance = CLOCK_TOLERANCE_NS;
+static int optClockStrict = 0;       /* warn only                    */
+static int optDuration = 0;         /* 5s, or the timeout with --count */
+static uint64_t optCount = 0;       /* run for the duration          */
+static int optSafety = MEASURE_SAFETY_MARGIN;
+static const char* optOutput = "mq-perf-bench.csv";
+static char* optLog = nullptr;      /* child output to /dev/null     */
+static std::string binDir;
+
+/**
+ * one cell of the matrix and its results
+ */
+struct Cell
+{
+    std::string ipc;
+    std::string size;
+    std::string interval;
+    std::string burst;
+    std::string recvMask;
+    std::string xmitMask;
+    std::string noise;
+
+    std::string status = "not-run";
+    double seconds = 0.0;
+    int64_t clockBoundNs = -1;      /* not checked or inconsistent */
+    uint64_t samples = 0;
+    uint64_t dropped = 0;           /* record ring overflows in the receiver */
+    uint64_t lost = 0;              /* sequence gaps, includes dropped records */
+    uint64_t reordered = 0;
+    uint64_t duplicates = 0;
+    std::string noiseRate;          /* achieved by mq-perf-noise */
+    double minimum = 0.0;
+    double average = 0.0;
+    double median = 0.0;
+    double deviation = 0.0;
+    double maximum = 0.0;
+    PercentileVector percentiles;
+};
+
+struct Child
+{
+    pid_t pid = -1;
+    int input = -1;                 /* stdin of the child, q quits */
+};
+
+/**
+ * display version
+ */
+void display_version (void)
+{
+    printf(PROGRAM " " PROGRAMVERSION "\n"
+           "\n"
+           "\n"
+           PROGRAM " comes with NO WARRANTY\n"
+           "to the extent permitted by law.\n"
+           "\n");
+
+    exit(0);
+}
+
+/**
+ * display help
+ */
+void display_help (void)
+{
+    printf("Usage: " PROGRAM " [OPTIONS]\n"
+           "runs mq-perf-recv and mq-perf-xmit for every combination of the given lists\n"
+           "and writes one row per combination, lists are comma separated\n"
+           "\n"
+           "example: " PROGRAM " --ipc=mq,uds,shmem --size=64,1024 --time=1000,100 --duration=10 --output=run.csv\n"
+           "\n"
+           "  --help                              Show this menu\n"
+           "  --version                           Show version of this application\n"
+           "  -i, --ipc                           Transports (default mq,uds,shmem)\n"
+           "  -z, --size                          Payload sizes in bytes (default 256)\n"
+           "  -t, --time                          Send intervals in micro seconds, 0 = no wait (default 6000)\n"
+           "  -b, --burst                         Burst counts (default 0)\n"
+           "  -m, --mask                          CPU affinity masks as recv:xmit, e.g. 2:4,2:2 (default none)\n"
+           "  -N, --noise                         mq-perf-noise runs as workloads@cpus/load, workloads joined by +,\n"
+           "                                      ; separated, e.g. none;llc+membw@sibling:2/50;fifo@2/20 (default none)\n"
+           "  -p, --prio                          FIFO priorities as recv:xmit (default 50:40)\n"
+           "  -d, --duration                      Seconds per cell (default 5), the timeout with --count\n"
+           "  -n, --count                         Messages received per cell instead of a duration\n"
+           "  -s, --safety                        Samples removed at start and end of each cell (default 100)\n"
+           "  -o, --output                        Result file, JSON if it ends with .json, CSV otherwise (default mq-perf-bench.csv)\n"
+           "  -l, --log                           Append the output of recv and xmit to this file\n"
+           "  --clock=[system|tsc]                Clock of recv and xmit\n"
+           "  --clock-tolerance=<ns>              Largest acceptable clock offset bound between the masks (default 1000 ns)\n"
+           "  --clock-strict                      Skip cells above the tolerance instead of a warning\n");
+    exit(-1);
+}
+
+static std::vector<std::string> split(const char* list, char separator = ',')
+{
+    std::vector<std::string> items;
+    std::string text(list);
+    size_t start = 0;
+
+    for (;;) {
+        const size_t end = text.find(separator, start);
+        items.push_back(text.substr(start, end == std::string::npos ? std::string::npos : end - start));
+        if (end == std::string::npos) {
+            break;
+        }
+        start = end + 1;
+    }
+
+    return items;
+}
+
+/**
+ *
+ */
+void process_options(int argc, char *argv[])
+{
+    int error = 0;
+
+    for (;;) {
+        int option_index = 0;
+        static const char *short_options = "i:z:t:b:m:N:p:d:n:s:o:l:";
+
+        static const struct option long_options[] = {
+                { "help",          no_argument,       0,  0  },
+                { "version",       no_argument,       0,  0  },
+                { "ipc",           required_argument, 0, 'i' },
+                { "size",          required_argument, 0, 'z' },
+                { "time",          required_argument, 0, 't' },
+                { "burst",         required_argument, 0, 'b' },
+                { "mask",          required_argument, 0, 'm' },
+                { "noise",         required_argument, 0, 'N' },
+                { "prio",          required_argument, 0, 'p' },
+                { "duration",      required_argument, 0, 'd' },
+                { "count",         required_argument, 0, 'n' },
+                { "safety",        required_argument, 0, 's' },
+                { "output",        required_argument, 0, 'o' },
+                { "log",           required_argument, 0, 'l' },
+                { "clock",         required_argument, 0,  0  },
+                { "clock-tolerance", required_argument, 0, 0 },
+                { "clock-strict",  no_argument,       0,  0  },
+                { 0,               0,                 0,  0  },
+        };
+
+        int c = getopt_long(argc, argv, short_options,
+                            long_options, &option_index);
+        /* detect the end of the options. */
+        if (c == -1) {
+            break;
+        }
+
+        switch (c) {
+            case 0:
+                switch (option_index) {
+                    case 0:
+                        display_help();
+                        break;
+                    case 1:
+                        display_version();
+                        break;
+                    default:
+                        if (strcmp(long_options[option_index].name, "clock") == 0) {
+                            optClock = optarg;
+                        }
+                        else if (strcmp(long_options[option_index].name, "clock-tolerance") == 0) {
+                            optClockTolerance = atoi(optarg);
+                        }
+                        else if (strcmp(long_options[option_index].name, "clock-strict") == 0) {
+                            optClockStrict = 1;
+                        }
+                        break;
+                }
+                break;
+            case 'i':
+                optIPC = split(optarg);
+                break;
+            case 'z':
+                optSizes = split(optarg);
+                break;
+            case 't':
+                optIntervals = split(optarg);
+                break;
+            case 'b':
+                optBursts = split(optarg);
+                break;
+            case 'm':
+                optMasks = split(optarg);
+                break;
+            case 'N':
+                optNoise = split(optarg, ';');
+                for (auto& noise : optNoise) {
+                    if (noise == "none") {
+                        noise.clear();
+                    }
+                }
+                break;
+            case 'p':
+                optPrio = optarg;
+                break;
+            case 'd':
+                optDuration = atoi(optarg);
+                break;
+            case 'n':
+                optCount = strtoull(optarg, 0, 10);
+                break;
+            case 's':
+                optSafety = atoi(optarg);
+                break;
+            case 'o':
+                optOutput = strdup(optarg);
+                break;
+            case 'l':
+                optLog = strdup(optarg);
+                break;
+            case '?':
+                error = 1;
+                break;
+        }
+    }
+
+    if ((argc - optind) != 0) {
+        error = 1;
+    }
+
+    if (error) {
+        display_help();
+    }
+}
+
+static void sleep_ms(int ms)
+{
+    struct timespec ts = { .tv_sec = ms / 1000, .tv_nsec = (ms % 1000) * 1000000L };
+
+    nanosleep(&ts, nullptr);
+}
+
+static double now_s(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+
+    return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+/**
+ * the recv and xmit binaries next to the directory of this one
+ */
+static void find_binaries(const char* argv0)
+{
+    char path[4096];
+    ssize_t len = readlink("/proc/self/exe", path, sizeof(path) - 1);
+
+    if (len <= 0) {
+        len = snprintf(path, sizeof(path), "%s", argv0);
+    }
+    path[len] = '\0';
+
+    std::string dir(path);
+    dir = dir.substr(0, dir.rfind('/'));        /* bench */
+    binDir = dir.substr(0, dir.rfind('/'));     /* mq-perf */
+}
+
+static std::string mask_part(const std::string& masks, bool xmit)
+{
+    const size_t colon = masks.find(':');
+
+    if (colon == std::string::npos) {
+        return masks;
+    }
+
+    return xmit ? masks.substr(colon + 1) : masks.substr(0, colon);
+}
+
+static Child spawn(const std::string& binary, const std::vector<std::string>& args, int logFd)
+{
+    Child child;
+    int fds[2];
+
+    if (pipe2(fds, O_CLOEXEC) == -1) {
+        perror("pipe2() failed");
+        return child;
+    }
+
+    if ((child.pid = fork()) == 0) {
+        std::vector<char*> argv;
+
+        argv.push_back((char*)binary.c_str());
+        for (const auto& arg : args) {
+            argv.push_back((char*)arg.c_str());
+        }
+        argv.push_back(nullptr);
+
+        dup2(fds[0], STDIN_FILENO);
+        dup2(logFd, STDOUT_FILENO);
+        dup2(logFd, STDERR_FILENO);
+        execv(binary.c_str(), argv.data());
+        perror("execv() failed");
+        _exit(127);
+    }
+
+    close(fds[0]);
+    child.input = fds[1];
+
+    if (child.pid == -1) {
+        perror("fork() failed");
+        close(child.input);
+        child.input = -1;
+    }
+
+    return child;
+}
+
+static bool alive(const Child& child)
+{
+    return (child.pid > 0) && (waitpid(child.pid, nullptr, WNOHANG) == 0);
+}
+
+/**
+ * press q like the user would, kill if it does not exit in time
+ */
+static void stop(Child& child, int timeoutMs)
+{
+    if (child.pid <= 0) {
+        return;
+    }
+
+    if (write(child.input, "q", 1) != 1) {
+        /* exited already, reaped below */
+    }
+    close(child.input);
+    child.input = -1;
+
+    for (int waited = 0; waited < timeoutMs; waited += POLL_MS) {
+        if (waitpid(child.pid, nullptr, WNOHANG) != 0) {
+            child.pid = -1;
+            return;
+        }
+        sleep_ms(POLL_MS);
+    }
+
+    fprintf(stderr, "pid %d did not quit, killed\n", child.pid);
+    kill(child.pid, SIGKILL);
+    waitpid(child.pid, nullptr, 0);
+    child.pid = -1;
+}
+
+static bool transport_exists(const std::string& ipc)
+{
+    if (ipc == "uds") {
+        return access(UDS_FILE, F_OK) == 0;
+    }
+    if (ipc == "shmem") {
+        return access(SHMEM_FILE, F_OK) == 0;
+    }
+
+    /* /dev/mqueue is not necessarily mounted */
+    const mqd_t mq = mq_open(QUEUE_NAME, O_WRONLY | O_NONBLOCK);
+    if (mq == (mqd_t)-1) {
+        return false;
+    }
+    mq_close(mq);
+
+    return true;
+}
+
+/**
+ * wait until the receiver has created its transport, the sender needs it to exist
+ */
+static bool wait_ready(const Child& recv, const std::string& ipc)
+{
+    for (int waited = 0; waited < READY_TIMEOUT_MS; waited += POLL_MS) {
+        if (!alive(recv)) {
+            return false;
+        }
+        if (transport_exists(ipc)) {
+            /* created before the receive thread is up */
+            sleep_ms(100);
+            return true;
+        }
+        sleep_ms(POLL_MS);
+    }
+
+    return alive(recv);
+}
+
+/**
+ * run for the duration, or until the receiver published count messages
+ */
+static void wait_cell(const Child& recv, const Child& xmit)
+{
+    const int timeout = optDuration ? optDuration : (optCount ? COUNT_TIMEOUT_S : 5);
+    const double end = now_s() + timeout;
+    shmstats_t* stats = nullptr;
+
+    if (optCount) {
+        char name[64];
+
+        snprintf(name, sizeof(name), "/" SHMSTATS_PREFIX "%d", recv.pid);
+        stats = shmstats_attach(name);
+        if (stats == nullptr) {
+            fprintf(stderr, "shmstats_attach(%s) failed, running for %d s\n", name, timeout);
+        }
+    }
+
+    while ((now_s() < end) && alive(recv) && alive(xmit)) {
+        struct shmstats_data data;
+
+        if (stats && shmstats_snapshot(stats, &data) && (data.messages >= optCount)) {
+            break;
+        }
+        sleep_ms(stats ? POLL_MS : 100);
+    }
+
+    if (stats) {
+        shmstats_detach(stats);
+    }
+}
+
+static void analyze(Cell& cell, const char* recordFile)
+{
+    samplefile_reader_t* reader = samplefile_open(recordFile);
+    struct samplefile_record record;
+
+    if (reader == nullptr) {
+        cell.status = "no-record";
+        return;
+    }
+
+    SequenceTracking sequenceTracking;
+    while (samplefile_next(reader, &record)) {
+        sequenceTracking.add(record.seq, record.recv_ns);
+        cell.samples++;
+    }
+    cell.dropped = samplefile_get_header(reader)->dropped;
+    cell.lost = sequenceTracking.getLost();
+    cell.reordered = sequenceTracking.getReordered();
+    cell.duplicates = sequenceTracking.getDuplicates();
+
+    if (cell.samples > (uint64_t)(2 * optSafety + 1)) {
+        TimeProfiling timeProfiling(cell.samples);
+        timeProfiling.start(std::numeric_limits<int64_t>::min());
+
+        samplefile_rewind(reader);
+        while (samplefile_next(reader, &record)) {
+            timeProfiling.add(record.sent_ns, record.recv_ns);
+        }
+
+        timeProfiling.process(optSafety);
+        cell.minimum = timeProfiling.getMinimum();
+        cell.average = timeProfiling.getAverage();
+        cell.median = timeProfiling.getMedian();
+        cell.deviation = timeProfiling.getDeviation();
+        cell.maximum = timeProfiling.getMaximum();
+        cell.percentiles = timeProfiling.getPercentiles();
+        cell.status = "ok";
+    }
+    else {
+        cell.status = "no-samples";
+    }
+
+    samplefile_reader_close(reader);
+}
+
+static std::vector<int> mask_cpus(const std::string& mask)
+{
+    std::vector<int> cpus;
+    affinity_t* affinity = affinity_new();
+
+    if (affinity_parse_mask(affinity, mask.c_str())) {
+        for (int cpu = affinity_next(affinity, -1); cpu != -1; cpu = affinity_next(affinity, cpu)) {
+            cpus.push_back(cpu);
+        }
+    }
+    affinity_destroy(affinity);
+
+    return cpus;
+}
+
+/**
+ * offset bound of the clocks between both masks, false if the cell must not run
+ */
+static bool check_clocks(Cell& cell)
+{
+    ClockCheck clockCheck;
+
+    if (cell.recvMask.empty() || cell.xmitMask.empty()) {
+        return true;
+    }
+
+    clockCheck.check(mask_cpus(cell.recvMask), mask_cpus(cell.xmitMask));
+    const ClockPair* worst = clockCheck.getWorst();
+    if (worst == nullptr) {
+        /* same single CPU */
+        cell.clockBoundNs = 0;
+        return true;
+    }
+
+    cell.clockBoundNs = worst->consistent() ? worst->boundNs() : -1;
+    if (!clockCheck.withinTolerance(optClockTolerance)) {
+        fprintf(stderr, "        clock offset bound %ld ns between CPU %d and %d%s, tolerance %d ns\n", (long)worst->boundNs(),
+                worst->cpuA, worst->cpuB, worst->consistent() ? "" : " (inconsistent)", optClockTolerance);
+        if (optClockStrict) {
+            cell.status = "clock-skew";
+            return false;
+        }
+    }
+
+    return true;
+}
+
+/**
+ * workloads@cpus/load as mq-perf-noise options
+ */
+static std::vector<std::string> noise_args(const std::string& noise, const char* reportFile)
+{
+    const size_t at = noise.find('@');
+    const size_t slash = noise.find('/', at == std::string::npos ? 0 : at);
+    std::string workloads = noise.substr(0, std::min(at, slash));
+    std::vector<std::string> args;
+
+    std::replace(workloads.begin(), workloads.end(), '+', ',');
+    args.push_back("--workload=" + workloads);
+    if (at != std::string::npos) {
+        args.push_back("--cpus=" + noise.substr(at + 1, slash == std::string::npos ? std::string::npos : slash - at - 1));
+    }
+    if (slash != std::string::npos) {
+        args.push_back("--load=" + noise.substr(slash + 1));
+    }
+    args.push_back(std::string("--report=") + reportFile);
+
+    return args;
+}
+
+static std::string read_line(const char* path)
+{
+    char line[512] = { 0 };
+    FILE* file = fopen(path, "r");
+
+    if (file == nullptr) {
+        return "";
+    }
+    if (fgets(line, sizeof(line), file)) {
+        line[strcspn(line, "\n")] = '\0';
+    }
+    fclose(file);
+
+    return line;
+}
+
+static void run_cell(Cell& cell, int logFd)
+{
+    char recordFile[64];
+    char noiseFile[64];
+    Child noise;
+    const double start = now_s();
+
+    snprintf(recordFile, sizeof(recordFile), "/tmp/" PROGRAM ".%d.rec", getpid());
+    unlink(recordFile);
+
+    std::vector<std::string> recvArgs = { "--ipc=" + cell.ipc, "--size=" + cell.size, "--burst=" + cell.burst,
+                                          "--prio=" + mask_part(optPrio, false), std::string("--record=") + recordFile };
+    std::vector<std::string> xmitArgs = { "--ipc=" + cell.ipc, "--size=" + cell.size, "--time=" + cell.interval,
+                                          "--burst=" + cell.burst, "--prio=" + mask_part(optPrio, true) };
+    if (!cell.recvMask.empty()) {
+        recvArgs.push_back("--mask=" + cell.recvMask);
+    }
+    if (!cell.xmitMask.empty()) {
+        xmitArgs.push_back("--mask=" + cell.xmitMask);
+    }
+    if (optCount) {
+        recvArgs.push_back("--stats");
+    }
+    if (!optClock.empty()) {
+        recvArgs.push_back("--clock=" + optClock);
+        xmitArgs.push_back("--clock=" + optClock);
+    }
+
+    /* the neighbours are busy before the first message */
+    snprintf(noiseFile, sizeof(noiseFile), "/tmp/" PROGRAM ".%d.noise", getpid());
+    unlink(noiseFile);
+    if (!cell.noise.empty()) {
+        noise = spawn(binDir + "/noise/mq-perf-noise", noise_args(cell.noise, noiseFile), logFd);
+        sleep_ms(NOISE_WARMUP_MS);
+        if (!alive(noise)) {
+            stop(noise, STOP_TIMEOUT_MS);
+            cell.status = "noise-failed";
+            return;
+        }
+    }
+
+    Child recv = spawn(binDir + "/recv/mq-perf-recv", recvArgs, logFd);
+    if (!wait_ready(recv, cell.ipc)) {
+        stop(recv, STOP_TIMEOUT_MS);
+        stop(noise, STOP_TIMEOUT_MS);
+        cell.status = "recv-failed";
+        return;
+    }
+
+    Child xmit = spawn(binDir + "/xmit/mq-perf-xmit", xmitArgs, logFd);
+
+    wait_cell(recv, xmit);
+    cell.seconds = now_s() - start;
+
+    /* receiver first: a shmem receiver only leaves its blocking dequeue on a message */
+    stop(recv, STOP_TIMEOUT_MS);
+    stop(xmit, STOP_TIMEOUT_MS);
+    stop(noise, STOP_TIMEOUT_MS);
+
+    analyze(cell, recordFile);
+    unlink(recordFile);
+    cell.noiseRate = read_line(noiseFile);
+    unlink(noiseFile);
+}
+
+static bool is_json(void)
+{
+    const size_t len = strlen(optOutput);
+
+    return (len > 5) && (strcmp(optOutput + len - 5, ".json") == 0);
+}
+
+/**
+ * the whole file is rewritten after each cell, a partial run keeps its results
+ */
+static void write_results(const std::vector<Cell>& cells, const struct utsname& host)
+{
+    FILE* file = fopen(optOutput, "w");
+
+    if (file == nullptr) {
+        perror("fopen() failed");
+        return;
+    }
+
+    if (is_json()) {
+        fprintf(file, "{\n  \"host\": \"%s\",\n  \"kernel\": \"%s %s\",\n  \"cells\": [\n", host.nodename, host.release, host.version);
+    }
+    else {
+        fprintf(file, "host,kernel,ipc,size,interval_us,burst,recv_mask,xmit_mask,status,seconds,samples,dropped,"
+                      "min_us,avg_us,median_us");
+        for (const double percentile : PERCENTILES) {
+            if (percentile != 50.0) {
+                fprintf(file, ",p%g_us", percentile);
+            }
+        }
+        fprintf(file, ",max_us,deviation_us,clock_bound_ns,lost,reordered,duplicates,noise,noise_rate\n");
+    }
+
+    for (size_t index = 0; index < cells.size(); index++) {
+        const Cell& cell = cells[index];
+
+        if (cell.status == "not-run") {
+            continue;
+        }
+
+        if (is_json()) {
+            fprintf(file, "%s    { \"ipc\": \"%s\", \"size\": %s, \"interval_us\": %s, \"burst\": %s, \"recv_mask\": \"%s\", "
+                          "\"xmit_mask\": \"%s\", \"status\": \"%s\", \"seconds\": %.3f, \"samples\": %lu, \"dropped\": %lu, "
+                          "\"min_us\": %.3f, \"avg_us\": %.3f, \"median_us\": %.3f",
+                    index ? ",\n" : "", cell.ipc.c_str(), cell.size.c_str(), cell.interval.c_str(), cell.burst.c_str(),
+                    cell.recvMask.c_str(), cell.xmitMask.c_str(), cell.status.c_str(), cell.seconds,
+                    (unsigned long)cell.samples, (unsigned long)cell.dropped, cell.minimum, cell.average, cell.median);
+            for (const auto& percentile : cell.percentiles) {
+                if (percentile.first != 50.0) {
+                    fprintf(file, ", \"p%g_us\": %.3f", percentile.first, percentile.second);
+                }
+            }
+            fprintf(file, ", \"max_us\": %.3f, \"deviation_us\": %.3f, \"clock_bound_ns\": %ld, \"lost\": %lu, "
+                          "\"reordered\": %lu, \"duplicates\": %lu, \"noise\": \"%s\", \"noise_rate\": \"%s\" }", cell.maximum,
+                    cell.deviation, (long)cell.clockBoundNs, (unsigned long)cell.lost, (unsigned long)cell.reordered,
+                    (unsigned long)cell.duplicates, cell.noise.empty() ? "none" : cell.noise.c_str(), cell.noiseRate.c_str());
+        }
+        else {
+            fprintf(file, "%s,%s,%s,%s,%s,%s,%s,%s,%s,%.3f,%lu,%lu,%.3f,%.3f,%.3f", host.nodename, host.release,
+                    cell.ipc.c_str(), cell.size.c_str(), cell.interval.c_str(), cell.burst.c_str(), cell.recvMask.c_str(),
+                    cell.xmitMask.c_str(), cell.status.c_str(), cell.seconds, (unsigned long)cell.samples,
+                    (unsigned long)cell.dropped, cell.minimum, cell.average, cell.median);
+            for (size_t cnt = 1; cnt < sizeof(PERCENTILES) / sizeof(PERCENTILES[0]); cnt++) {
+                fprintf(file, ",%.3f", cnt < cell.percentiles.size() ? cell.percentiles[cnt].second : 0.0);
+            }
+            /* quoted, cpu lists have commas */
+            fprintf(file, ",%.3f,%.3f,%ld,%lu,%lu,%lu,\"%s\",\"%s\"\n", cell.maximum, cell.deviation, (long)cell.clockBoundNs,
+                    (unsigned long)cell.lost, (unsigned long)cell.reordered, (unsigned long)cell.duplicates,
+                    cell.noise.empty() ? "none" : cell.noise.c_str(), cell.noiseRate.c_str());
+        }
+    }
+
+    if (is_json()) {
+        fprintf(file, "\n  ]\n}\n");
+    }
+
+    fclose(file);
+}
+
+int main(int argc, char **argv)
+{
+    std::vector<Cell> cells;
+    struct utsname host;
+
+    /* parse given cmd line args */
+    process_options(argc, argv);
+    find_binaries(argv[0]);
+    uname(&host);
+
+    /* the clock check uses the clock the children stamp with */
+    if (optClock == "tsc") {
+        std::string reason;
+        TscClock::enable(reason);
+    }
+
+    /* no SIGPIPE if a child is already gone when q is written */
+    signal(SIGPIPE, SIG_IGN);
+
+    const int logFd = open(optLog ? optLog : "/dev/null", O_WRONLY | O_CREAT | O_APPEND | O_CLOEXEC, 0644);
+    if (logFd == -1) {
+        perror("open() log failed");
+        return 1;
+    }
+
+    for (const auto& ipc : optIPC) {
+        for (const auto& size : optSizes) {
+            for (const auto& interval : optIntervals) {
+                for (const auto& burst : optBursts) {
+                    for (const auto& masks : optMasks) {
+                        for (const auto& noise : optNoise) {
+                            Cell cell;
+                            cell.ipc = ipc;
+                            cell.size = size;
+                            cell.interval = interval;
+                            cell.burst = burst;
+                            cell.recvMask = mask_part(masks, false);
+                            cell.xmitMask = mask_part(masks, true);
+                            cell.noise = noise;
+                            cells.push_back(cell);
+                        }
+                    }
+                }
+            }
+        }
+    }
+
+    for (size_t index = 0; index < cells.size(); index++) {
+        Cell& cell = cells[index];
+
+        fprintf(stderr, "[%zu/%zu] ipc %s size %s interval %s us burst %s mask %s:%s noise %s\n", index + 1, cells.size(),
+                cell.ipc.c_str(), cell.size.c_str(), cell.interval.c_str(), cell.burst.c_str(), cell.recvMask.c_str(),
+                cell.xmitMask.c_str(), cell.noise.empty() ? "none" : cell.noise.c_str());
+
+        if (check_clocks(cell)) {
+            run_cell(cell, logFd);
+        }
+
+        fprintf(stderr, "        %s: %lu samples median %.3f us max %.3f us\n", cell.status.c_str(),
+                (unsigned long)cell.samples, cell.median, cell.maximum);
+
+        write_results(cells, host);
+    }
+
+    close(logFd);
+
+    return 0;
+}
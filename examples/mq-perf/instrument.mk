@@ -0,0 +1,19 @@
+# -finstrument-functions flags shared by recv and xmit
+#
+# build with make INSTRUMENT=0 to drop the function hooks entirely. With
+# hooks, the standard library and the per message helpers are compiled
+# without them, everything else can be filtered at runtime by the collector
+# (see ../cyg-collector). scripts/mq-perf-instrument-exclude.sh generates
+# instrument-exclude.list with further small functions.
+INSTRUMENT ?= 1
+INSTRUMENT_EXCLUDE_FILES ?= /usr/include
+INSTRUMENT_EXCLUDE_FUNCTIONS ?= TimeItem::,Codec::,Transport::,TimeProfiling::add,OutlierCapture::add,SnapshotTrigger::check
+
+ifeq ($(INSTRUMENT),1)
+ifneq ($(wildcard ../instrument-exclude.list),)
+INSTRUMENT_EXCLUDE_FUNCTIONS:=$(INSTRUMENT_EXCLUDE_FUNCTIONS),$(shell paste -sd, ../instrument-exclude.list)
+endif
+CFLAGS+=-finstrument-functions
+CFLAGS+=-finstrument-functions-exclude-file-list=$(INSTRUMENT_EXCLUDE_FILES)
+CFLAGS+=-finstrument-functions-exclude-function-list=$(INSTRUMENT_EXCLUDE_FUNCTIONS)
+endif
@@ -0,0 +1,640 @@
+/**
+ * build with make, background interference for latency under load measurements
+ */
+
+/* local includes */
+#include "affinity.h"
+
+/* global includes */
+#include <algorithm>
+#include <atomic>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <cerrno>
+#include <ctime>
+#include <string>
+#include <thread>
+#include <vector>
+#include <getopt.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <sched.h>
+#include <termios.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+
+#define NOISE_PERIOD_NS         1000000             /* duty cycle period of --load                  */
+#define NOISE_LLC_DEFAULT       (8ul << 20)         /* when sysfs does not tell the LLC size        */
+#define NOISE_LLC_STRIDE        1021                /* cache lines, prime so every line is visited  */
+#define NOISE_LLC_CHUNK         1024                /* cache lines per work call                    */
+#define NOISE_MEMBW_MIN         (64ul << 20)        /* working set is 4 x LLC but at least this     */
+#define NOISE_MEMBW_CHUNK       (1ul << 20)         /* bytes copied per work call                   */
+#define NOISE_SYSCALL_CHUNK     256                 /* getppid calls per work call                  */
+#define NOISE_IO_BLOCK          (256ul << 10)       /* bytes written and read back per work call    */
+#define NOISE_IO_FILE_SIZE      (64ul << 20)        /* the file wraps at this size                  */
+#define NOISE_IO_SYNC           16                  /* blocks between fdatasync and cache drop      */
+#define NOISE_SPIN_NS           10000               /* busy loop per work call                      */
+#define NOISE_LLC_INDEX         AFFINITY_SYSFS "/cpu0/cache/index3/size"
+#define PROGRAM                 "mq-perf-noise"
+#define PROGRAMVERSION          "0.0.1"
+
+static volatile int running = 1;
+static std::vector<std::string> optWorkloads;
+static affinity_t* noiseCpus = affinity_new();     /* unpinned if empty */
+static int optLoad = 100;           /* percent busy of each period  */
+static int optThreadPrio = 30;      /* fifo workload                */
+static size_t optSize = 0;          /* working set, derived from LLC */
+static char* optFile = nullptr;     /* io workload                  */
+static char* optReport = nullptr;
+static int optDuration = 0;         /* until q                      */
+
+/**
+ * state of one noise thread, counters are read by the main thread
+ */
+struct alignas(64) Worker
+{
+    int workload = 0;
+    int cpu = -1;
+    char* buffer = nullptr;
+    size_t size = 0;
+    size_t position = 0;
+    int fd = -1;
+    uint32_t blocks = 0;
+    std::atomic<uint64_t> ops{0};
+    std::thread thread;
+};
+
+static uint64_t work_llc(Worker& worker);
+static uint64_t work_membw(Worker& worker);
+static uint64_t work_syscall(Worker& worker);
+static uint64_t work_io(Worker& worker);
+static uint64_t work_spin(Worker& worker);
+
+/**
+ * workloads, each work call does a bounded amount so the duty cycle is kept
+ */
+static const struct {
+    const char* name;
+    const char* unit;
+    double scale;                   /* ops per unit */
+    int policy;
+    uint64_t (*work)(Worker& worker);
+} workloads[] = {
+    { "llc",     "Mlines/s", 1e6,          SCHED_OTHER, work_llc     },
+    { "membw",   "MiB/s",    1048576.0,    SCHED_OTHER, work_membw   },
+    { "syscall", "Mcalls/s", 1e6,          SCHED_OTHER, work_syscall },
+    { "io",      "MiB/s",    1048576.0,    SCHED_OTHER, work_io      },
+    { "fifo",    "% cpu",    1e7,          SCHED_FIFO,  work_spin    },
+    { "other",   "% cpu",    1e7,          SCHED_OTHER, work_spin    },
+};
+
+#define NOISE_WORKLOADS     (int)(sizeof(workloads) / sizeof(workloads[0]))
+
+/**
+ * display version
+ */
+void display_version (void)
+{
+    printf(PROGRAM " " PROGRAMVERSION "\n"
+           "\n"
+           "\n"
+           PROGRAM " comes with NO WARRANTY\n"
+           "to the extent permitted by law.\n"
+           "\n");
+
+    exit(0);
+}
+
+/**
+ * display help
+ */
+void display_help (void)
+{
+    printf("Usage: " PROGRAM " [OPTIONS]\n"
+           "background interference on chosen CPUs while mq-perf-recv and mq-perf-xmit measure\n"
+           "\n"
+           "example: " PROGRAM " --workload=llc,syscall --cpus=sibling:2,llc:2 --load=50\n"
+           "\n"
+           "  --help                              Show this menu\n"
+           "  --version                           Show version of this application\n"
+           "  -w, --workload                      Comma separated list of\n"
+           "                                        llc     walk a working set of the LLC size\n"
+           "                                        membw   copy a working set of 4 x LLC size\n"
+           "                                        syscall getppid storm\n"
+           "                                        io      write, fdatasync, drop and read back a file\n"
+           "                                        fifo    busy loop with SCHED_FIFO\n"
+           "                                        other   busy loop with SCHED_OTHER\n"
+           "  -c, --cpus                          CPU list, one thread per CPU and workload, e.g. 2,4-7 or sibling:2, llc:2\n"
+           "  -m, --mask                          CPU affinity mask, hex of any length\n"
+           "  -l, --load                          Percent busy of every 1 ms (default 100)\n"
+           "  -p, --prio                          Thread priority of the fifo workload (default 30)\n"
+           "  -s, --size                          Working set of llc and membw in KiB\n"
+           "  -f, --file                          File of the io workload (default /tmp/" PROGRAM ".<pid>)\n"
+           "  -d, --duration                      Seconds to run, 0 = until q (default 0)\n"
+           "  -r, --report                        Write the achieved rates as one line to this file\n");
+    exit(-1);
+}
+
+static std::vector<std::string> split(const char* list)
+{
+    std::vector<std::string> items;
+    std::string text(list);
+    size_t start = 0;
+
+    for (;;) {
+        const size_t end = text.find(',', start);
+        items.push_back(text.substr(start, end == std::string::npos ? std::string::npos : end - start));
+        if (end == std::string::npos) {
+            break;
+        }
+        start = end + 1;
+    }
+
+    return items;
+}
+
+static int find_workload(const std::string& name)
+{
+    for (int cnt = 0; cnt < NOISE_WORKLOADS; cnt++) {
+        if (name == workloads[cnt].name) {
+            return cnt;
+        }
+    }
+
+    return -1;
+}
+
+/**
+ *
+ */
+void process_options(int argc, char *argv[])
+{
+    int error = 0;
+
+    for (;;) {
+        int option_index = 0;
+        static const char *short_options = "w:c:m:l:p:s:f:d:r:";
+
+        static const struct option long_options[] = {
+                { "help",          no_argument,       0,  0  },
+                { "version",       no_argument,       0,  0  },
+                { "workload",      required_argument, 0, 'w' },
+                { "cpus",          required_argument, 0, 'c' },
+                { "mask",          required_argument, 0, 'm' },
+                { "load",          required_argument, 0, 'l' },
+                { "prio",          required_argument, 0, 'p' },
+                { "size",          required_argument, 0, 's' },
+                { "file",          required_argument, 0, 'f' },
+                { "duration",      required_argument, 0, 'd' },
+                { "report",        required_argument, 0, 'r' },
+                { 0,               0,                 0,  0  },
+        };
+
+        int c = getopt_long(argc, argv, short_options,
+                            long_options, &option_index);
+        /* detect the end of the options. */
+        if (c == -1) {
+            break;
+        }
+
+        switch (c) {
+            case 0:
+                switch (option_index) {
+                    case 0:
+                        display_help();
+                        break;
+                    case 1:
+                        display_version();
+                        break;
+                }
+                break;
+            case 'w':
+                optWorkloads = split(optarg);
+                for (const auto& workload : optWorkloads) {
+                    if (find_workload(workload) == -1) {
+                        fprintf(stderr, "unknown workload %s\n", workload.c_str());
+                        error = 1;
+                    }
+                }
+                break;
+            case 'c':
+                if (!affinity_parse_list(noiseCpus, optarg)) {
+                    fprintf(stderr, "invalid CPU list %s: %s\n", optarg, strerror(errno));
+                    error = 1;
+                }
+                break;
+            case 'm':
+                if (!affinity_parse_mask(noiseCpus, optarg)) {
+                    fprintf(stderr, "invalid CPU mask %s\n", optarg);
+                    error = 1;
+                }
+                break;
+            case 'l':
+                optLoad = atoi(optarg);
+                break;
+            case 'p':
+                optThreadPrio = atoi(optarg);
+                break;
+            case 's':
+                optSize = strtoul(optarg, 0, 10) << 10;
+                break;
+            case 'f':
+                optFile = strdup(optarg);
+                break;
+            case 'd':
+                optDuration = atoi(optarg);
+                break;
+            case 'r':
+                optReport = strdup(optarg);
+                break;
+            case '?':
+                error = 1;
+                break;
+        }
+    }
+
+    if ((argc - optind) != 0) {
+        error = 1;
+    }
+
+    if (optWorkloads.empty() || (optLoad < 1) || (optLoad > 100)) {
+        error = 1;
+    }
+
+    if (error) {
+        display_help();
+    }
+}
+
+static int get_one_character(char* c)
+{
+    struct termios tmbuf,tmsave;
+
+    if (tcgetattr(0,&tmbuf)) {
+        // not a terminal (e.g. started by mq-perf-bench), plain blocking read
+        return (read(STDIN_FILENO, c, 1) == 1) ? 0 : -1;
+    }
+
+    // save current state
+    memcpy(&tmsave, &tmbuf, sizeof(tmbuf));
+
+    tmbuf.c_lflag &= ~ICANON; // clear line oriented input
+    tmbuf.c_cc[VMIN] = 1;     // number of bytes to read before read returns
+    tmbuf.c_cc[VTIME] = 0;    // no timeout, wait forever
+
+    // write new termios configuration
+    if (tcsetattr(0, TCSANOW, &tmbuf)) {
+        return -1;
+    }
+
+    // read a single character
+    if (read(STDIN_FILENO, c, 1) != 1) {
+        return -1;
+    }
+
+    // restore
+    if (tcsetattr(0, TCSANOW, &tmsave)) {
+        return -1;
+    }
+
+    return 0;
+}
+
+static int64_t monotonic_ns(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+
+    return ts.tv_sec * 1000000000LL + ts.tv_nsec;
+}
+
+/* last level cache of CPU 0 from sysfs, e.g. "32768K" */
+static size_t llc_size(void)
+{
+    char line[32] = { 0 };
+    FILE* file = fopen(NOISE_LLC_INDEX, "r");
+    size_t size = 0;
+
+    if (file) {
+        if (fgets(line, sizeof(line), file)) {
+            char* unit;
+            size = strtoul(line, &unit, 10);
+            size <<= (*unit == 'M') ? 20 : (*unit == 'K') ? 10 : 0;
+        }
+        fclose(file);
+    }
+
+    return size ? size : NOISE_LLC_DEFAULT;
+}
+
+/* cache lines in a scattered order, the prefetcher can not hide the misses */
+static uint64_t work_llc(Worker& worker)
+{
+    const size_t lines = worker.size / 64;
+
+    for (int cnt = 0; cnt < NOISE_LLC_CHUNK; cnt++) {
+        worker.position = (worker.position + NOISE_LLC_STRIDE) % lines;
+        worker.buffer[worker.position * 64]++;
+    }
+
+    return NOISE_LLC_CHUNK;
+}
+
+/* one half copied into the other, streams through memory */
+static uint64_t work_membw(Worker& worker)
+{
+    const size_t half = worker.size / 2;
+
+    memcpy(&worker.buffer[half + worker.position], &worker.buffer[worker.position], NOISE_MEMBW_CHUNK);
+    worker.position = (worker.position + NOISE_MEMBW_CHUNK) % (half - NOISE_MEMBW_CHUNK + 1);
+
+    return NOISE_MEMBW_CHUNK;
+}
+
+/* getppid is not served from the vDSO, every call enters the kernel */
+static uint64_t work_syscall(Worker& worker)
+{
+    (void)worker;
+
+    for (int cnt = 0; cnt < NOISE_SYSCALL_CHUNK; cnt++) {
+        syscall(SYS_getppid);
+    }
+
+    return NOISE_SYSCALL_CHUNK;
+}
+
+/* written blocks are flushed and dropped from the page cache, reading them back misses */
+static uint64_t work_io(Worker& worker)
+{
+    const off_t offset = worker.position;
+
+    if (pwrite(worker.fd, worker.buffer, NOISE_IO_BLOCK, offset) != (ssize_t)NOISE_IO_BLOCK) {
+        return 0;
+    }
+
+    if (++worker.blocks % NOISE_IO_SYNC == 0) {
+        fdatasync(worker.fd);
+        posix_fadvise(worker.fd, 0, 0, POSIX_FADV_DONTNEED);
+    }
+
+    if (pread(worker.fd, worker.buffer, NOISE_IO_BLOCK, offset) != (ssize_t)NOISE_IO_BLOCK) {
+        return NOISE_IO_BLOCK;
+    }
+    worker.position = (worker.position + NOISE_IO_BLOCK) % NOISE_IO_FILE_SIZE;
+
+    return 2 * NOISE_IO_BLOCK;
+}
+
+/* ops are the ns spent spinning */
+static uint64_t work_spin(Worker& worker)
+{
+    (void)worker;
+
+    const int64_t start = monotonic_ns();
+    int64_t now;
+
+    do {
+        now = monotonic_ns();
+    } while ((now - start) < NOISE_SPIN_NS);
+
+    return now - start;
+}
+
+static bool setup(Worker& worker, int index)
+{
+    const char* name = workloads[worker.workload].name;
+
+    if ((strcmp(name, "llc") == 0) || (strcmp(name, "membw") == 0)) {
+        const size_t llc = llc_size();
+
+        worker.size = optSize ? optSize : (strcmp(name, "llc") == 0) ? llc : std::max(4 * llc, NOISE_MEMBW_MIN);
+        if (strcmp(name, "membw") == 0) {
+            worker.size = std::max(worker.size, 4 * NOISE_MEMBW_CHUNK);
+        }
+        worker.size = std::max(worker.size, (size_t)64);
+    }
+    else if (strcmp(name, "io") == 0) {
+        char path[256];
+
+        if (optFile) {
+            snprintf(path, sizeof(path), "%s.%d", optFile, index);
+        }
+        else {
+            snprintf(path, sizeof(path), "/tmp/" PROGRAM ".%d.%d", getpid(), index);
+        }
+        worker.fd = open(path, O_RDWR | O_CREAT | O_TRUNC | O_CLOEXEC, 0600);
+        if (worker.fd == -1) {
+            fprintf(stderr, "open(%s) failed: %s\n", path, strerror(errno));
+            return false;
+        }
+        /* the file is only needed while it is open */
+        unlink(path);
+        worker.size = NOISE_IO_BLOCK;
+    }
+
+    if (worker.size) {
+        worker.buffer = (char*)mmap(nullptr, worker.size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+        if (worker.buffer == MAP_FAILED) {
+            worker.buffer = nullptr;
+            perror("mmap() failed");
+            return false;
+        }
+        /* fault in before the measurement starts */
+        memset(worker.buffer, index + 1, worker.size);
+    }
+
+    return true;
+}
+
+static void release(Worker& worker)
+{
+    if (worker.buffer) {
+        munmap(worker.buffer, worker.size);
+        worker.buffer = nullptr;
+    }
+    if (worker.fd != -1) {
+        close(worker.fd);
+        worker.fd = -1;
+    }
+}
+
+static void noise_func(Worker* worker)
+{
+    const int policy = workloads[worker->workload].policy;
+    const int64_t busyNs = (int64_t)NOISE_PERIOD_NS * optLoad / 100;
+    char name[16];
+
+    snprintf(name, sizeof(name), "noise_%s", workloads[worker->workload].name);
+    pthread_setname_np(pthread_self(), name);
+
+    if (worker->cpu != -1) {
+        affinity_t* cpu = affinity_new();
+        char list[16];
+
+        snprintf(list, sizeof(list), "%d", worker->cpu);
+        if (!affinity_parse_list(cpu, list) || (affinity_apply(cpu) == -1)) {
+            fprintf(stderr, "%s: CPU %d not applied: %s\n", name, worker->cpu, strerror(errno));
+        }
+        affinity_destroy(cpu);
+    }
+
+    if (policy == SCHED_FIFO) {
+        struct sched_param param = { .sched_priority = optThreadPrio };
+        const int ret = pthread_setschedparam(pthread_self(), SCHED_FIFO, &param);
+        if (ret != 0) {
+            fprintf(stderr, "%s: SCHED_FIFO %d not applied: %s\n", name, optThreadPrio, strerror(ret));
+        }
+    }
+
+    while (running) {
+        const int64_t period = monotonic_ns();
+
+        do {
+            worker->ops.fetch_add(workloads[worker->workload].work(*worker), std::memory_order_relaxed);
+        } while (running && ((monotonic_ns() - period) < busyNs));
+
+        if (busyNs < NOISE_PERIOD_NS) {
+            const int64_t wake = period + NOISE_PERIOD_NS;
+            struct timespec ts = { .tv_sec = wake / 1000000000LL, .tv_nsec = wake % 1000000000LL };
+
+            clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &ts, nullptr);
+        }
+    }
+}
+
+/**
+ * achieved rate of each workload, summed over its threads
+ */
+static std::string report(const std::vector<Worker>& workers, double seconds)
+{
+    std::string line;
+
+    for (int workload = 0; workload < NOISE_WORKLOADS; workload++) {
+        uint64_t ops = 0;
+        int threads = 0;
+        char item[96];
+
+        for (const auto& worker : workers) {
+            if (worker.workload == workload) {
+                ops += worker.ops.load(std::memory_order_relaxed);
+                threads++;
+            }
+        }
+        if (threads == 0) {
+            continue;
+        }
+
+        snprintf(item, sizeof(item), "%s%s=%.1f %s x%d", line.empty() ? "" : ";", workloads[workload].name,
+                 (seconds > 0.0) ? ops / seconds / workloads[workload].scale : 0.0, workloads[workload].unit, threads);
+        line += item;
+    }
+
+    return line;
+}
+
+int main(int argc, char **argv)
+{
+    char ch;
+    std::vector<int> cpus;
+    char list[256];
+
+    /* parse given cmd line args */
+    process_options(argc, argv);
+
+    for (int cpu = affinity_next(noiseCpus, -1); cpu != -1; cpu = affinity_next(noiseCpus, cpu)) {
+        cpus.push_back(cpu);
+    }
+    if (cpus.empty()) {
+        cpus.push_back(-1);
+    }
+
+    /* workers must not move, the threads hold pointers */
+    std::vector<Worker> workers(optWorkloads.size() * cpus.size());
+    size_t index = 0;
+    for (const auto& workload : optWorkloads) {
+        for (const int cpu : cpus) {
+            workers[index].workload = find_workload(workload);
+            workers[index].cpu = cpu;
+            if (!setup(workers[index], index)) {
+                return 1;
+            }
+            index++;
+        }
+    }
+
+    std::string names;
+    for (const auto& workload : optWorkloads) {
+        names += (names.empty() ? "" : ",") + workload;
+    }
+    printf("noise %s on CPUs %s, %d %% load\n", names.c_str(),
+           affinity_is_empty(noiseCpus) ? "any" : affinity_format(noiseCpus, list, sizeof(list)), optLoad);
+
+    const int64_t start = monotonic_ns();
+    for (auto& worker : workers) {
+        worker.thread = std::thread(noise_func, &worker);
+    }
+
+    if (optDuration > 0) {
+        sleep(optDuration);
+        running = 0;
+    }
+
+    while (running == 1) {
+        printf("\nEnter command : ");
+        fflush(stdout);
+        if (get_one_character(&ch) == -1) {
+            // stdin closed, same as q
+            ch = 'q';
+        }
+        printf("\n");
+        switch (ch) {
+            case 'h':
+                printf("q.) exit application\n");
+                printf("h.) this help\n");
+                break;
+            case 'q':
+                printf("--> quit\n");
+                running = 0;
+                break;
+        }
+    }
+
+    for (auto& worker : workers) {
+        if (worker.thread.joinable()) {
+            worker.thread.join();
+        }
+    }
+    const double seconds = (monotonic_ns() - start) * 1e-9;
+
+    const std::string rates = report(workers, seconds);
+    printf("noise over %.3f s    : %s\n", seconds, rates.c_str());
+
+    if (optReport) {
+        FILE* file = fopen(optReport, "w");
+        if (file) {
+            fprintf(file, "%s\n", rates.c_str());
+            fclose(file);
+        }
+        else {
+            perror("fopen() report failed");
+        }
+        free(optReport);
+        optReport = nullptr;
+    }
+
+    for (auto& worker : workers) {
+        release(worker);
+    }
+
+    if (optFile) {
+        free(optFile);
+        optFile = nullptr;
+    }
+    affinity_destroy(noiseCpus);
+
+    return 0;
+}
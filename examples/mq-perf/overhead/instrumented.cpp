@@ -0,0 +1,14 @@
+/**
+ * the same work twice, only this file is built with -finstrument-functions
+ */
+#include <cstdint>
+
+__attribute__((noinline)) uint64_t work_instrumented(uint64_t value)
+{
+    return value * 6364136223846793005ull + 1442695040888963407ull;
+}
+
+__attribute__((noinline, no_instrument_function)) uint64_t work_plain(uint64_t value)
+{
+    return value * 6364136223846793005ull + 1442695040888963407ull;
+}
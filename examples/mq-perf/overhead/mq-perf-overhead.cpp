@@ -0,0 +1,434 @@
+/**
+ * cost of the instrumentation methods of the examples on a fixed hot loop
+ *   ust       lttng-ust tracepoint (lttng/lttng-ust/hello-tp), build with make LTTNG_UST=1
+ *   usdt      USDT probe, guarded by its semaphore and unguarded (lttng/dynamic-dtrace)
+ *   cyg       -finstrument-functions hooks (lttng/lttng-ust/func-entry-exit)
+ *   pthread   pthread_mutex_lock/unlock, interposed by a preloaded wrapper (pre-build-helpers)
+ *   libc      malloc/free, interposed by a preloaded wrapper (pre-build-helpers)
+ *
+ * Whether a method is enabled depends on the environment (a tracing session,
+ * an attached tracer, a preloaded library), the state is detected and
+ * reported per row. Without lttng-sessiond every method runs disabled.
+ * scripts/mq-perf-overhead.sh runs the usual configurations.
+ *
+ * usage: mq-perf-overhead [-i iterations] [-t max threads] [-r runs] [-l label] [-m methods] [-p] [-n]
+ */
+#include "mq-perf-tp.h"
+#include "mq-perf-usdt.h"
+
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <ctime>
+#include <string>
+#include <vector>
+#include <thread>
+#include <atomic>
+#include <algorithm>
+#include <getopt.h>
+#include <dlfcn.h>
+#include <pthread.h>
+#include <sched.h>
+#include <unistd.h>
+
+#define OVERHEAD_ITERATIONS     2000000
+#define OVERHEAD_RUNS           5
+
+MQ_PERF_USDT_SEMAPHORE(overhead)
+/* referenced by the probe note only, never tested */
+MQ_PERF_USDT_SEMAPHORE(overhead_unguarded)
+
+uint64_t work_instrumented(uint64_t value);
+uint64_t work_plain(uint64_t value);
+
+extern "C" void __cyg_profile_func_enter(void* fn, void* call_site);
+
+/* the not interposed libc functions, reference of the wrapper methods */
+static int (*libc_mutex_lock)(pthread_mutex_t*);
+static int (*libc_mutex_unlock)(pthread_mutex_t*);
+static void* (*libc_malloc)(size_t);
+static void (*libc_free)(void*);
+
+typedef uint64_t (*LoopFunc)(uint64_t iterations, uint64_t seed);
+
+struct Method
+{
+    const char* name;
+    LoopFunc loop;
+    LoopFunc reference;         /* same loop without the instrumentation */
+    std::string state;
+    std::string provider;       /* library implementing the instrumentation */
+};
+
+struct Result
+{
+    double nsPerEvent;
+    double refNsPerEvent;
+    double eventsPerSec;
+};
+
+static inline uint64_t now_ns(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+
+    return (uint64_t)ts.tv_sec * 1000000000ull + ts.tv_nsec;
+}
+
+static inline uint64_t work(uint64_t value)
+{
+    return value * 6364136223846793005ull + 1442695040888963407ull;
+}
+
+static uint64_t loop_none(uint64_t iterations, uint64_t value)
+{
+    for (uint64_t cnt = 0; cnt < iterations; cnt++) {
+        value = work(value);
+        __asm__ __volatile__("" : "+r"(value));
+    }
+
+    return value;
+}
+
+static uint64_t loop_ust(uint64_t iterations, uint64_t value)
+{
+    for (uint64_t cnt = 0; cnt < iterations; cnt++) {
+        value = work(value);
+        tracepoint(mq_perf, recv_wakeup, (int)value);
+        __asm__ __volatile__("" : "+r"(value));
+    }
+
+    return value;
+}
+
+static uint64_t loop_usdt_guarded(uint64_t iterations, uint64_t value)
+{
+    for (uint64_t cnt = 0; cnt < iterations; cnt++) {
+        value = work(value);
+        if (MQ_PERF_USDT_ENABLED(overhead)) {
+            MQ_PERF_USDT1(overhead, value);
+        }
+        __asm__ __volatile__("" : "+r"(value));
+    }
+
+    return value;
+}
+
+static uint64_t loop_usdt(uint64_t iterations, uint64_t value)
+{
+    for (uint64_t cnt = 0; cnt < iterations; cnt++) {
+        value = work(value);
+        MQ_PERF_USDT1(overhead_unguarded, value);
+        __asm__ __volatile__("" : "+r"(value));
+    }
+
+    return value;
+}
+
+static uint64_t loop_cyg(uint64_t iterations, uint64_t value)
+{
+    for (uint64_t cnt = 0; cnt < iterations; cnt++) {
+        value = work_instrumented(value);
+    }
+
+    return value;
+}
+
+static uint64_t loop_cyg_reference(uint64_t iterations, uint64_t value)
+{
+    for (uint64_t cnt = 0; cnt < iterations; cnt++) {
+        value = work_plain(value);
+    }
+
+    return value;
+}
+
+template <bool Interposed>
+static uint64_t loop_pthread(uint64_t iterations, uint64_t value)
+{
+    pthread_mutex_t mutex = PTHREAD_MUTEX_INITIALIZER;
+
+    for (uint64_t cnt = 0; cnt < iterations; cnt++) {
+        Interposed ? pthread_mutex_lock(&mutex) : libc_mutex_lock(&mutex);
+        value = work(value);
+        Interposed ? pthread_mutex_unlock(&mutex) : libc_mutex_unlock(&mutex);
+    }
+
+    return value;
+}
+
+template <bool Interposed>
+static uint64_t loop_libc(uint64_t iterations, uint64_t value)
+{
+    for (uint64_t cnt = 0; cnt < iterations; cnt++) {
+        void* ptr = Interposed ? malloc(64) : libc_malloc(64);
+        /* keep the compiler from eliding the pair */
+        __asm__ __volatile__("" : : "r"(ptr) : "memory");
+        value = work(value);
+        Interposed ? free(ptr) : libc_free(ptr);
+    }
+
+    return value;
+}
+
+static const char* library_of(const void* address)
+{
+    Dl_info info;
+
+    if (address && dladdr(address, &info) && info.dli_fname) {
+        const char* base = strrchr(info.dli_fname, '/');
+        return base ? base + 1 : info.dli_fname;
+    }
+
+    return "-";
+}
+
+/**
+ * resolve the libc definitions directly, a preloaded wrapper comes first in the global scope
+ */
+static void resolve_libc(void)
+{
+    void* libc = dlopen("libc.so.6", RTLD_LAZY | RTLD_NOLOAD);
+    void* libpthread = dlopen("libpthread.so.0", RTLD_LAZY | RTLD_NOLOAD);
+    void* pthread = libpthread ? libpthread : libc;
+
+    libc_mutex_lock = (int (*)(pthread_mutex_t*))dlsym(pthread, "pthread_mutex_lock");
+    libc_mutex_unlock = (int (*)(pthread_mutex_t*))dlsym(pthread, "pthread_mutex_unlock");
+    libc_malloc = (void* (*)(size_t))dlsym(libc, "malloc");
+    libc_free = (void (*)(void*))dlsym(libc, "free");
+}
+
+static void interposed_state(Method& method, const char* symbol, const void* libcAddress)
+{
+    const void* address = dlsym(RTLD_DEFAULT, symbol);
+
+    method.provider = library_of(address);
+    method.state = (address == libcAddress) ? "libc" : "interposed";
+}
+
+static std::vector<Method> build_methods(void)
+{
+    std::vector<Method> methods;
+    Method method;
+
+    methods.push_back({"none", loop_none, loop_none, "-", "-"});
+
+#ifdef HAVE_LTTNG_UST
+    method = {"ust", loop_ust, loop_none, tracepoint_enabled(mq_perf, recv_wakeup) ? "enabled" : "disabled", "liblttng-ust.so"};
+#else
+    method = {"ust", loop_ust, loop_none, "not-built", "-"};
+#endif
+    methods.push_back(method);
+
+#ifdef HAVE_SDT
+    method = {"usdt-guarded", loop_usdt_guarded, loop_none, MQ_PERF_USDT_ENABLED(overhead) ? "enabled" : "disabled", "-"};
+    methods.push_back(method);
+    method = {"usdt", loop_usdt, loop_none, "nop", "-"};
+    methods.push_back(method);
+#else
+    method = {"usdt-guarded", loop_usdt_guarded, loop_none, "not-built", "-"};
+    methods.push_back(method);
+    method = {"usdt", loop_usdt, loop_none, "not-built", "-"};
+    methods.push_back(method);
+#endif
+
+    /* glibc's own hooks do nothing */
+    method = {"cyg", loop_cyg, loop_cyg_reference, "", ""};
+    method.provider = library_of(dlsym(RTLD_DEFAULT, "__cyg_profile_func_enter"));
+    method.state = (method.provider.find("libc.so") == 0) ? "disabled" : "enabled";
+    methods.push_back(method);
+
+    method = {"pthread", loop_pthread<true>, loop_pthread<false>, "", ""};
+    interposed_state(method, "pthread_mutex_lock", (const void*)libc_mutex_lock);
+    methods.push_back(method);
+
+    method = {"libc", loop_libc<true>, loop_libc<false>, "", ""};
+    interposed_state(method, "malloc", (const void*)libc_malloc);
+    methods.push_back(method);
+
+    return methods;
+}
+
+/**
+ * run the loop on threads pinned to distinct cpus, returns the mean ns per
+ * event of the threads and the aggregated events per second
+ */
+static void run_threads(LoopFunc loop, int threads, uint64_t iterations, double* nsPerEvent, double* eventsPerSec)
+{
+    std::vector<std::thread> workers;
+    std::vector<uint64_t> elapsed(threads);
+    std::atomic<int> ready{0};
+    std::atomic<bool> go{false};
+    const int cpus = (int)sysconf(_SC_NPROCESSORS_ONLN);
+
+    for (int index = 0; index < threads; index++) {
+        workers.emplace_back([&, index]() {
+            cpu_set_t set;
+
+            CPU_ZERO(&set);
+            CPU_SET(index % cpus, &set);
+            pthread_setaffinity_np(pthread_self(), sizeof(set), &set);
+
+            ready++;
+            while (!go.load(std::memory_order_acquire));
+
+            const uint64_t start = now_ns();
+            volatile uint64_t sink = loop(iterations, (uint64_t)index);
+            elapsed[index] = now_ns() - start;
+            (void)sink;
+        });
+    }
+
+    while (ready.load() != threads);
+    go.store(true, std::memory_order_release);
+
+    for (auto& worker : workers) {
+        worker.join();
+    }
+
+    uint64_t sum = 0;
+    uint64_t max = 0;
+    for (uint64_t value : elapsed) {
+        sum += value;
+        max = std::max(max, value);
+    }
+
+    *nsPerEvent = (double)sum / threads / iterations;
+    *eventsPerSec = (double)iterations * threads * 1e9 / max;
+}
+
+static Result measure(const Method& method, int threads, uint64_t iterations, int runs)
+{
+    Result result = {1e30, 1e30, 0};
+
+    /* alternate method and reference, keep the best of the runs */
+    for (int run = 0; run < runs; run++) {
+        double ns, rate;
+
+        run_threads(method.loop, threads, iterations, &ns, &rate);
+        if (ns < result.nsPerEvent) {
+            result.nsPerEvent = ns;
+            result.eventsPerSec = rate;
+        }
+
+        run_threads(method.reference, threads, iterations, &ns, &rate);
+        result.refNsPerEvent = std::min(result.refNsPerEvent, ns);
+    }
+
+    return result;
+}
+
+static void display_help(const char* name)
+{
+    printf("usage: %s [options]\n"
+           "  -i, --iterations=N    events per thread and run (default %d)\n"
+           "  -t, --threads=N       up to N threads, 1 2 4 .. N (default 4)\n"
+           "  -r, --runs=N          runs per measurement, the best is taken (default %d)\n"
+           "  -l, --label=LABEL     first column, names the configuration (default plain)\n"
+           "  -m, --methods=LIST    comma separated methods (default all)\n"
+           "  -p, --pretty          aligned table instead of CSV\n"
+           "  -n, --no-header       omit the CSV header, to append runs\n"
+           "  -h, --help            this help\n", name, OVERHEAD_ITERATIONS, OVERHEAD_RUNS);
+}
+
+int main(int argc, char *argv[])
+{
+    uint64_t iterations = OVERHEAD_ITERATIONS;
+    int maxThreads = std::min(4, (int)sysconf(_SC_NPROCESSORS_ONLN));
+    int runs = OVERHEAD_RUNS;
+    const char* label = "plain";
+    std::string selected;
+    bool pretty = false;
+    bool header = true;
+
+    static struct option long_options[] = {
+        { "iterations", required_argument, 0, 'i' },
+        { "threads",    required_argument, 0, 't' },
+        { "runs",       required_argument, 0, 'r' },
+        { "label",      required_argument, 0, 'l' },
+        { "methods",    required_argument, 0, 'm' },
+        { "pretty",     no_argument,       0, 'p' },
+        { "no-header",  no_argument,       0, 'n' },
+        { "help",       no_argument,       0, 'h' },
+        { 0, 0, 0, 0 }
+    };
+
+    int opt;
+    while ((opt = getopt_long(argc, argv, "i:t:r:l:m:pnh", long_options, NULL)) != -1) {
+        switch (opt) {
+            case 'i':
+                iterations = strtoull(optarg, NULL, 0);
+                break;
+            case 't':
+                maxThreads = std::max(1, atoi(optarg));
+                break;
+            case 'r':
+                runs = std::max(1, atoi(optarg));
+                break;
+            case 'l':
+                label = optarg;
+                break;
+            case 'm':
+                selected = std::string(",") + optarg + ",";
+                break;
+            case 'p':
+                pretty = true;
+                break;
+            case 'n':
+                header = false;
+                break;
+            default:
+                display_help(argv[0]);
+                return opt == 'h' ? 0 : 1;
+        }
+    }
+
+    resolve_libc();
+
+    std::vector<int> threadCounts;
+    for (int threads = 1; threads < maxThreads; threads *= 2) {
+        threadCounts.push_back(threads);
+    }
+    threadCounts.push_back(maxThreads);
+
+    const char* csvFormat = "%s,%s,%s,%s,%d,%lu,%.2f,%.2f,%.2f,%.2f,%.3f\n";
+    const char* prettyFormat = "%-14s %-13s %-10s %-22s %7d %12lu %10.2f %10.2f %10.2f %12.2f %8.3f\n";
+
+    if (pretty) {
+        printf("%-14s %-13s %-10s %-22s %7s %12s %10s %10s %10s %12s %8s\n", "label", "method", "state", "provider", "threads",
+               "events", "ns/event", "ref ns", "overhead", "Mevents/s", "scaling");
+    }
+    else if (header) {
+        printf("label,method,state,provider,threads,events,ns_per_event,ref_ns_per_event,overhead_ns,mevents_per_s,scaling\n");
+    }
+
+    /* warm up caches, frequency and the lazy bindings */
+    double ns, rate;
+    run_threads(loop_none, 1, iterations, &ns, &rate);
+
+    for (const Method& method : build_methods()) {
+        if (!selected.empty() && (selected.find(std::string(",") + method.name + ",") == std::string::npos)) {
+            continue;
+        }
+
+        double singleRate = 0;
+
+        for (int threads : threadCounts) {
+            const Result result = measure(method, threads, iterations, runs);
+
+            if (threads == 1) {
+                singleRate = result.eventsPerSec;
+            }
+
+            printf(pretty ? prettyFormat : csvFormat, label, method.name, method.state.c_str(), method.provider.c_str(), threads,
+                   (unsigned long)(iterations * threads), result.nsPerEvent, result.refNsPerEvent,
+                   result.nsPerEvent - result.refNsPerEvent, result.eventsPerSec / 1e6,
+                   singleRate ? result.eventsPerSec / (singleRate * threads) : 0.0);
+            fflush(stdout);
+        }
+    }
+
+    return 0;
+}
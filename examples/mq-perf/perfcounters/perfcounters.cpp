@@ -0,0 +1,262 @@
+#include <linux/perf_event.h>
+#include <sys/ioctl.h>
+#include <sys/resource.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#include <errno.h>
+#include <stdio.h>
+#include <string.h>
+#include <stdlib.h>
+#include <assert.h>
+
+#include "perfcounters.h"
+
+#define PERFCOUNTERS_GROUP_SW   0
+#define PERFCOUNTERS_GROUP_HW   1
+#define PERFCOUNTERS_GROUPS     2
+
+static const struct {
+    const char* name;
+    uint32_t type;
+    uint64_t config;
+    int group;
+} perfcounters_events[PERFCOUNTERS_MAX] = {
+    { "context switches",   PERF_TYPE_SOFTWARE, PERF_COUNT_SW_CONTEXT_SWITCHES, PERFCOUNTERS_GROUP_SW },
+    { "cpu migrations",     PERF_TYPE_SOFTWARE, PERF_COUNT_SW_CPU_MIGRATIONS,   PERFCOUNTERS_GROUP_SW },
+    { "page faults",        PERF_TYPE_SOFTWARE, PERF_COUNT_SW_PAGE_FAULTS,      PERFCOUNTERS_GROUP_SW },
+    { "syscalls",           PERF_TYPE_TRACEPOINT, 0 /* id from tracefs */,    PERFCOUNTERS_GROUP_SW },
+    { "cycles",             PERF_TYPE_HARDWARE, PERF_COUNT_HW_CPU_CYCLES,       PERFCOUNTERS_GROUP_HW },
+    { "instructions",       PERF_TYPE_HARDWARE, PERF_COUNT_HW_INSTRUCTIONS,     PERFCOUNTERS_GROUP_HW },
+    { "cache misses",       PERF_TYPE_HARDWARE, PERF_COUNT_HW_CACHE_MISSES,     PERFCOUNTERS_GROUP_HW },
+    { "branch misses",      PERF_TYPE_HARDWARE, PERF_COUNT_HW_BRANCH_MISSES,    PERFCOUNTERS_GROUP_HW },
+};
+
+struct _perfcounters {
+    int kernel;                             /* kernel part is counted   */
+    int leader[PERFCOUNTERS_GROUPS];
+    int fd[PERFCOUNTERS_MAX];
+    uint64_t id[PERFCOUNTERS_MAX];
+    uint64_t value[PERFCOUNTERS_MAX];
+    bool valid[PERFCOUNTERS_MAX];
+    bool multiplexed;
+    struct rusage usage;                    /* at start, without kernel counting */
+};
+
+static long perfcounters_open(struct perf_event_attr* attr, int group)
+{
+    return syscall(__NR_perf_event_open, attr, 0 /* calling thread */, -1 /* any cpu */, group, PERF_FLAG_FD_CLOEXEC);
+}
+
+static uint64_t perfcounters_syscall_id(void)
+{
+    char line[32] = { 0 };
+    FILE* file = fopen(PERFCOUNTERS_TRACEFS "/events/raw_syscalls/sys_enter/id", "r");
+
+    if (file == nullptr) {
+        file = fopen(PERFCOUNTERS_DEBUGFS "/events/raw_syscalls/sys_enter/id", "r");
+    }
+    if (file == nullptr) {
+        return 0;
+    }
+
+    if (fgets(line, sizeof(line), file) == nullptr) {
+        line[0] = '\0';
+    }
+    fclose(file);
+
+    return strtoull(line, nullptr, 10);
+}
+
+static void perfcounters_add(perfcounters_t* self, int counter, uint64_t config)
+{
+    struct perf_event_attr attr;
+    const int group = perfcounters_events[counter].group;
+
+    memset(&attr, 0, sizeof(attr));
+    attr.size = sizeof(attr);
+    attr.type = perfcounters_events[counter].type;
+    attr.config = config;
+    attr.read_format = PERF_FORMAT_GROUP | PERF_FORMAT_ID | PERF_FORMAT_TOTAL_TIME_ENABLED | PERF_FORMAT_TOTAL_TIME_RUNNING;
+    /* members follow the leader */
+    attr.disabled = (self->leader[group] == -1);
+    attr.exclude_kernel = !self->kernel;
+    attr.exclude_hv = 1;
+
+    const int fd = perfcounters_open(&attr, self->leader[group]);
+    if (fd == -1) {
+        return;
+    }
+
+    if (ioctl(fd, PERF_EVENT_IOC_ID, &self->id[counter]) == -1) {
+        close(fd);
+        return;
+    }
+
+    self->fd[counter] = fd;
+    if (self->leader[group] == -1) {
+        self->leader[group] = fd;
+    }
+}
+
+perfcounters_t* perfcounters_new(void)
+{
+    perfcounters_t* self;
+    struct perf_event_attr attr;
+
+    self = (perfcounters_t*)malloc(sizeof(perfcounters_t));
+    assert(self != nullptr);
+
+    memset(self, 0, sizeof(perfcounters_t));
+    for (int cnt = 0; cnt < PERFCOUNTERS_GROUPS; cnt++) {
+        self->leader[cnt] = -1;
+    }
+    for (int cnt = 0; cnt < PERFCOUNTERS_MAX; cnt++) {
+        self->fd[cnt] = -1;
+    }
+
+    /* probe whether the kernel part may be counted */
+    memset(&attr, 0, sizeof(attr));
+    attr.size = sizeof(attr);
+    attr.type = PERF_TYPE_SOFTWARE;
+    attr.config = PERF_COUNT_SW_TASK_CLOCK;
+    attr.disabled = 1;
+    attr.exclude_hv = 1;
+    const int probe = perfcounters_open(&attr, -1);
+    if (probe != -1) {
+        self->kernel = 1;
+        close(probe);
+    }
+
+    /* software events happen in the kernel, user space only they would read 0 */
+    if (self->kernel) {
+        const uint64_t syscalls = perfcounters_syscall_id();
+
+        perfcounters_add(self, PERFCOUNTERS_CONTEXT_SWITCHES, perfcounters_events[PERFCOUNTERS_CONTEXT_SWITCHES].config);
+        perfcounters_add(self, PERFCOUNTERS_CPU_MIGRATIONS, perfcounters_events[PERFCOUNTERS_CPU_MIGRATIONS].config);
+        perfcounters_add(self, PERFCOUNTERS_PAGE_FAULTS, perfcounters_events[PERFCOUNTERS_PAGE_FAULTS].config);
+        if (syscalls) {
+            perfcounters_add(self, PERFCOUNTERS_SYSCALLS, syscalls);
+        }
+    }
+
+    for (int cnt = PERFCOUNTERS_CYCLES; cnt < PERFCOUNTERS_MAX; cnt++) {
+        perfcounters_add(self, cnt, perfcounters_events[cnt].config);
+    }
+
+    return self;
+}
+
+void perfcounters_destroy(perfcounters_t* self)
+{
+    if (self == nullptr) {
+        return;
+    }
+
+    for (int cnt = 0; cnt < PERFCOUNTERS_MAX; cnt++) {
+        if (self->fd[cnt] != -1) {
+            close(self->fd[cnt]);
+        }
+    }
+
+    free(self);
+}
+
+void perfcounters_start(perfcounters_t* self)
+{
+    for (int cnt = 0; cnt < PERFCOUNTERS_GROUPS; cnt++) {
+        if (self->leader[cnt] != -1) {
+            ioctl(self->leader[cnt], PERF_EVENT_IOC_RESET, PERF_IOC_FLAG_GROUP);
+            ioctl(self->leader[cnt], PERF_EVENT_IOC_ENABLE, PERF_IOC_FLAG_GROUP);
+        }
+    }
+
+    getrusage(RUSAGE_THREAD, &self->usage);
+}
+
+static void perfcounters_read_group(perfcounters_t* self, int leader)
+{
+    struct {
+        uint64_t nr;
+        uint64_t time_enabled;
+        uint64_t time_running;
+        struct {
+            uint64_t value;
+            uint64_t id;
+        } values[PERFCOUNTERS_MAX];
+    } data;
+
+    if (read(leader, &data, sizeof(data)) <= 0) {
+        return;
+    }
+
+    for (uint64_t index = 0; index < data.nr; index++) {
+        uint64_t value = data.values[index].value;
+
+        /* extrapolate, the group shared the PMU with others */
+        if ((data.time_running > 0) && (data.time_running < data.time_enabled)) {
+            value = (uint64_t)((double)value * data.time_enabled / data.time_running);
+            self->multiplexed = true;
+        }
+
+        for (int cnt = 0; cnt < PERFCOUNTERS_MAX; cnt++) {
+            if ((self->fd[cnt] != -1) && (self->id[cnt] == data.values[index].id)) {
+                self->value[cnt] = value;
+                self->valid[cnt] = (data.time_running > 0);
+            }
+        }
+    }
+}
+
+void perfcounters_stop(perfcounters_t* self)
+{
+    for (int cnt = 0; cnt < PERFCOUNTERS_GROUPS; cnt++) {
+        if (self->leader[cnt] != -1) {
+            ioctl(self->leader[cnt], PERF_EVENT_IOC_DISABLE, PERF_IOC_FLAG_GROUP);
+            perfcounters_read_group(self, self->leader[cnt]);
+        }
+    }
+
+    if (!self->kernel) {
+        struct rusage usage;
+
+        getrusage(RUSAGE_THREAD, &usage);
+        self->value[PERFCOUNTERS_CONTEXT_SWITCHES] = (usage.ru_nvcsw + usage.ru_nivcsw) -
+                                                     (self->usage.ru_nvcsw + self->usage.ru_nivcsw);
+        self->value[PERFCOUNTERS_PAGE_FAULTS] = (usage.ru_minflt + usage.ru_majflt) -
+                                                (self->usage.ru_minflt + self->usage.ru_majflt);
+        self->valid[PERFCOUNTERS_CONTEXT_SWITCHES] = true;
+        self->valid[PERFCOUNTERS_PAGE_FAULTS] = true;
+    }
+}
+
+bool perfcounters_get(const perfcounters_t* self, enum perfcounters_counter counter, uint64_t* value)
+{
+    *value = self->value[counter];
+
+    return self->valid[counter];
+}
+
+void perfcounters_dump(const perfcounters_t* self, uint64_t messages)
+{
+    printf("Counters of %lu messages (%s%s)\n", (unsigned long)messages,
+           self->kernel ? "user and kernel" : "user space, switches and faults from getrusage",
+           self->multiplexed ? ", multiplexed" : "");
+
+    for (int cnt = 0; cnt < PERFCOUNTERS_MAX; cnt++) {
+        if (!self->valid[cnt]) {
+            printf("%-21s: %12s\n", perfcounters_events[cnt].name, "n/a");
+        }
+        else if (messages > 0) {
+            printf("%-21s: %12lu %12.3f / message\n", perfcounters_events[cnt].name, (unsigned long)self->value[cnt],
+                   (double)self->value[cnt] / messages);
+        }
+        else {
+            printf("%-21s: %12lu\n", perfcounters_events[cnt].name, (unsigned long)self->value[cnt]);
+        }
+    }
+
+    if (self->valid[PERFCOUNTERS_CYCLES] && self->valid[PERFCOUNTERS_INSTRUCTIONS] && self->value[PERFCOUNTERS_CYCLES]) {
+        printf("%-21s: %12.3f\n", "instructions / cycle",
+               (double)self->value[PERFCOUNTERS_INSTRUCTIONS] / self->value[PERFCOUNTERS_CYCLES]);
+    }
+}
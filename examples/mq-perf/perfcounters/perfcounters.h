@@ -0,0 +1,43 @@
+#pragma once
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#define PERFCOUNTERS_TRACEFS    "/sys/kernel/tracing"
+#define PERFCOUNTERS_DEBUGFS    "/sys/kernel/debug/tracing"
+
+enum perfcounters_counter {
+    /* software group, always there */
+    PERFCOUNTERS_CONTEXT_SWITCHES,
+    PERFCOUNTERS_CPU_MIGRATIONS,
+    PERFCOUNTERS_PAGE_FAULTS,
+    PERFCOUNTERS_SYSCALLS,                  /* raw_syscalls:sys_enter, needs tracefs */
+    /* hardware group, missing in most VMs */
+    PERFCOUNTERS_CYCLES,
+    PERFCOUNTERS_INSTRUCTIONS,
+    PERFCOUNTERS_CACHE_MISSES,
+    PERFCOUNTERS_BRANCH_MISSES,
+    PERFCOUNTERS_MAX
+};
+
+/**
+ * perf_event_open counter groups of the calling thread. every counter
+ * which can not be opened is left out. without permission to count in
+ * the kernel (perf_event_paranoid > 1 and no CAP_PERFMON) the hardware
+ * counters count user space only and context switches and page faults
+ * come from getrusage(RUSAGE_THREAD).
+ */
+typedef struct _perfcounters perfcounters_t;
+
+perfcounters_t* perfcounters_new(void);
+void perfcounters_destroy(perfcounters_t* self);
+
+/* around the hot loop, same thread as perfcounters_new */
+void perfcounters_start(perfcounters_t* self);
+void perfcounters_stop(perfcounters_t* self);
+
+/* false if the counter is not available, value scaled when multiplexed */
+bool perfcounters_get(const perfcounters_t* self, enum perfcounters_counter counter, uint64_t* value);
+
+/* totals and per message values */
+void perfcounters_dump(const perfcounters_t* self, uint64_t messages);
@@ -0,0 +1,228 @@
+#pragma once
+
+#include <atomic>
+#include <thread>
+#include <vector>
+#include <limits>
+#include <algorithm>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <ctime>
+#include <sched.h>
+#include "TscClock.h"
+
+#define CLOCK_CHECK_ROUNDS      2000        /* ping-pongs per CPU pair                     */
+#define CLOCK_CHECK_SPINS       10000       /* busy polls before yielding                  */
+#define CLOCK_CHECK_TIMEOUT_NS  1000000000  /* a partner which does not answer in 1s fails */
+#define CLOCK_TOLERANCE_NS      1000        /* default tolerance of the offset bound       */
+
+/**
+ * result of one CPU pair, offsets are clock(cpuB) - clock(cpuA)
+ */
+struct ClockPair
+{
+    int cpuA = -1;
+    int cpuB = -1;
+    int64_t lowNs = std::numeric_limits<int64_t>::min();     /* offset is at least  */
+    int64_t highNs = std::numeric_limits<int64_t>::max();    /* offset is at most   */
+    int64_t roundTripNs = std::numeric_limits<int64_t>::max();
+    uint64_t backwards = 0;                                 /* causality or monotonicity violated */
+    uint32_t rounds = 0;
+    bool failed = false;                                    /* not pinned or no answer */
+
+    int64_t offsetNs() const
+    {
+        return lowNs / 2 + highNs / 2;
+    }
+
+    /* largest error a one way latency between both CPUs may carry */
+    int64_t boundNs() const
+    {
+        return std::max(std::abs(lowNs), std::abs(highNs));
+    }
+
+    /* the interval is empty if the clocks drifted while measuring */
+    bool consistent() const
+    {
+        return !failed && (rounds > 0) && (backwards == 0) && (lowNs <= highNs);
+    }
+};
+
+/**
+ * cross CPU clock consistency check
+ *
+ * two threads pinned to cpuA and cpuB ping-pong over two cache lines, each
+ * round A stamps t1 and pings, B stamps t2 and answers, A stamps t3. causality
+ * gives t2 - t3 <= offset <= t2 - t1, the tightest bounds of all rounds are kept.
+ * the stamps are taken with TscClock, the clock the messages are stamped with.
+ */
+class ClockCheck
+{
+    public:
+        /* every pair of the two lists, same CPUs share one clock and are skipped */
+        void check(const std::vector<int>& cpusA, const std::vector<int>& cpusB, uint32_t rounds = CLOCK_CHECK_ROUNDS)
+        {
+            for (const int cpuA : cpusA) {
+                for (const int cpuB : cpusB) {
+                    if (cpuA != cpuB) {
+                        m_pairs.push_back(run(cpuA, cpuB, rounds));
+                    }
+                }
+            }
+        }
+
+        const std::vector<ClockPair>& getPairs() const
+        {
+            return m_pairs;
+        }
+
+        /* first inconsistent pair or the one with the largest bound, nullptr if nothing was checked */
+        const ClockPair* getWorst() const
+        {
+            const ClockPair* worst = nullptr;
+
+            for (const auto& pair : m_pairs) {
+                if (!pair.consistent()) {
+                    return &pair;
+                }
+                if ((worst == nullptr) || (pair.boundNs() > worst->boundNs())) {
+                    worst = &pair;
+                }
+            }
+
+            return worst;
+        }
+
+        bool withinTolerance(int64_t toleranceNs) const
+        {
+            const ClockPair* worst = getWorst();
+
+            return (worst == nullptr) || (worst->consistent() && (worst->boundNs() <= toleranceNs));
+        }
+
+        void dump() const
+        {
+            const ClockPair* worst = getWorst();
+
+            if (worst == nullptr) {
+                printf("clock check          : no CPU pair to check\n");
+                return;
+            }
+
+            printf("clock check          : %zu CPU pairs, worst CPU %d -> %d offset %ld ns in [%ld, %ld] ns, "
+                   "bound %ld ns, round trip %ld ns%s%s\n",
+                   m_pairs.size(), worst->cpuA, worst->cpuB, (long)worst->offsetNs(), (long)worst->lowNs, (long)worst->highNs,
+                   (long)worst->boundNs(), (long)worst->roundTripNs, worst->backwards ? ", causality violated" : "",
+                   worst->failed ? ", failed" : "");
+        }
+
+    private:
+        struct alignas(64) Line
+        {
+            std::atomic<uint32_t> seq{0};
+            int64_t stamp = 0;
+        };
+
+        static bool pin(int cpu)
+        {
+            cpu_set_t* set = CPU_ALLOC(cpu + 1);
+            const size_t size = CPU_ALLOC_SIZE(cpu + 1);
+
+            CPU_ZERO_S(size, set);
+            CPU_SET_S(cpu, size, set);
+            const bool ok = (sched_setaffinity(0, size, set) == 0);
+            CPU_FREE(set);
+
+            return ok;
+        }
+
+        static int64_t monotonicNs()
+        {
+            struct timespec ts;
+
+            clock_gettime(CLOCK_MONOTONIC, &ts);
+
+            return ts.tv_sec * 1000000000LL + ts.tv_nsec;
+        }
+
+        /* false after the timeout, polls yield so pairs sharing a CPU with others still progress */
+        static bool wait(const Line& line, uint32_t seq, int64_t deadlineNs)
+        {
+            for (uint32_t spins = 0; line.seq.load(std::memory_order_acquire) != seq; spins++) {
+                if (spins >= CLOCK_CHECK_SPINS) {
+                    if (monotonicNs() > deadlineNs) {
+                        return false;
+                    }
+                    sched_yield();
+                    spins = 0;
+                }
+            }
+
+            return true;
+        }
+
+        static ClockPair run(int cpuA, int cpuB, uint32_t rounds)
+        {
+            ClockPair pair;
+            Line ping;
+            Line pong;
+            std::atomic<bool> failed{false};
+
+            pair.cpuA = cpuA;
+            pair.cpuB = cpuB;
+
+            std::thread partner([&]()
+            {
+                if (!pin(cpuB)) {
+                    failed = true;
+                }
+                for (uint32_t round = 1; (round <= rounds) && !failed; round++) {
+                    if (!wait(ping, round, monotonicNs() + CLOCK_CHECK_TIMEOUT_NS)) {
+                        failed = true;
+                        break;
+                    }
+                    pong.stamp = TscClock::now();
+                    pong.seq.store(round, std::memory_order_release);
+                }
+            });
+
+            std::thread initiator([&]()
+            {
+                int64_t previous = std::numeric_limits<int64_t>::min();
+
+                if (!pin(cpuA)) {
+                    failed = true;
+                }
+                for (uint32_t round = 1; (round <= rounds) && !failed; round++) {
+                    const int64_t t1 = TscClock::now();
+                    ping.seq.store(round, std::memory_order_release);
+                    if (!wait(pong, round, monotonicNs() + CLOCK_CHECK_TIMEOUT_NS)) {
+                        failed = true;
+                        break;
+                    }
+                    const int64_t t3 = TscClock::now();
+                    const int64_t t2 = pong.stamp;
+
+                    if ((t1 < previous) || (t2 < t1) || (t3 < t2)) {
+                        pair.backwards++;
+                    }
+                    previous = t3;
+
+                    pair.lowNs = std::max(pair.lowNs, TscClock::toNs(t2 - t3));
+                    pair.highNs = std::min(pair.highNs, TscClock::toNs(t2 - t1));
+                    pair.roundTripNs = std::min(pair.roundTripNs, TscClock::toNs(t3 - t1));
+                    pair.rounds++;
+                }
+            });
+
+            initiator.join();
+            partner.join();
+            pair.failed = failed;
+
+            return pair;
+        }
+
+    private:
+        std::vector<ClockPair> m_pairs;
+};
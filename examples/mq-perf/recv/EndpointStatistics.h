@@ -0,0 +1,95 @@
+#pragma once
+
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <cstdio>
+#include <limits>
+#include <string>
+#include "SequenceTracking.h"
+
+/**
+ * running latency statistics and sequence accounting of one endpoint of the
+ * fan-in receiver. no samples are kept, hundreds of endpoints stay small.
+ */
+class EndpointStatistics
+{
+    public:
+        EndpointStatistics(const std::string& name = "")
+            : m_name{name}
+        {
+        }
+
+        inline void add(int64_t latencyNs, uint32_t seq, int64_t capture)
+        {
+            m_sequence.add(seq, capture);
+
+            m_count++;
+            m_minNs = std::min(m_minNs, latencyNs);
+            m_maxNs = std::max(m_maxNs, latencyNs);
+            /* shifted by the first sample to keep precision */
+            if (m_count == 1) {
+                m_shiftNs = latencyNs;
+            }
+            const double value = (double)(latencyNs - m_shiftNs);
+            m_sum += value;
+            m_sumSq += value * value;
+        }
+
+        /* messages taken in one go after the endpoint became ready */
+        inline void batch(uint32_t messages)
+        {
+            m_batches++;
+            m_maxBatch = std::max(m_maxBatch, messages);
+        }
+
+        const std::string& getName() const
+        {
+            return m_name;
+        }
+
+        const SequenceTracking& getSequence() const
+        {
+            return m_sequence;
+        }
+
+        double getAverageUs() const
+        {
+            return m_count ? (m_shiftNs + m_sum / m_count) * 1e-3 : 0.0;
+        }
+
+        double getDeviationUs() const
+        {
+            if (m_count < 2) {
+                return 0.0;
+            }
+
+            return sqrt((m_sumSq - m_sum * m_sum / m_count) / (m_count - 1)) * 1e-3;
+        }
+
+        static void dumpHeader()
+        {
+            printf("%-24s %10s %8s %7s %10s %10s %10s %10s %8s %6s\n", "endpoint", "received", "lost", "reorder",
+                   "min us", "avg us", "max us", "dev us", "batches", "batch");
+        }
+
+        void dump() const
+        {
+            printf("%-24s %10lu %8lu %7lu %10.3f %10.3f %10.3f %10.3f %8lu %6u\n", m_name.c_str(), (unsigned long)m_count,
+                   (unsigned long)m_sequence.getLost(), (unsigned long)m_sequence.getReordered(),
+                   m_count ? m_minNs * 1e-3 : 0.0, getAverageUs(), m_count ? m_maxNs * 1e-3 : 0.0, getDeviationUs(),
+                   (unsigned long)m_batches, m_maxBatch);
+        }
+
+    private:
+        std::string m_name;
+        SequenceTracking m_sequence;
+        uint64_t m_count = 0;
+        int64_t m_minNs = std::numeric_limits<int64_t>::max();
+        int64_t m_maxNs = std::numeric_limits<int64_t>::min();
+        int64_t m_shiftNs = 0;
+        double m_sum = 0.0;
+        double m_sumSq = 0.0;
+        uint64_t m_batches = 0;
+        uint32_t m_maxBatch = 0;
+};
@@ -0,0 +1,121 @@
+#pragma once
+
+#include <cstdint>
+#include <cstdio>
+#include <ctime>
+#include <vector>
+#include <sched.h>
+#include <sys/time.h>
+#include <sys/resource.h>
+
+#define MAX_OUTLIERS    10000 /* we may capture that much OutlierItems */
+
+/**
+ * context of one sample above the threshold
+ */
+struct OutlierItem
+{
+    uint32_t seq;
+    uint32_t cpu;
+    int64_t latencyNs;
+    struct timespec monotonic;  /* LTTng kernel traces are stamped with this clock */
+    struct timespec realtime;
+    long voluntarySwitches;     /* context switches of the recv thread since the previous outlier */
+    long involuntarySwitches;
+};
+
+/**
+ * Outlier capture as class, all items are pre-allocated
+ */
+class OutlierCapture
+{
+    public:
+        OutlierCapture(const uint32_t maxSize = MAX_OUTLIERS)
+            : m_maxSize{maxSize}
+        {
+        }
+
+        virtual ~OutlierCapture()
+        {
+        }
+
+        void configure(int thresholdUs)
+        {
+            m_thresholdNs = (int64_t)thresholdUs * 1000;
+            /* remark: must be pre-allocated to avoid outliers due to memory allocation */
+            m_items.resize(m_maxSize);
+        }
+
+        bool enabled() const
+        {
+            return m_thresholdNs > 0;
+        }
+
+        /**
+         * to be called from the recv thread for every sample, the usage is only
+         * read for the first sample and for outliers, a syscall per message would
+         * cost more than the switch counts are worth. the counts of an outlier
+         * cover the time since the previous outlier.
+         */
+        inline void add(int64_t latencyNs, uint32_t seq)
+        {
+            if (!m_haveUsage) {
+                getrusage(RUSAGE_THREAD, &m_lastUsage);
+                m_haveUsage = true;
+            }
+
+            if (latencyNs > m_thresholdNs) {
+                if (m_index < m_maxSize) {
+                    struct rusage usage;
+                    OutlierItem& item = m_items[m_index];
+
+                    getrusage(RUSAGE_THREAD, &usage);
+                    clock_gettime(CLOCK_MONOTONIC, &item.monotonic);
+                    clock_gettime(CLOCK_REALTIME, &item.realtime);
+                    item.seq = seq;
+                    item.cpu = sched_getcpu();
+                    item.latencyNs = latencyNs;
+                    item.voluntarySwitches = usage.ru_nvcsw - m_lastUsage.ru_nvcsw;
+                    item.involuntarySwitches = usage.ru_nivcsw - m_lastUsage.ru_nivcsw;
+                    m_lastUsage = usage;
+                    m_index++;
+                }
+                else {
+                    m_missed++;
+                }
+            }
+        }
+
+        void dump()
+        {
+            char date[32];
+            struct tm tm;
+
+            printf("Outliers above %ld us : %u (%lu not captured)\n", (long)(m_thresholdNs / 1000), m_index, (unsigned long)m_missed);
+
+            if (m_index == 0) {
+                return;
+            }
+
+            printf("%10s %4s %12s %22s %30s %6s %6s\n", "seq", "cpu", "latency us", "monotonic", "realtime", "vcsw", "ivcsw");
+            for (uint32_t cnt = 0; cnt < m_index; cnt++) {
+                const OutlierItem& item = m_items[cnt];
+
+                localtime_r(&item.realtime.tv_sec, &tm);
+                strftime(date, sizeof(date), "%Y-%m-%d %H:%M:%S", &tm);
+
+                printf("%10u %4u %12.3f %12ld.%09ld %20s.%09ld %6ld %6ld\n", item.seq, item.cpu, item.latencyNs / 1000.0,
+                       (long)item.monotonic.tv_sec, item.monotonic.tv_nsec, date, item.realtime.tv_nsec,
+                       item.voluntarySwitches, item.involuntarySwitches);
+            }
+        }
+
+    private:
+        std::vector<OutlierItem> m_items;
+        uint32_t m_index = 0;
+        uint64_t m_missed = 0;
+        int64_t m_thresholdNs = 0;
+        struct rusage m_lastUsage;
+        bool m_haveUsage = false;
+        const uint32_t m_maxSize;
+};
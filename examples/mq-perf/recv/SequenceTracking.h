@@ -0,0 +1,195 @@
+#pragma once
+
+#include <algorithm>
+#include <cstdint>
+#include <cstdio>
+#include <vector>
+#include "TscClock.h"
+
+#define SEQUENCE_WINDOW     4096    /* late messages within this distance are told from duplicates, power of 2 */
+
+/**
+ * sequence accounting of one sender
+ *
+ * the sender numbers its messages 1, 2, 3, ... and counts failed sends as well,
+ * so a gap is a message lost anywhere between the two send calls. a message
+ * behind the highest sequence seen is reordered when it is still missing and a
+ * duplicate when it was received already, a bitmap of the last SEQUENCE_WINDOW
+ * sequences tells them apart. a sequence 1 behind which was received already or
+ * is beyond the window is a restarted sender, not a duplicate.
+ */
+class SequenceTracking
+{
+    public:
+        SequenceTracking(const uint32_t window = SEQUENCE_WINDOW)
+            : m_window{window}
+        {
+            /* remark: must be pre-allocated to avoid outliers due to memory allocation */
+            m_seen.resize((window + 63) / 64);
+        }
+
+        virtual ~SequenceTracking()
+        {
+        }
+
+        inline void add(uint32_t seq, int64_t capture)
+        {
+            if (m_received == 0) {
+                m_firstCapture = capture;
+                start(seq);
+            }
+            else {
+                /* signed distance, the sequence wraps after 2^32 messages */
+                const int32_t ahead = (int32_t)(seq - m_highest);
+
+                if (ahead > 0) {
+                    if (ahead > 1) {
+                        m_gaps++;
+                        m_missing += ahead - 1;
+                    }
+                    forget(seq);
+                    m_highest = seq;
+                }
+                else if ((seq == 1) && (((uint32_t)-ahead >= m_window) || seen(seq))) {
+                    m_restarts++;
+                    start(seq);
+                }
+                else if ((uint32_t)-ahead < m_window) {
+                    if (seen(seq)) {
+                        m_duplicates++;
+                        m_lastCapture = capture;
+                        return;
+                    }
+                    m_reordered++;
+                    /* not missing if it is older than the first one received */
+                    m_missing -= (m_missing > 0);
+                }
+                else {
+                    /* too late to know whether it is a duplicate */
+                    m_stale++;
+                }
+            }
+
+            mark(seq);
+            m_received++;
+            m_lastCapture = capture;
+        }
+
+        inline void timeout()
+        {
+            m_timeouts++;
+        }
+
+        uint64_t getReceived() const
+        {
+            return m_received;
+        }
+
+        /* still missing, sent but never received */
+        uint64_t getLost() const
+        {
+            return m_missing;
+        }
+
+        uint64_t getGaps() const
+        {
+            return m_gaps;
+        }
+
+        uint64_t getReordered() const
+        {
+            return m_reordered;
+        }
+
+        uint64_t getDuplicates() const
+        {
+            return m_duplicates;
+        }
+
+        uint64_t getTimeouts() const
+        {
+            return m_timeouts;
+        }
+
+        uint64_t getRestarts() const
+        {
+            return m_restarts;
+        }
+
+        double getLossRatio() const
+        {
+            return (m_received + m_missing) ? (double)m_missing / (m_received + m_missing) : 0.0;
+        }
+
+        void dump() const
+        {
+            const double seconds = TscClock::toNs(m_lastCapture - m_firstCapture) * 1e-9;
+
+            printf("received messages    : %12lu", (unsigned long)m_received);
+            if (seconds > 0.0) {
+                printf(" %12.0f / s over %.3f s", m_received / seconds, seconds);
+            }
+            printf("\n");
+            printf("lost messages        : %12lu %11.3f %% in %lu gaps\n", (unsigned long)m_missing, getLossRatio() * 100.0,
+                   (unsigned long)m_gaps);
+            printf("reordered messages   : %12lu\n", (unsigned long)m_reordered);
+            printf("duplicate messages   : %12lu\n", (unsigned long)m_duplicates);
+            if (m_stale) {
+                printf("late beyond window   : %12lu\n", (unsigned long)m_stale);
+            }
+            if (m_restarts) {
+                printf("sender restarts      : %12lu\n", (unsigned long)m_restarts);
+            }
+            printf("receive timeouts     : %12lu\n", (unsigned long)m_timeouts);
+        }
+
+    private:
+        inline void start(uint32_t seq)
+        {
+            std::fill(m_seen.begin(), m_seen.end(), 0);
+            m_highest = seq;
+        }
+
+        inline bool seen(uint32_t seq) const
+        {
+            const uint32_t bit = seq % m_window;
+
+            return m_seen[bit / 64] & (1ull << (bit % 64));
+        }
+
+        inline void mark(uint32_t seq)
+        {
+            const uint32_t bit = seq % m_window;
+
+            m_seen[bit / 64] |= (1ull << (bit % 64));
+        }
+
+        /* the window slides up to seq, slots which now stand for new sequences are cleared */
+        inline void forget(uint32_t seq)
+        {
+            if ((seq - m_highest) >= m_window) {
+                std::fill(m_seen.begin(), m_seen.end(), 0);
+                return;
+            }
+
+            for (uint32_t next = m_highest + 1; next != seq + 1; next++) {
+                const uint32_t bit = next % m_window;
+                m_seen[bit / 64] &= ~(1ull << (bit % 64));
+            }
+        }
+
+    private:
+        uint32_t m_window;
+        std::vector<uint64_t> m_seen;
+        uint32_t m_highest = 0;
+        uint64_t m_received = 0;
+        uint64_t m_missing = 0;
+        uint64_t m_gaps = 0;
+        uint64_t m_reordered = 0;
+        uint64_t m_duplicates = 0;
+        uint64_t m_stale = 0;
+        uint64_t m_restarts = 0;
+        uint64_t m_timeouts = 0;
+        int64_t m_firstCapture = 0;
+        int64_t m_lastCapture = 0;
+};
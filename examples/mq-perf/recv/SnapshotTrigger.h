@@ -0,0 +1,155 @@
+#pragma once
+
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <string>
+#include <thread>
+#include <atomic>
+#include <unistd.h>
+#include <sys/eventfd.h>
+#ifdef HAVE_LTTNG_CTL
+#include <lttng/lttng.h>
+#endif
+
+#define SNAPSHOT_SESSION        "mq-latency"    /* session name used by mq-perf-lttng-start.sh snapshot */
+#define SNAPSHOT_MIN_INTERVAL   1000            /* at most one snapshot per second by default */
+
+/**
+ * Records an LTTng snapshot of the in-memory ring buffers when a sample
+ * exceeds the threshold. The recv thread only checks the rate limit and
+ * kicks an eventfd, the blocking liblttng-ctl call runs on its own thread.
+ */
+class SnapshotTrigger
+{
+    public:
+        SnapshotTrigger()
+        {
+        }
+
+        virtual ~SnapshotTrigger()
+        {
+            stop();
+        }
+
+        bool configure(int thresholdUs, int minIntervalMs = SNAPSHOT_MIN_INTERVAL, const char* session = SNAPSHOT_SESSION)
+        {
+#ifndef HAVE_LTTNG_CTL
+            (void)thresholdUs;
+            (void)minIntervalMs;
+            (void)session;
+            fprintf(stderr, "SnapshotTrigger: built without liblttng-ctl, snapshots disabled\n");
+            return false;
+#else
+            m_session = session;
+            m_minIntervalNs = (int64_t)minIntervalMs * 1000000;
+
+            if ((m_eventFd = eventfd(0, EFD_CLOEXEC)) == -1) {
+                perror("SnapshotTrigger: eventfd() failed");
+                return false;
+            }
+
+            m_running = true;
+            m_thread = std::thread(&SnapshotTrigger::run, this);
+            m_thresholdNs = (int64_t)thresholdUs * 1000;
+
+            return true;
+#endif
+        }
+
+        bool enabled() const
+        {
+            return m_thresholdNs > 0;
+        }
+
+        /**
+         * to be called from the recv thread, costs a compare unless a snapshot is due
+         */
+        inline void check(int64_t latencyNs, int64_t nowNs)
+        {
+            if (latencyNs <= m_thresholdNs) {
+                return;
+            }
+
+            if ((nowNs - m_lastTriggerNs) < m_minIntervalNs) {
+                m_suppressed++;
+                return;
+            }
+
+            const uint64_t value = 1;
+
+            m_lastTriggerNs = nowNs;
+            m_triggered++;
+            if (write(m_eventFd, &value, sizeof(value)) != sizeof(value)) {
+                m_failed++;
+            }
+        }
+
+        void stop()
+        {
+            if (m_running) {
+                const uint64_t value = 1;
+
+                m_running = false;
+                if (write(m_eventFd, &value, sizeof(value)) != sizeof(value)) {
+                    perror("SnapshotTrigger: write() failed");
+                }
+            }
+
+            if (m_thread.joinable()) {
+                m_thread.join();
+            }
+
+            if (m_eventFd != -1) {
+                close(m_eventFd);
+                m_eventFd = -1;
+            }
+
+            m_thresholdNs = 0;
+        }
+
+        void dump()
+        {
+            printf("Snapshots of session %s : %lu triggered, %lu recorded, %lu failed, %lu rate limited\n",
+                   m_session.c_str(), (unsigned long)m_triggered, (unsigned long)m_recorded.load(),
+                   (unsigned long)m_failed.load(), (unsigned long)m_suppressed);
+        }
+
+    private:
+        void run()
+        {
+            uint64_t value;
+
+            pthread_setname_np(pthread_self(), "lttng_snapshot");
+
+            while (read(m_eventFd, &value, sizeof(value)) == sizeof(value)) {
+                if (!m_running) {
+                    break;
+                }
+#ifdef HAVE_LTTNG_CTL
+                /* output NULL: use the snapshot output configured for the session */
+                int ret = lttng_snapshot_record(m_session.c_str(), NULL, 0);
+                if (ret < 0) {
+                    fprintf(stderr, "SnapshotTrigger: lttng_snapshot_record() failed: %s\n", lttng_strerror(ret));
+                    m_failed++;
+                }
+                else {
+                    m_recorded++;
+                }
+#endif
+            }
+        }
+
+    private:
+        std::string m_session = SNAPSHOT_SESSION;
+        int64_t m_thresholdNs = 0;
+        int64_t m_minIntervalNs = 0;
+        int64_t m_lastTriggerNs = 0;
+        uint64_t m_triggered = 0;
+        uint64_t m_suppressed = 0;
+        std::atomic<uint64_t> m_recorded{0};
+        std::atomic<uint64_t> m_failed{0};
+        std::atomic<bool> m_running{false};
+        int m_eventFd = -1;
+        std::thread m_thread;
+};
@@ -4,29 +4,43 @@
 #include <vector>
 #include <map>
 #include <algorithm>
+#include <execution>
 #include <numeric>
 #include <cstdint>
 #include <cmath>
 #include <iostream>
 #include <iomanip>
+#include <sstream>
+#include <utility>
+#include <limits>
+#include <cstdio>
+#include <cstring>
+#include <sys/mman.h>
+#include "TscClock.h"
 
 #define MAX_TIMESTAMPS  1000000 /* we may capture that much TimeItems */
+#define HUGE_PAGE_SIZE  (2ul * 1024 * 1024)
+#define HISTOGRAM_DENSE_MAX  (1 << 20) /* up to 1s spread use a flat array while binning */
 
 using Clock = std::chrono::high_resolution_clock;
 using TimePoint = std::chrono::time_point<Clock>;
 
+/**
+ * a received message: send stamp from the message, capture stamp taken on construction.
+ * stamps are in TscClock units, ns unless the TSC clock is enabled.
+ */
 class TimeItem
 {
     public:
         TimeItem()
             :
-            captureTP(Clock::now())
+            capture(TscClock::now())
         {
         }
 
         TimeItem(int64_t ts)
             :
-            captureTP(Clock::now()),
+            capture(TscClock::now()),
             timestamp(ts)
         {
         }
@@ -39,7 +53,7 @@ class TimeItem
         TimeItem& operator= (const TimeItem& rhs)
         {
             if (&rhs != this) {
-                captureTP = rhs.captureTP;
+                capture = rhs.capture;
                 timestamp = rhs.timestamp;
             }
 
@@ -58,7 +72,7 @@ class TimeItem
             if (this != &other)
             {
                 // use std::exchange
-                captureTP = std::exchange(other.captureTP, { });
+                capture = std::exchange(other.capture, { 0 });
                 timestamp = std::exchange(other.timestamp, { 0 });
             }
 
@@ -67,13 +81,26 @@ class TimeItem
 
         int getElapsed()
         {
-            TimePoint sent(std::chrono::nanoseconds(this->timestamp));
-            std::chrono::duration<double, std::micro> elapsed = this->captureTP - sent;
-            return nearbyint(elapsed.count());
+            return nearbyint(getElapsedNs() * 1e-3);
+        }
+
+        int64_t getElapsedNs()
+        {
+            return TscClock::toNs(this->capture - this->timestamp);
+        }
+
+        int64_t getCaptureNs() const
+        {
+            return TscClock::toRealtimeNs(this->capture);
+        }
+
+        static int64_t nowNs()
+        {
+            return std::chrono::duration_cast<std::chrono::nanoseconds>(Clock::now().time_since_epoch()).count();
         }
 
     public:
-        TimePoint captureTP;
+        int64_t capture = 0;
         int64_t timestamp = 0;
 };
 
@@ -83,10 +110,18 @@ class TimeItem
 using TimeItemVector = std::vector<TimeItem>;
 using TimeItemVectorIt = TimeItemVector::iterator;
 using TimeItemVectorConstIt = TimeItemVector::const_iterator;
-using HistogramMap = std::multimap<uint32_t /* us */, double>;
+using HistogramMap = std::map<int64_t /* us */, uint64_t /* count */>;
+using PercentileVector = std::vector<std::pair<double /* percentile */, double /* us */>>;
+
+/* first entry must be the median, ranks must be ascending */
+static constexpr double PERCENTILES[] = { 50.0, 90.0, 99.0, 99.9, 99.99 };
 
 /**
  * Normal time profiling as class
+ *
+ * samples are kept as struct of arrays (send, receive stamp) inside one
+ * anonymous mapping which is prefaulted and locked when the profiling is
+ * started, so recording a sample never takes a page fault.
  */
 class TimeProfiling
 {
@@ -95,47 +130,57 @@ class TimeProfiling
             : m_maxSize{maxSize}
         {
             /* min and max */
-            m_startTimePoint = TimePoint::min();
-            m_endTimePoint = TimePoint::max();
-            m_timeItems = new TimeItem[m_maxSize];
+            m_startNs = std::numeric_limits<int64_t>::min();
+            m_endNs = std::numeric_limits<int64_t>::max();
         }
 
         virtual ~TimeProfiling()
         {
+            release();
         }
 
-        void configure(int startDelaySec, int durationSec)
+        void configure(int startDelaySec, int durationSec, bool hugePages = false)
         {
             m_startDelaySec = startDelaySec;
             m_durationSec = durationSec;
+            m_hugePages = hugePages;
         }
 
-        void start()
+        /* origin defaults to now, offline analysis passes the origin the receiver stored in the record file */
+        void start(int64_t origin = TscClock::now())
         {
-            m_startTimePoint = TimePoint(Clock::now() + std::chrono::seconds(m_startDelaySec));
-            m_endTimePoint = (m_durationSec > 0) ? TimePoint(m_startTimePoint + std::chrono::seconds(m_durationSec)) : TimePoint::max();
+            allocate();
+
+            m_originNs = origin;
+            m_startNs = origin + TscClock::fromNs((int64_t)m_startDelaySec * 1000000000);
+            m_endNs = (m_durationSec > 0) ? m_startNs + TscClock::fromNs((int64_t)m_durationSec * 1000000000) : std::numeric_limits<int64_t>::max();
         }
 
-        inline void add(TimeItem&& item)
+        inline void add(int64_t sentNs, int64_t recvNs)
         {
-            if ((item.captureTP > m_startTimePoint) && (item.captureTP < m_endTimePoint)) {
-                if (m_index < m_maxSize) {
-                    m_timeItems[m_index] = item;
+            if ((recvNs > m_startNs) && (recvNs < m_endNs)) {
+                if (m_index < m_capacity) {
+                    m_sentNs[m_index] = sentNs;
+                    m_recvNs[m_index] = recvNs;
                     m_index++;
                 }
             }
         }
 
+        /* kept as stamps, converted to ns in process() */
+        inline void add(TimeItem&& item)
+        {
+            add(item.timestamp, item.capture);
+        }
+
         inline int addLatency(TimeItem&& item)
         {
             int ret = 0;
+            const int64_t recvNs = item.capture;
 
-            if ((item.captureTP > m_startTimePoint) && (item.captureTP < m_endTimePoint)) {
+            if ((recvNs > m_startNs) && (recvNs < m_endNs)) {
                 ret = item.getElapsed();
-                if (m_index < m_maxSize) {
-                    m_timeItems[m_index] = item;
-                    m_index++;
-                }
+                add(item.timestamp, recvNs);
             }
 
             return ret;
@@ -145,6 +190,7 @@ class TimeProfiling
         {
             std::vector<double> latencyVec;
             m_histogramMap.clear();
+            m_percentiles.clear();
 
             const size_t eleInVec = m_index;
             size_t start = (eleInVec - 1) > safety ? safety : 0;
@@ -152,45 +198,53 @@ class TimeProfiling
 
             std::cout << "safety : " << safety << " start : " << start << " stop : " << stop << " total elements : " << eleInVec << std::endl;
 
-            if (eleInVec < 2) {
+            if ((eleInVec < 2) || (stop <= start)) {
                 return;
             }
 
-            // creates a histogram
-            for (size_t cnt = start; cnt < stop; cnt++) {
-                TimePoint sent(std::chrono::nanoseconds(m_timeItems[cnt].timestamp));
-                std::chrono::duration<double, std::micro> elapsed = m_timeItems[cnt].captureTP - sent;
-                m_histogramMap.emplace(std::make_pair(nearbyint(elapsed.count()), elapsed.count()));
-                latencyVec.push_back(elapsed.count());
-                m_minLatency = m_minLatency > elapsed.count() ? elapsed.count() : m_minLatency;
-                m_maxLatency = m_maxLatency < elapsed.count() ? elapsed.count() : m_maxLatency;
-            }
-
-            // average calc
-            const size_t sz = latencyVec.size();
-            const double mean = std::accumulate(latencyVec.begin(), latencyVec.end(), 0.0) / sz;
-            m_avgLatency = mean;
-
-            // Now calculate the variance & deviation
-            m_varianceLatency = std::accumulate(latencyVec.begin(), latencyVec.end(), 0.0,
-                                                [&mean, &sz](double accumulator, const double& val)
-                                                {
-                                                    return accumulator + ((val - mean)*(val - mean) / (sz - 1));
-                                                });
+            // latency in us, element wise over both arrays so it vectorizes
+            const size_t count = stop - start;
+            const double usPerUnit = TscClock::nsPerUnit() * 1e-3;
+            latencyVec.resize(count);
+            std::transform(std::execution::par_unseq, &m_recvNs[start], &m_recvNs[stop], &m_sentNs[start], latencyVec.begin(),
+                           [usPerUnit](const int64_t recvNs, const int64_t sentNs)
+                           {
+                               return (double)(recvNs - sentNs) * usPerUnit;
+                           });
+
+            // min, max, mean and variance in one fused pass, sums are shifted by the first sample to keep precision
+            const double shift = latencyVec.front();
+            const Moments moments = std::transform_reduce(std::execution::par_unseq, latencyVec.cbegin(), latencyVec.cend(),
+                                                          Moments(), Moments::merge,
+                                                          [shift](const double val)
+                                                          {
+                                                              return Moments{ val - shift, (val - shift) * (val - shift), val, val };
+                                                          });
+            m_minLatency = moments.min;
+            m_maxLatency = moments.max;
+            m_avgLatency = shift + moments.sum / count;
+            m_varianceLatency = (moments.sumSq - moments.sum * moments.sum / count) / (count - 1);
             m_deviationLatency = sqrt(m_varianceLatency);
 
-            // median
-            std::sort(latencyVec.begin(), latencyVec.end(), std::less<double>());
-            auto it = latencyVec.cbegin();
-            std::advance(it, latencyVec.size() / 2);
+            buildHistogram(latencyVec);
+
+            // median and percentiles by selection, each nth_element only works on the part above the previous rank
+            auto lower = latencyVec.begin();
+            for (const double percentile : PERCENTILES) {
+                auto nth = latencyVec.begin() + std::min(count - 1, (size_t)(percentile / 100.0 * count));
+                std::nth_element(std::execution::par_unseq, lower, nth, latencyVec.end());
+                m_percentiles.emplace_back(percentile, *nth);
+                lower = nth;
+            }
 
-            // Middle or average of two middle values
-            if (latencyVec.size() % 2 == 0) {
-                const auto it2 = it--;
-                m_medLatency = double((*it) + (*it2)) / 2;    // data[n/2 - 1] AND data[n/2]
+            // median: middle or average of two middle values, data[n/2 - 1] is the largest below data[n/2]
+            const double upperMid = m_percentiles.front().second;
+            if (count % 2 == 0) {
+                const double lowerMid = *std::max_element(std::execution::par_unseq, latencyVec.begin(), latencyVec.begin() + count / 2);
+                m_medLatency = (lowerMid + upperMid) / 2;
             }
             else {
-                m_medLatency = (*it);
+                m_medLatency = upperMid;
             }
         }
 
@@ -203,20 +257,185 @@ class TimeProfiling
             std::cout << "variance of latency  : " << std::fixed << std::setprecision(3) << std::setw(9) << m_varianceLatency << " us" << std::endl;
             std::cout << "deviation of latency : " << std::fixed << std::setprecision(3) << std::setw(9) << m_deviationLatency << " us" << std::endl;
 
+            for (const auto& percentile : m_percentiles) {
+                if (percentile.first == 50.0) {
+                    continue; // already shown as median
+                }
+                std::ostringstream label;
+                label << "p" << std::defaultfloat << std::setprecision(6) << percentile.first << " of latency";
+                std::cout << std::left << std::setw(21) << label.str() << std::right << ": "
+                          << std::fixed << std::setprecision(3) << std::setw(9) << percentile.second << " us" << std::endl;
+            }
+
             std::cout << "Histogram" << std::endl;
-            for (auto it = m_histogramMap.begin(), end = m_histogramMap.end(); it != end; it = m_histogramMap.upper_bound(it->first)) {
-                std::cout << it->first << " : " << m_histogramMap.count(it->first) << std::endl;
+            for (const auto& bucket : m_histogramMap) {
+                std::cout << bucket.first << " : " << bucket.second << std::endl;
+            }
+        }
+
+        const HistogramMap& getHistogram() const
+        {
+            return m_histogramMap;
+        }
+
+        double getMedian() const
+        {
+            return m_medLatency;
+        }
+
+        double getAverage() const
+        {
+            return m_avgLatency;
+        }
+
+        double getMinimum() const
+        {
+            return m_minLatency;
+        }
+
+        double getMaximum() const
+        {
+            return m_maxLatency;
+        }
+
+        double getDeviation() const
+        {
+            return m_deviationLatency;
+        }
+
+        const PercentileVector& getPercentiles() const
+        {
+            return m_percentiles;
+        }
+
+        /* start of the --start/--duration window, in stamps */
+        int64_t getOrigin() const
+        {
+            return m_originNs;
+        }
+
+        int getStartDelay() const
+        {
+            return m_startDelaySec;
+        }
+
+        int getDuration() const
+        {
+            return m_durationSec;
+        }
+
+    private:
+        /**
+         * partial sums of one pass, merged pairwise so the reduction may run in parallel
+         */
+        struct Moments
+        {
+            double sum = 0.0;
+            double sumSq = 0.0;
+            double min = std::numeric_limits<double>::max();
+            double max = std::numeric_limits<double>::lowest();
+
+            static Moments merge(const Moments& a, const Moments& b)
+            {
+                return Moments{ a.sum + b.sum, a.sumSq + b.sumSq, std::min(a.min, b.min), std::max(a.max, b.max) };
+            }
+        };
+
+        void buildHistogram(const std::vector<double>& latencyVec)
+        {
+            const int64_t lo = (int64_t)nearbyint(m_minLatency);
+            const int64_t hi = (int64_t)nearbyint(m_maxLatency);
+
+            if ((hi - lo) < HISTOGRAM_DENSE_MAX) {
+                // 1 us buckets, count in a flat array and keep only the used ones
+                std::vector<uint64_t> dense(hi - lo + 1, 0);
+                for (const double latency : latencyVec) {
+                    dense[(int64_t)nearbyint(latency) - lo]++;
+                }
+                for (size_t bucket = 0; bucket < dense.size(); bucket++) {
+                    if (dense[bucket] > 0) {
+                        m_histogramMap.emplace_hint(m_histogramMap.end(), lo + (int64_t)bucket, dense[bucket]);
+                    }
+                }
+            }
+            else {
+                for (const double latency : latencyVec) {
+                    m_histogramMap[(int64_t)nearbyint(latency)]++;
+                }
+            }
+        }
+
+    private:
+        void allocate()
+        {
+            if (m_arena != nullptr) {
+                return;
+            }
+
+            m_arenaSize = 2 * sizeof(int64_t) * (size_t)m_maxSize;
+
+            if (m_hugePages) {
+                /* round up to a multiple of the 2MB huge page size */
+                m_arenaSize = (m_arenaSize + HUGE_PAGE_SIZE - 1) & ~(HUGE_PAGE_SIZE - 1);
+                m_arena = mmap(nullptr, m_arenaSize, PROT_READ | PROT_WRITE,
+                               MAP_PRIVATE | MAP_ANONYMOUS | MAP_POPULATE | MAP_HUGETLB, -1, 0);
+                if (m_arena == MAP_FAILED) {
+                    perror("TimeProfiling: mmap(MAP_HUGETLB) failed, using normal pages");
+                }
+            }
+
+            if ((m_arena == nullptr) || (m_arena == MAP_FAILED)) {
+                m_arena = mmap(nullptr, m_arenaSize, PROT_READ | PROT_WRITE,
+                               MAP_PRIVATE | MAP_ANONYMOUS | MAP_POPULATE, -1, 0);
+                if (m_arena == MAP_FAILED) {
+                    perror("TimeProfiling: mmap() failed");
+                    m_arena = nullptr;
+                    return;
+                }
+
+                if (m_hugePages) {
+                    madvise(m_arena, m_arenaSize, MADV_HUGEPAGE);
+                }
+            }
+
+            if (mlock(m_arena, m_arenaSize) == -1) {
+                perror("TimeProfiling: mlock() failed");
+            }
+
+            /* touch every page, MAP_POPULATE is only a hint */
+            memset(m_arena, 0, m_arenaSize);
+
+            m_sentNs = static_cast<int64_t*>(m_arena);
+            m_recvNs = m_sentNs + m_maxSize;
+            m_capacity = m_maxSize;
+        }
+
+        void release()
+        {
+            if (m_arena != nullptr) {
+                munmap(m_arena, m_arenaSize);
+                m_arena = nullptr;
+                m_sentNs = m_recvNs = nullptr;
+                m_capacity = 0;
+                m_index = 0;
             }
         }
 
     private:
-        int m_index = 0;
-        TimeItem * m_timeItems; /* remark: must be pre-allocated to avoid outliers due to memory allocation */
+        uint32_t m_index = 0;
+        uint32_t m_capacity = 0;
+        void* m_arena = nullptr;     /* remark: must be pre-allocated to avoid outliers due to memory allocation */
+        size_t m_arenaSize = 0;
+        int64_t* m_sentNs = nullptr;
+        int64_t* m_recvNs = nullptr;
+        bool m_hugePages = false;
         int m_startDelaySec = 0;
         int m_durationSec = 0;
-        TimePoint m_startTimePoint;
-        TimePoint m_endTimePoint;
+        int64_t m_originNs = 0;
+        int64_t m_startNs;
+        int64_t m_endNs;
         HistogramMap m_histogramMap;
+        PercentileVector m_percentiles;
         double m_avgLatency = 0.0;
         double m_medLatency = 0.0;
         double m_varianceLatency = 0.0;
@@ -0,0 +1,171 @@
+#pragma once
+
+#include <chrono>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <ctime>
+#include <string>
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <cpuid.h>
+#include <x86intrin.h>
+#define HAVE_TSC 1
+#endif
+
+#define TSC_CALIBRATION_MS      100     /* between the two calibration points */
+#define TSC_CALIBRATION_TRIES   16      /* keep the tightest tsc/clock pair    */
+#define TSC_CLOCKSOURCE         "/sys/devices/system/clocksource/clocksource0/current_clocksource"
+
+/**
+ * time stamps of the hot path
+ *
+ * by default stamps are CLOCK_REALTIME ns like std::chrono::high_resolution_clock.
+ * after enable() they are raw TSC ticks, one rdtscp instead of a vDSO call, and are
+ * converted to ns only when needed: deltas with the calibrated tick length, absolute
+ * values relative to the CLOCK_REALTIME at calibration. both sides must stamp with the
+ * same clock, the TSC is shared by all processes on a host with an invariant TSC.
+ */
+class TscClock
+{
+    public:
+        /* false and the reason if the TSC is not usable, stamps stay in ns */
+        static bool enable(std::string& reason)
+        {
+#ifdef HAVE_TSC
+            unsigned int eax, ebx, ecx, edx;
+
+            if (!__get_cpuid(0x80000007, &eax, &ebx, &ecx, &edx) || !(edx & (1u << 8))) {
+                reason = "no invariant TSC";
+                return false;
+            }
+
+            if (__get_cpuid(0x80000001, &eax, &ebx, &ecx, &edx) && (edx & (1u << 27))) {
+                s_rdtscp = true;
+            }
+
+            /* the kernel drops the TSC as clocksource when it found it unstable */
+            reason.clear();
+            FILE* file = fopen(TSC_CLOCKSOURCE, "r");
+            if (file) {
+                char line[64] = { 0 };
+                if (fgets(line, sizeof(line), file) && (strncmp(line, "tsc", 3) != 0)) {
+                    line[strcspn(line, "\n")] = '\0';
+                    reason = std::string("clocksource is ") + line + ", TSC may be unstable";
+                }
+                fclose(file);
+            }
+
+            calibrate();
+            s_enabled = true;
+
+            return true;
+#else
+            reason = "no TSC on this architecture";
+            return false;
+#endif
+        }
+
+        static bool enabled()
+        {
+            return s_enabled;
+        }
+
+        static inline int64_t now()
+        {
+#ifdef HAVE_TSC
+            if (s_enabled) {
+                return ticks();
+            }
+#endif
+            return std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::high_resolution_clock::now().time_since_epoch()).count();
+        }
+
+        /* length of a stamp difference */
+        static inline int64_t toNs(int64_t delta)
+        {
+            return s_enabled ? (int64_t)(delta * s_nsPerTick) : delta;
+        }
+
+        static inline int64_t fromNs(int64_t ns)
+        {
+            return s_enabled ? (int64_t)(ns / s_nsPerTick) : ns;
+        }
+
+        /* CLOCK_REALTIME ns of a stamp */
+        static inline int64_t toRealtimeNs(int64_t stamp)
+        {
+            return s_enabled ? s_baseRealtimeNs + toNs(stamp - s_baseTicks) : stamp;
+        }
+
+        /* 1.0 without TSC */
+        static double nsPerUnit()
+        {
+            return s_enabled ? s_nsPerTick : 1.0;
+        }
+
+        static void dump()
+        {
+            if (s_enabled) {
+                printf("TSC clock            : %9.3f MHz (%s)\n", 1e3 / s_nsPerTick, s_rdtscp ? "rdtscp" : "lfence, rdtsc");
+            }
+        }
+
+    private:
+#ifdef HAVE_TSC
+        static inline int64_t ticks()
+        {
+            if (s_rdtscp) {
+                unsigned int aux;
+                return (int64_t)__rdtscp(&aux);
+            }
+
+            _mm_lfence();
+            return (int64_t)__rdtsc();
+        }
+
+        /* tsc in the middle of the fastest clock_gettime of several tries */
+        static void sample(int64_t& tsc, int64_t& monotonicNs, int64_t& realtimeNs)
+        {
+            int64_t best = INT64_MAX;
+
+            for (int cnt = 0; cnt < TSC_CALIBRATION_TRIES; cnt++) {
+                struct timespec mono, real;
+
+                const int64_t before = ticks();
+                clock_gettime(CLOCK_MONOTONIC, &mono);
+                clock_gettime(CLOCK_REALTIME, &real);
+                const int64_t after = ticks();
+
+                if ((after - before) < best) {
+                    best = after - before;
+                    tsc = before + (after - before) / 2;
+                    monotonicNs = mono.tv_sec * 1000000000LL + mono.tv_nsec;
+                    realtimeNs = real.tv_sec * 1000000000LL + real.tv_nsec;
+                }
+            }
+        }
+
+        static void calibrate()
+        {
+            int64_t startTsc = 0, startMono = 0, startReal = 0;
+            int64_t endTsc = 0, endMono = 0, endReal = 0;
+            struct timespec delay = { .tv_sec = 0, .tv_nsec = TSC_CALIBRATION_MS * 1000000L };
+
+            sample(startTsc, startMono, startReal);
+            nanosleep(&delay, nullptr);
+            sample(endTsc, endMono, endReal);
+
+            s_nsPerTick = (double)(endMono - startMono) / (double)(endTsc - startTsc);
+            s_baseTicks = endTsc;
+            s_baseRealtimeNs = endReal;
+        }
+#endif
+
+    private:
+        static inline bool s_enabled = false;
+        static inline bool s_rdtscp = false;
+        static inline double s_nsPerTick = 1.0;
+        static inline int64_t s_baseTicks = 0;
+        static inline int64_t s_baseRealtimeNs = 0;
+};
@@ -4,6 +4,12 @@
 
 /* local includes */
 #include "shmemq.h"
+#include "affinity.h"
+#include "perfcounters.h"
+#include "shmstats.h"
+#include "samplefile.h"
+#include "mq-perf-tp.h"
+#include "mq-perf-usdt.h"
 
 /* global includes */
 #include <cstdint>
@@ -21,12 +27,19 @@
 #include <mqueue.h>
 #include <sys/types.h>
 #include <sys/socket.h>
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#include <sys/resource.h>
 #include <sys/un.h>
 #include <netinet/in.h>
 #include <arpa/inet.h>
 #include <sched.h>
-#include <functional>
 #include "TimeProfiling.h"
+#include "OutlierCapture.h"
+#include "SnapshotTrigger.h"
+#include "ClockCheck.h"
+#include "SequenceTracking.h"
+#include "EndpointStatistics.h"
 
 #define SHMEM_NAME              "gugus"
 #define SHMEM_MAX_MESSAGES      100
@@ -39,25 +52,79 @@
 #define MSG_BUFFER_SIZE         MAX_MSG_SIZE + 10
 #define MSG_SEND_SIZE           256                 /* we seend 256 bytes */
 #define MSG_HDR_SIZE            (sizeof(int64_t) + sizeof(uint32_t))
+#define CLOCK_SYSTEM            "system"
+#define CLOCK_TSC               "tsc"
+#define CLOCK_PLAUSIBLE_NS      (60 * 1000000000LL) /* first latency above means different clocks */
+#define MSG_SIZE_MAX_TEXT       "4084"              /* MAX_MSG_SIZE - MSG_HDR_SIZE */
 #define IPC_METHOD_MQ           "mq"
 #define IPC_METHOD_UDS          "uds"
 #define IPC_METHOD_SHMEM        "shmem"
+#define IPC_METHOD_NULL         "null"
+#define IPC_METHOD_EPOLL        "epoll"             /* --endpoints message queues and as many sockets */
+#define EPOLL_MAX_EVENTS        64
+#define EPOLL_BATCH             16                  /* messages taken from a ready endpoint before the next one */
+#define EPOLL_SHUTDOWN          UINT32_MAX          /* epoll data of the eventfd */
 #define IPC_ENC_PROTOBUF        "protobuf"
 #define IPC_ENC_RAW             "raw"
+#define IPC_ENC_STAGES          "stages"            /* raw + post send stamp of the previous message */
+#define STAGES_EXT_SIZE         sizeof(int64_t)
 #define PROGRAM 		        "mq-perf-recv"
-#define PROGRAMVERSION 		    "0.0.6"
+#define PROGRAMVERSION 		    "0.0.7"
 
 static int running = 1;
 static TimeProfiling timeProfiling;
+static OutlierCapture outlierCapture;
+static SnapshotTrigger snapshotTrigger;
+static SequenceTracking sequenceTracking;
 static int optThreadPrio = 50;      /* fifo with prio 50            */
 static char* optIPCMethod = nullptr;
-static unsigned int optAffinityMask = 0;
+static affinity_t* recvCpus = affinity_new();     /* started affinity if empty */
+static affinity_t* reportCpus = affinity_new();
 static char* optEncapsulation = nullptr;
 static int optStartDelay = 0;
 static int optDuration = 0;
 static int optBurstCount = 0;       /* no burst                     */
-static std::function<void(char**, ssize_t*)> aquireFunc;
-static std::function<void(char**, ssize_t*)> releaseFunc;
+static int optMsgSize = MSG_SEND_SIZE; /* payload after the header */
+static int optStats = 0;            /* no shared memory stats       */
+static int optHugePages = 0;        /* sample store on normal pages */
+static char* optClock = nullptr;    /* system clock                 */
+static bool clockChecked = false;
+static affinity_t* senderCpus = nullptr;    /* no cross CPU clock check */
+static int optClockTolerance = CLOCK_TOLERANCE_NS;
+static int optClockStrict = 0;      /* warn only                    */
+static ClockCheck clockCheck;
+
+/* per stage latencies of the stages encapsulation */
+enum Stage { STAGE_SEND, STAGE_RECEIVE, STAGE_COPY, STAGE_MAX };
+static const char* stageNames[STAGE_MAX] = { "send (t0 -> t1, send call)",
+                                             "receive (t0 -> t2, send started until the receiver has the message)",
+                                             "copy (t2 -> t3, copy out of the shmem queue, mq and uds copy within t2)" };
+static TimeProfiling stageProfiling[STAGE_MAX];
+static shmstats_t* shmStats = nullptr;
+static char* optRecordFile = nullptr;
+static samplefile_t* sampleFile = nullptr;
+static perfcounters_t* perfCounters = nullptr;
+static uint64_t receivedMessages = 0;
+static int optOutlierUs = 0;        /* no outlier capture           */
+static int optSnapshotUs = 0;       /* no lttng snapshots           */
+static int optSnapshotInterval = SNAPSHOT_MIN_INTERVAL;
+static char* optSnapshotSession = nullptr;
+static int optEndpoints = 1;
+static int optBatch = EPOLL_BATCH;
+
+/* endpoints of the fan-in receiver, named like the single ones with .<index> from the second on */
+struct Endpoint
+{
+    bool mq;
+    int fd;
+    std::string name;
+};
+static std::vector<Endpoint> endpoints;
+static std::vector<EndpointStatistics> endpointStats;
+static uint32_t currentEndpoint = 0;
+static int shutdownFd = -1;     /* wakes the fan-in receiver on quit */
+
+MQ_PERF_USDT_SEMAPHORE(receive)
 
 /**
  * display version
@@ -86,12 +153,30 @@ void display_help (void)
            "\n"
            "  --help                              Show this menu\n"
            "  --version                           Show version of this application\n"
-           "  -i, --ipc=[mq|uds|shmem]            Use MQ, Unix domain socket or shared memory as IPC\n"
-           "  -m, --mask                          CPU affinity mask\n"
+           "  -i, --ipc=[mq|uds|shmem|null|epoll] Use MQ, Unix domain socket or shared memory as IPC, null measures the receive path alone,\n"
+           "                                      epoll serves --endpoints message queues and as many sockets from one thread\n"
+           "  --endpoints=<n>                     Message queues or sockets served by one thread with epoll (default 1)\n"
+           "  --batch=<n>                         Messages taken from a ready endpoint before the next one (default 16)\n"
+           "  -e, --encapsulation=[raw|stages]    Message encoding, stages adds per stage latencies\n"
+           "  -m, --mask                          CPU affinity mask of the receive thread, hex of any length\n"
+           "  -c, --cpus                          CPU list of the receive thread, e.g. 2,4-7 or sibling:2, llc:2, remote:2\n"
+           "  --report-cpus                       CPU list of the main, record and snapshot threads\n"
+           "  -z, --size                          Payload bytes per message (default 256, max " MSG_SIZE_MAX_TEXT ")\n"
            "  -b, --burst                         Expected number of messages coming as burst (0 = single messages, no burst)\n"
            "  -p, --prio                          Thread priority (FIFO scheduling)\n"
            "  -s, --start                         Time in seconds starting capture timestamps\n"
-           "  -d, --duration                      Duration in seconds while capture timestamps\n");
+           "  -d, --duration                      Duration in seconds while capture timestamps\n"
+           "  -S, --stats                         Publish live statistics in shared memory (see mq-perf-top)\n"
+           "  -H, --hugepages                     Back the timestamp store with huge pages\n"
+           "  --clock=[system|tsc]                Stamp with the system clock or calibrated TSC ticks, same on both sides\n"
+           "  --clock-check=<cpus>                Check the clock offset between the receive thread CPUs and these sender CPUs\n"
+           "  --clock-tolerance=<ns>              Largest acceptable offset bound (default 1000 ns)\n"
+           "  --clock-strict                      Refuse to run above the tolerance instead of a warning\n"
+           "  -r, --record=<file>                 Record every sample to file (see mq-perf-analyze)\n"
+           "  -o, --outlier-us                    Capture context of samples above the given latency in micro seconds\n"
+           "  --snapshot-us                       Record an LTTng snapshot for samples above the given latency in micro seconds\n"
+           "  --snapshot-interval                 Minimum time between two snapshots in milli seconds\n"
+           "  --snapshot-session                  LTTng snapshot session name (default " SNAPSHOT_SESSION ")\n");
     exit(-1);
 }
 
@@ -104,18 +189,34 @@ void process_options(int argc, char *argv[])
 
     for (;;) {
         int option_index = 0;
-        static const char *short_options = "m:i:p:s:d:b:";
+        static const char *short_options = "m:c:i:e:p:s:d:b:z:SHr:o:";
 
         static const struct option long_options[] = {
                 { "help",          no_argument,       0,  0  },
                 { "version",       no_argument,       0,  0  },
                 { "mask",          required_argument, 0, 'm' },
+                { "cpus",          required_argument, 0, 'c' },
+                { "report-cpus",   required_argument, 0,  0  },
                 { "burst",         required_argument, 0, 'b' },
+                { "size",          required_argument, 0, 'z' },
                 { "ipc",           required_argument, 0, 'i' },
                 { "prio",          required_argument, 0, 'p' },
                 { "encapsulation", required_argument, 0, 'e' },
                 { "start",         required_argument, 0, 's' },
                 { "duration",      required_argument, 0, 'd' },
+                { "stats",         no_argument,       0, 'S' },
+                { "hugepages",     no_argument,       0, 'H' },
+                { "clock",         required_argument, 0,  0  },
+                { "clock-check",   required_argument, 0,  0  },
+                { "clock-tolerance", required_argument, 0, 0 },
+                { "clock-strict",  no_argument,       0,  0  },
+                { "record",        required_argument, 0, 'r' },
+                { "outlier-us",    required_argument, 0, 'o' },
+                { "snapshot-us",   required_argument, 0,  0  },
+                { "snapshot-interval", required_argument, 0, 0 },
+                { "snapshot-session", required_argument, 0, 0 },
+                { "endpoints",     required_argument, 0,  0  },
+                { "batch",         required_argument, 0,  0  },
                 { 0,               0,                 0,  0	 },
         };
 
@@ -135,26 +236,95 @@ void process_options(int argc, char *argv[])
                     case 1:
                         display_version();
                         break;
+                    default:
+                        if (strcmp(long_options[option_index].name, "snapshot-us") == 0) {
+                            optSnapshotUs = atoi(optarg);
+                        }
+                        else if (strcmp(long_options[option_index].name, "snapshot-interval") == 0) {
+                            optSnapshotInterval = atoi(optarg);
+                        }
+                        else if (strcmp(long_options[option_index].name, "snapshot-session") == 0) {
+                            optSnapshotSession = strdup(optarg);
+                        }
+                        else if (strcmp(long_options[option_index].name, "clock") == 0) {
+                            optClock = strdup(optarg);
+                            if ((strcmp(optClock, CLOCK_SYSTEM) != 0) && (strcmp(optClock, CLOCK_TSC) != 0)) {
+                                error = 1;
+                            }
+                        }
+                        else if (strcmp(long_options[option_index].name, "clock-check") == 0) {
+                            senderCpus = senderCpus ? senderCpus : affinity_new();
+                            if (!affinity_parse_list(senderCpus, optarg)) {
+                                fprintf(stderr, "invalid CPU list %s: %s\n", optarg, strerror(errno));
+                                error = 1;
+                            }
+                        }
+                        else if (strcmp(long_options[option_index].name, "clock-tolerance") == 0) {
+                            optClockTolerance = atoi(optarg);
+                        }
+                        else if (strcmp(long_options[option_index].name, "clock-strict") == 0) {
+                            optClockStrict = 1;
+                        }
+                        else if (strcmp(long_options[option_index].name, "report-cpus") == 0) {
+                            if (!affinity_parse_list(reportCpus, optarg)) {
+                                fprintf(stderr, "invalid CPU list %s: %s\n", optarg, strerror(errno));
+                                error = 1;
+                            }
+                        }
+                        else if (strcmp(long_options[option_index].name, "endpoints") == 0) {
+                            optEndpoints = atoi(optarg);
+                        }
+                        else if (strcmp(long_options[option_index].name, "batch") == 0) {
+                            optBatch = atoi(optarg);
+                        }
+                        break;
                 }
                 break;
             case 'm':
-                optAffinityMask = strtoul(optarg, 0, 16);
+                if (!affinity_parse_mask(recvCpus, optarg)) {
+                    fprintf(stderr, "invalid CPU mask %s\n", optarg);
+                    error = 1;
+                }
+                break;
+            case 'c':
+                if (!affinity_parse_list(recvCpus, optarg)) {
+                    fprintf(stderr, "invalid CPU list %s: %s\n", optarg, strerror(errno));
+                    error = 1;
+                }
                 break;
             case 'b':
                 optBurstCount = atoi(optarg);
                 break;
+            case 'z':
+                optMsgSize = atoi(optarg);
+                break;
             case 'p':
                 optThreadPrio = atoi(optarg);
                 break;
             case 'i':
                 optIPCMethod = strdup(optarg);
                 break;
+            case 'e':
+                optEncapsulation = strdup(optarg);
+                break;
             case 's':
                 optStartDelay = atoi(optarg);
                 break;
             case 'd':
                 optDuration = atoi(optarg);
                 break;
+            case 'S':
+                optStats = 1;
+                break;
+            case 'H':
+                optHugePages = 1;
+                break;
+            case 'r':
+                optRecordFile = strdup(optarg);
+                break;
+            case 'o':
+                optOutlierUs = atoi(optarg);
+                break;
             case '?':
                 error = 1;
                 break;
@@ -165,17 +335,45 @@ void process_options(int argc, char *argv[])
         error = 1;
     }
 
+    /* the header carries timestamp and sequence, a message queue message is limited */
+    if ((optMsgSize < 0) || (optMsgSize > (int)(MAX_MSG_SIZE - MSG_HDR_SIZE))) {
+        error = 1;
+    }
+
+    if (optEncapsulation && (strcmp(optEncapsulation, IPC_ENC_STAGES) == 0) && (optMsgSize < (int)STAGES_EXT_SIZE)) {
+        error = 1;
+    }
+
+    /* fan-in over mq and uds only, stages pair consecutive messages of one endpoint */
+    if ((optEndpoints < 1) || (optBatch < 1)) {
+        error = 1;
+    }
+    if ((optEndpoints > 1) && optIPCMethod && (strcmp(optIPCMethod, IPC_METHOD_MQ) != 0) &&
+        (strcmp(optIPCMethod, IPC_METHOD_UDS) != 0) && (strcmp(optIPCMethod, IPC_METHOD_EPOLL) != 0)) {
+        error = 1;
+    }
+    if (((optEndpoints > 1) || (optIPCMethod && (strcmp(optIPCMethod, IPC_METHOD_EPOLL) == 0))) &&
+        optEncapsulation && (strcmp(optEncapsulation, IPC_ENC_STAGES) == 0)) {
+        error = 1;
+    }
+
     if (error) {
         display_help();
     }
 }
 
+static bool fan_in(void)
+{
+    return (optEndpoints > 1) || (strcmp(optIPCMethod, IPC_METHOD_EPOLL) == 0);
+}
+
 static int get_one_character(char* c)
 {
     struct termios tmbuf,tmsave;
 
     if (tcgetattr(0,&tmbuf)) {
-        return -1;
+        // not a terminal (e.g. started by mq-perf-bench), plain blocking read
+        return (read(STDIN_FILENO, c, 1) == 1) ? 0 : -1;
     }
 
     // save current state
@@ -203,150 +401,519 @@ static int get_one_character(char* c)
     return 0;
 }
 
-static void configure_cpu_affinity()
+/**
+ * pin the calling thread if CPUs were given and report its placement once
+ */
+static void configure_cpu_affinity(const affinity_t* cpus, const char* who)
 {
-    /* get number of cores */
-    int nproc = sysconf(_SC_NPROCESSORS_ONLN);
-    cpu_set_t cpuset;
+    affinity_t* current = affinity_new();
+    char list[1024];
 
-    CPU_ZERO(&cpuset);
+    if (!affinity_is_empty(cpus) && (affinity_apply(cpus) == -1)) {
+        perror("sched_setaffinity() failed");
+    }
 
-    if (optAffinityMask > 0) {
-        for (int cnt = 0; cnt < nproc; cnt++) {
-            if ((optAffinityMask & (1 << cnt)) != 0) {
-                /* enable core */
-                CPU_SET(cnt, &cpuset);
-            }
+    if (affinity_get(current) != -1) {
+        printf("%s on CPUs %s (%ld online)\n", who, affinity_format(current, list, sizeof(list)), sysconf(_SC_NPROCESSORS_ONLN));
+    }
+    else {
+        perror("sched_getaffinity() failed");
+    }
+
+    affinity_destroy(current);
+}
+
+/**
+ * codecs: provide the receive buffer and account the received message
+ */
+struct RawCodec
+{
+    static constexpr const char* name = IPC_ENC_RAW;
+    static constexpr bool staged = false;
+
+    static inline void aquire(char** buffer, ssize_t* size)
+    {
+        if (*buffer == nullptr) {
+            *size = MSG_BUFFER_SIZE;
+            *buffer = (char*)std::malloc(*size);
         }
+    }
+
+    static inline void release(char** buffer, ssize_t* size)
+    {
+        if (*size > (ssize_t)MSG_HDR_SIZE) {
+            TimeItem item(*((int64_t*)*buffer));
+            const uint32_t seq = *(uint32_t*)&(*buffer)[sizeof(int64_t)];
+
+            if (!clockChecked) {
+                clockChecked = true;
+                if ((item.getElapsedNs() < 0) || (item.getElapsedNs() > CLOCK_PLAUSIBLE_NS)) {
+                    fprintf(stderr, "implausible latency of %ld ns, does the sender use the same --clock?\n", (long)item.getElapsedNs());
+                }
+            }
 
-        if (sched_setaffinity(0, sizeof(cpuset), &cpuset) == -1) {
-            perror("sched_setaffinity() failed");
+            tracepoint(mq_perf, message_received, seq, item.getElapsedNs());
+            if (MQ_PERF_USDT_ENABLED(receive)) {
+                MQ_PERF_USDT3(receive, seq, item.getElapsedNs(), (int)*size);
+            }
+
+            if (endpointStats.empty()) {
+                sequenceTracking.add(seq, item.capture);
+            }
+            else {
+                endpointStats[currentEndpoint].add(item.getElapsedNs(), seq, item.capture);
+            }
+
+            if (shmStats) {
+                shmstats_add(shmStats, item.getElapsedNs(), item.getCaptureNs());
+            }
+
+            if (sampleFile) {
+                struct samplefile_record record = { .sent_ns = TscClock::toRealtimeNs(item.timestamp),
+                                                    .recv_ns = item.getCaptureNs(),
+                                                    .seq = seq,
+                                                    .cpu = (uint32_t)sched_getcpu() };
+                samplefile_append(sampleFile, &record);
+            }
+
+            if (outlierCapture.enabled()) {
+                outlierCapture.add(item.getElapsedNs(), seq);
+            }
+
+            if (snapshotTrigger.enabled()) {
+                snapshotTrigger.check(item.getElapsedNs(), item.getCaptureNs());
+            }
+
+            timeProfiling.add(std::move(item));
+        }
+        else if (*size == -1) {
+            sequenceTracking.timeout();
+            if (shmStats) {
+                shmstats_timeout(shmStats);
+            }
         }
     }
+};
 
-    printf("We have %d CPUs\n", nproc);
+/**
+ * stages: the sender stamps t0 before the send call and t1 after it returns, t1 travels
+ * with the next message. the receiver stamps t2 when it has the message and t3 after the
+ * copy. the send call wakes the receiver, t1 is mostly after t2, so only stages starting
+ * at t0 or ending at t3 are histograms and t1 - t2 is reported as signed overlap.
+ * the send stage of message n is known once message n + 1 arrived.
+ */
+struct StagesCodec
+{
+    static constexpr const char* name = IPC_ENC_STAGES;
+    static constexpr bool staged = true;
+    static inline int64_t woken = 0;
+    static inline uint32_t lastSeq = 0;
+    static inline int64_t lastSent = 0;
+    static inline int64_t lastWoken = 0;
+    static inline uint64_t overlapPairs = 0;
+    static inline uint64_t overlapLater = 0;
+    static inline int64_t overlapSumNs = 0;
+
+    static inline void aquire(char** buffer, ssize_t* size)
+    {
+        RawCodec::aquire(buffer, size);
+    }
+
+    static inline void release(char** buffer, ssize_t* size)
+    {
+        const int64_t copied = TscClock::now();
+
+        if (*size >= (ssize_t)(MSG_HDR_SIZE + STAGES_EXT_SIZE)) {
+            const int64_t sent = *(int64_t*)*buffer;
+            const uint32_t seq = *(uint32_t*)&(*buffer)[sizeof(int64_t)];
+            int64_t afterSend;
+
+            memcpy(&afterSend, &(*buffer)[MSG_HDR_SIZE], sizeof(afterSend));
+
+            if ((seq == lastSeq + 1) && (afterSend != 0) && (lastSent != 0)) {
+                const int64_t overlapNs = TscClock::toNs(afterSend - lastWoken);
 
-    CPU_ZERO(&cpuset);
-    if (sched_getaffinity(0, sizeof(cpuset), &cpuset) != -1) {
-        for (int i = 0; i < nproc; i++) {
-            printf("  CPU %d is %s\n", i, CPU_ISSET(i, &cpuset) ? "enabled" : "disabled");
+                stageProfiling[STAGE_SEND].add(lastSent, afterSend);
+                overlapPairs++;
+                overlapLater += (overlapNs > 0);
+                overlapSumNs += overlapNs;
+            }
+            stageProfiling[STAGE_RECEIVE].add(sent, woken);
+            stageProfiling[STAGE_COPY].add(woken, copied);
+
+            lastSeq = seq;
+            lastSent = sent;
+            lastWoken = woken;
         }
+
+        RawCodec::release(buffer, size);
     }
-    else {
-        perror("sched_getaffinity() failed");
+
+    /* t1 - t2: how long the send call went on after the receiver had the message */
+    static void dumpOverlap()
+    {
+        printf("send returned after receive : %12lu of %lu, average t1 - t2 %.3f us\n", (unsigned long)overlapLater,
+               (unsigned long)overlapPairs, overlapPairs ? overlapSumNs * 1e-3 / overlapPairs : 0.0);
     }
-}
+};
 
-/* start of plain, no protobuf */
-static void aquire_message_0(char** buffer, ssize_t* size)
+/**
+ * transports: blocking receive of one message, -1 on timeout.
+ * receiveStaged makes the same calls and also stamps when the message is there:
+ * shmem after its condition wait, before the copy. mq and uds copy within the
+ * receive call, they stamp when it returned.
+ */
+struct MqTransport
 {
-    if (*buffer == nullptr) {
-        *size = MSG_BUFFER_SIZE;
-        *buffer = (char*)std::malloc(*size);
+    static constexpr const char* label = "mq";
+    static constexpr const char* threadName = "mq_recv";
+    mqd_t descriptor;
+
+    inline ssize_t receive(char* buffer, ssize_t size)
+    {
+        struct timespec tm;
+
+        // get the oldest message with highest priority
+        clock_gettime(CLOCK_REALTIME, &tm);
+        tm.tv_sec += 1;
+
+        return mq_timedreceive(descriptor, buffer, size, NULL, &tm);
     }
-}
 
-static void release_message_0(char** buffer, ssize_t* size)
+    inline ssize_t receiveStaged(char* buffer, ssize_t size, int64_t& woken)
+    {
+        const ssize_t len = receive(buffer, size);
+
+        woken = TscClock::now();
+
+        return len;
+    }
+};
+
+struct UdsTransport
 {
-    if (*size > (ssize_t)MSG_HDR_SIZE) {
-        timeProfiling.add(*((int64_t*)*buffer));
-        // element counter access
-        //printf("%d\n", *(uint32_t*)&(*buffer)[sizeof(int64_t)]);
+    static constexpr const char* label = "UDS";
+    static constexpr const char* threadName = "uds_recv";
+    int sockfd;
+
+    inline ssize_t receive(char* buffer, ssize_t size)
+    {
+        return recv(sockfd, buffer, size, 0);
     }
-}
-/* end of plain, no protobuf */
 
-void recv_func(mqd_t mq_descriptor)
+    inline ssize_t receiveStaged(char* buffer, ssize_t size, int64_t& woken)
+    {
+        const ssize_t len = receive(buffer, size);
+
+        woken = TscClock::now();
+
+        return len;
+    }
+};
+
+struct ShmemTransport
 {
-    char* recv_buffer = nullptr;
-    ssize_t recv_size = 0;
-    struct timespec tm;
-    ssize_t len;
+    static constexpr const char* label = "shmem";
+    static constexpr const char* threadName = "shmem_recv";
+    shmemq_t* shmemq;
 
-    std::cout << "start receive mq with prio [" << optThreadPrio << "]" << std::endl;
+    inline ssize_t receive(char* buffer, ssize_t size)
+    {
+        /* shmem needs a fixed size */
+        size = (optMsgSize + MSG_HDR_SIZE);
 
-    pthread_setname_np(pthread_self(), "mq_recv");
+        return shmemq_dequeue(shmemq, buffer, size) ? size : -1;
+    }
 
-    struct sched_param param = { .sched_priority = optThreadPrio };
-    pthread_setschedparam(pthread_self(), SCHED_FIFO, &param);
+    inline ssize_t receiveStaged(char* buffer, ssize_t size, int64_t& woken)
+    {
+        size = (optMsgSize + MSG_HDR_SIZE);
 
-    configure_cpu_affinity();
+        return shmemq_dequeue_stamped(shmemq, buffer, size, TscClock::now, &woken) ? size : -1;
+    }
+};
 
-    while (running) {
-        // get the oldest message with highest priority
-        clock_gettime(CLOCK_REALTIME, &tm);
-        tm.tv_sec += 1;
+/**
+ * no IPC, the message is stamped in place: the latency is the cost of the receive path itself
+ */
+struct NullTransport
+{
+    static constexpr const char* label = "null";
+    static constexpr const char* threadName = "null_recv";
+    uint32_t seq;
+
+    inline ssize_t receive(char* buffer, ssize_t size)
+    {
+        (void)size;
+        *(int64_t*)&buffer[0] = TscClock::now();
+        *(uint32_t*)&buffer[sizeof(int64_t)] = ++seq;
+
+        return optMsgSize + MSG_HDR_SIZE;
+    }
 
-        aquireFunc(&recv_buffer, &recv_size);
+    inline ssize_t receiveStaged(char* buffer, ssize_t size, int64_t& woken)
+    {
+        const ssize_t len = receive(buffer, size);
 
-        len = mq_timedreceive(mq_descriptor, recv_buffer, recv_size, NULL, &tm);
+        /* nothing to wait for, the previous send stamp stays 0 */
+        woken = TscClock::now();
+        memset(&buffer[MSG_HDR_SIZE], 0, STAGES_EXT_SIZE);
 
-        releaseFunc(&recv_buffer, &len);
+        return len;
     }
+};
 
-    if (recv_buffer) {
-        std::free(recv_buffer);
+/**
+ * fan-in: one thread waits on all endpoints, a ready endpoint is drained without
+ * blocking up to the batch size before the next ready one is served. the eventfd
+ * replaces the receive timeout, it is only signalled on quit.
+ */
+struct EpollTransport
+{
+    static constexpr const char* label = "epoll";
+    static constexpr const char* threadName = "epoll_recv";
+    int epfd;
+    int ready = 0;
+    int current = 0;
+    int drained = 0;
+    struct epoll_event events[EPOLL_MAX_EVENTS];
+
+    inline ssize_t receive(char* buffer, ssize_t size)
+    {
+        for (;;) {
+            while (current < ready) {
+                const uint32_t index = events[current].data.u32;
+
+                if (index == EPOLL_SHUTDOWN) {
+                    return 0;
+                }
+
+                if (drained < optBatch) {
+                    const Endpoint& endpoint = endpoints[index];
+                    const ssize_t len = endpoint.mq ? mq_receive(endpoint.fd, buffer, size, NULL)
+                                                    : recv(endpoint.fd, buffer, size, MSG_DONTWAIT);
+                    if (len >= 0) {
+                        drained++;
+                        currentEndpoint = index;
+                        return len;
+                    }
+                }
+
+                if (drained) {
+                    endpointStats[index].batch(drained);
+                }
+                current++;
+                drained = 0;
+            }
+
+            /* level triggered, an endpoint left with messages is reported again */
+            ready = epoll_wait(epfd, events, EPOLL_MAX_EVENTS, -1);
+            current = 0;
+            drained = 0;
+            if (ready == -1) {
+                ready = 0;
+                /* a lasting error would spin, it is no receive timeout */
+                if (errno != EINTR) {
+                    perror("epoll_wait() failed");
+                    running = 0;
+                    return 0;
+                }
+            }
+        }
+    }
+
+    inline ssize_t receiveStaged(char* buffer, ssize_t size, int64_t& woken)
+    {
+        /* rejected in process_options, stages need one endpoint */
+        const ssize_t len = receive(buffer, size);
+
+        woken = TscClock::now();
+
+        return len;
     }
+};
+
+static std::string endpoint_name(const char* base, int index)
+{
+    return index ? std::string(base) + "." + std::to_string(index) : std::string(base);
 }
 
-void recv_uds_func(int sockfd)
+/**
+ * non blocking queues and sockets registered at the epoll instance, false on the first failure
+ */
+static bool open_endpoints(int epfd, struct mq_attr* attr)
 {
-    char* recv_buffer = nullptr;
-    ssize_t recv_size = 0;
-    ssize_t len;
+    const bool mq = (strcmp(optIPCMethod, IPC_METHOD_UDS) != 0);
+    const bool uds = (strcmp(optIPCMethod, IPC_METHOD_MQ) != 0);
+    struct rlimit limit;
 
-    std::cout << "start receive UDS with prio [" << optThreadPrio << "]" << std::endl;
+    /* every queue is charged against RLIMIT_MSGQUEUE, the default fits about 20, unlimited needs CAP_SYS_RESOURCE */
+    if (mq && (getrlimit(RLIMIT_MSGQUEUE, &limit) == 0)) {
+        const struct rlimit unlimited = { .rlim_cur = RLIM_INFINITY, .rlim_max = RLIM_INFINITY };
 
-    pthread_setname_np(pthread_self(), "uds_recv");
+        if (setrlimit(RLIMIT_MSGQUEUE, &unlimited) == -1) {
+            limit.rlim_cur = limit.rlim_max;
+            setrlimit(RLIMIT_MSGQUEUE, &limit);
+        }
+    }
 
-    struct sched_param param = { .sched_priority = optThreadPrio };
-    pthread_setschedparam(pthread_self(), SCHED_FIFO, &param);
+    for (int index = 0; index < optEndpoints; index++) {
+        if (mq) {
+            const std::string name = endpoint_name(QUEUE_NAME, index);
+            const int fd = mq_open(name.c_str(), O_RDONLY | O_CREAT | O_NONBLOCK, QUEUE_PERMISSIONS, attr);
+            if (fd == -1) {
+                fprintf(stderr, "mq_open(%s) failed: %s (fs.mqueue.queues_max, ulimit -q)\n", name.c_str(), strerror(errno));
+                return false;
+            }
+            endpoints.push_back({ true, fd, name });
+        }
+        if (uds) {
+            const std::string name = endpoint_name(UDS_FILE, index);
+            struct sockaddr_un address;
+            const int fd = socket(AF_LOCAL, SOCK_DGRAM | SOCK_CLOEXEC, 0);
+
+            bzero(&address, sizeof(address));
+            address.sun_family = AF_LOCAL;
+            strncpy(address.sun_path, name.c_str(), sizeof(address.sun_path) - 1);
+            unlink(name.c_str());
+            if ((fd == -1) || (bind(fd, (struct sockaddr *)&address, sizeof(address)) == -1)) {
+                fprintf(stderr, "bind(%s) failed: %s\n", name.c_str(), strerror(errno));
+                if (fd != -1) {
+                    close(fd);
+                }
+                return false;
+            }
+            endpoints.push_back({ false, fd, name });
+        }
+    }
 
-    configure_cpu_affinity();
+    for (size_t index = 0; index < endpoints.size(); index++) {
+        struct epoll_event event = { .events = EPOLLIN, .data = { .u32 = (uint32_t)index } };
 
-    while (running) {
-        aquireFunc(&recv_buffer, &recv_size);
+        endpointStats.emplace_back(endpoints[index].name);
+        if (epoll_ctl(epfd, EPOLL_CTL_ADD, endpoints[index].fd, &event) == -1) {
+            perror("epoll_ctl() failed");
+            return false;
+        }
+    }
+
+    struct epoll_event event = { .events = EPOLLIN, .data = { .u32 = EPOLL_SHUTDOWN } };
+    if (epoll_ctl(epfd, EPOLL_CTL_ADD, shutdownFd, &event) == -1) {
+        perror("epoll_ctl() failed");
+        return false;
+    }
 
-        len = recv(sockfd, recv_buffer, recv_size, 0);
+    printf("fan-in over %zu endpoints, batches of %d\n", endpoints.size(), optBatch);
 
-        releaseFunc(&recv_buffer, &len);
+    return true;
+}
+
+static void close_endpoints(void)
+{
+    for (const auto& endpoint : endpoints) {
+        if (endpoint.mq) {
+            mq_close(endpoint.fd);
+            mq_unlink(endpoint.name.c_str());
+        }
+        else {
+            close(endpoint.fd);
+            unlink(endpoint.name.c_str());
+        }
     }
+    endpoints.clear();
+}
 
-    if (recv_buffer) {
-        std::free(recv_buffer);
+static std::vector<int> cpu_vector(const affinity_t* cpus)
+{
+    std::vector<int> vector;
+
+    for (int cpu = affinity_next(cpus, -1); cpu != -1; cpu = affinity_next(cpus, cpu)) {
+        vector.push_back(cpu);
     }
+
+    return vector;
 }
 
-void recv_shmem_func(shmemq_t* shmemq)
+/**
+ * one way latencies are only as good as the agreement of the clocks of both CPUs
+ */
+static void check_clocks()
+{
+    clockCheck.check(cpu_vector(recvCpus), cpu_vector(senderCpus));
+    clockCheck.dump();
+
+    if (!clockCheck.withinTolerance(optClockTolerance)) {
+        fprintf(stderr, "clock offset bound above the tolerance of %d ns, latencies between these CPUs are not reliable\n",
+                optClockTolerance);
+        if (optClockStrict) {
+            exit(1);
+        }
+    }
+}
+
+/**
+ * the receive loop, one instance per transport and codec so the per message path inlines
+ */
+template <class Transport, class Codec>
+void recv_func(Transport transport)
 {
     char* recv_buffer = nullptr;
     ssize_t recv_size = 0;
+    ssize_t len;
 
+    std::cout << "start receive " << Transport::label << " with prio [" << optThreadPrio << "]" << std::endl;
 
-    std::cout << "start receive shmem with prio [" << optThreadPrio << "]" << std::endl;
-
-    pthread_setname_np(pthread_self(), "shmem_recv");
+    pthread_setname_np(pthread_self(), Transport::threadName);
 
     struct sched_param param = { .sched_priority = optThreadPrio };
     pthread_setschedparam(pthread_self(), SCHED_FIFO, &param);
 
-    configure_cpu_affinity();
+    configure_cpu_affinity(recvCpus, Transport::threadName);
+
+    perfCounters = perfcounters_new();
+    perfcounters_start(perfCounters);
 
     while (running) {
-        aquireFunc(&recv_buffer, &recv_size);
+        Codec::aquire(&recv_buffer, &recv_size);
 
-        /* shmem needs a fixed size */
-        recv_size = (MSG_SEND_SIZE + MSG_HDR_SIZE);
-        shmemq_dequeue(shmemq, recv_buffer, recv_size);
+        if constexpr (Codec::staged) {
+            len = transport.receiveStaged(recv_buffer, recv_size, Codec::woken);
+        }
+        else {
+            len = transport.receive(recv_buffer, recv_size);
+        }
+
+        tracepoint(mq_perf, recv_wakeup, (int)len);
 
-        releaseFunc(&recv_buffer, &recv_size);
+        receivedMessages += (len > (ssize_t)MSG_HDR_SIZE);
+
+        Codec::release(&recv_buffer, &len);
     }
 
+    perfcounters_stop(perfCounters);
+
     if (recv_buffer) {
         std::free(recv_buffer);
     }
 }
 
+/**
+ * select the codec once at startup
+ */
+template <class Transport>
+std::thread start_recv_thread(Transport transport)
+{
+    if (strcmp(optEncapsulation, RawCodec::name) == 0) {
+        return std::thread(recv_func<Transport, RawCodec>, transport);
+    }
+    if (strcmp(optEncapsulation, StagesCodec::name) == 0) {
+        return std::thread(recv_func<Transport, StagesCodec>, transport);
+    }
+
+    fprintf(stderr, "encapsulation %s not supported\n", optEncapsulation);
+    exit(1);
+}
+
 int main(int argc, char **argv)
 {
     char ch;
@@ -357,23 +924,84 @@ int main(int argc, char **argv)
             .mq_msgsize = MAX_MSG_SIZE,
             .mq_curmsgs = 0 };
     int sockfd;
+    int epfd = -1;
     struct sockaddr_un servaddr;
     shmemq_t* shmemq = nullptr;
 
     /* parse given cmd line args */
     process_options(argc, argv);
 
-    timeProfiling.configure(optStartDelay, optDuration);
+    /* helper threads inherit the main thread placement, the receive thread keeps the started one */
+    if (affinity_is_empty(recvCpus)) {
+        affinity_get(recvCpus);
+    }
+    configure_cpu_affinity(reportCpus, "main");
+
+    if (optClock && (strcmp(optClock, CLOCK_TSC) == 0)) {
+        std::string reason;
+        if (!TscClock::enable(reason)) {
+            fprintf(stderr, "TSC clock not usable (%s), using the system clock\n", reason.c_str());
+        }
+        else if (!reason.empty()) {
+            fprintf(stderr, "TSC clock: %s\n", reason.c_str());
+        }
+    }
+
+    if (senderCpus) {
+        check_clocks();
+    }
+
+    timeProfiling.configure(optStartDelay, optDuration, optHugePages);
+    if (optOutlierUs > 0) {
+        outlierCapture.configure(optOutlierUs);
+    }
+
+    if (optSnapshotUs > 0) {
+        snapshotTrigger.configure(optSnapshotUs, optSnapshotInterval, optSnapshotSession ? optSnapshotSession : SNAPSHOT_SESSION);
+    }
     timeProfiling.start();
 
     optEncapsulation = optEncapsulation ? optEncapsulation : strdup(IPC_ENC_RAW);
 
-    aquireFunc = std::function<void(char**, ssize_t*)>(aquire_message_0);
-    releaseFunc = std::function<void(char**, ssize_t*)>(release_message_0);
+    const bool staged = (strcmp(optEncapsulation, IPC_ENC_STAGES) == 0);
+    if (staged) {
+        for (auto& stage : stageProfiling) {
+            stage.configure(optStartDelay, optDuration, optHugePages);
+            stage.start();
+        }
+    }
 
     optIPCMethod = optIPCMethod ? optIPCMethod : strdup(IPC_METHOD_MQ);
 
-    if (strncmp(optIPCMethod, IPC_METHOD_UDS, strlen(IPC_METHOD_UDS)) == 0) {
+    if (optStats) {
+        if ((shmStats = shmstats_new(optIPCMethod)) == nullptr) {
+            perror("shmstats_new() failed");
+        }
+    }
+
+    if (optRecordFile) {
+        if ((sampleFile = samplefile_create(optRecordFile)) == nullptr) {
+            perror("samplefile_create() failed");
+        }
+        else {
+            samplefile_set_window(sampleFile, TscClock::toRealtimeNs(timeProfiling.getOrigin()), timeProfiling.getStartDelay(),
+                                  timeProfiling.getDuration());
+        }
+    }
+
+    if (fan_in()) {
+        if (((epfd = epoll_create1(EPOLL_CLOEXEC)) == -1) || ((shutdownFd = eventfd(0, EFD_CLOEXEC)) == -1)) {
+            perror("epoll_create1() or eventfd() failed");
+            exit(1);
+        }
+        if (!open_endpoints(epfd, &attr)) {
+            close_endpoints();
+            exit(1);
+        }
+
+        recv_thread = start_recv_thread(EpollTransport{epfd});
+    }
+    else if (strncmp(optIPCMethod, IPC_METHOD_UDS, strlen(IPC_METHOD_UDS)) == 0) {
         if ((sockfd = socket(AF_LOCAL, SOCK_DGRAM, 0)) == -1) {
             perror("socket() failed");
         }
@@ -392,13 +1020,16 @@ int main(int argc, char **argv)
         struct timeval tv = { .tv_sec = 1, .tv_usec = 0};
         setsockopt(sockfd, SOL_SOCKET, SO_RCVTIMEO, (const char*)&tv, sizeof(tv));
 
-        recv_thread = std::thread(recv_uds_func, sockfd);
+        recv_thread = start_recv_thread(UdsTransport{sockfd});
     }
     else if (strncmp(optIPCMethod, IPC_METHOD_SHMEM, strlen(IPC_METHOD_SHMEM)) == 0) {
         /* as we have a queue of fixed elements size must match */
-        shmemq = shmemq_new(SHMEM_NAME, SHMEM_MAX_MESSAGES, (MSG_SEND_SIZE + MSG_HDR_SIZE));
+        shmemq = shmemq_new(SHMEM_NAME, SHMEM_MAX_MESSAGES, (optMsgSize + MSG_HDR_SIZE));
 
-        recv_thread = std::thread(recv_shmem_func, shmemq);
+        recv_thread = start_recv_thread(ShmemTransport{shmemq});
+    }
+    else if (strncmp(optIPCMethod, IPC_METHOD_NULL, strlen(IPC_METHOD_NULL)) == 0) {
+        recv_thread = start_recv_thread(NullTransport{0});
     }
     else {
         if ((mq_descriptor = mq_open(QUEUE_NAME, O_RDONLY | O_CREAT, QUEUE_PERMISSIONS, &attr)) == -1) {
@@ -406,13 +1037,16 @@ int main(int argc, char **argv)
             exit(1);
         }
 
-        recv_thread = std::thread(recv_func, mq_descriptor);
+        recv_thread = start_recv_thread(MqTransport{mq_descriptor});
     }
 
     while (running == 1) {
         printf("\nEnter command : ");
         fflush(stdout);
-        get_one_character(&ch);
+        if (get_one_character(&ch) == -1) {
+            // stdin closed, same as q
+            ch = 'q';
+        }
         printf("\n");
         switch (ch) {
             case 'h':
@@ -422,6 +1056,12 @@ int main(int argc, char **argv)
             case 'q':
                 printf("--> quit\n");
                 running = 0;
+                if (shutdownFd != -1) {
+                    const uint64_t one = 1;
+                    if (write(shutdownFd, &one, sizeof(one)) != sizeof(one)) {
+                        perror("write() eventfd failed");
+                    }
+                }
                 break;
         }
     }
@@ -430,7 +1070,13 @@ int main(int argc, char **argv)
         recv_thread.join();
     }
 
-    if (strncmp(optIPCMethod, IPC_METHOD_UDS, strlen(IPC_METHOD_UDS)) == 0) {
+    if (fan_in()) {
+        close_endpoints();
+        close(shutdownFd);
+        shutdownFd = -1;
+        close(epfd);
+    }
+    else if (strncmp(optIPCMethod, IPC_METHOD_UDS, strlen(IPC_METHOD_UDS)) == 0) {
         close(sockfd);
         unlink(UDS_FILE);
     }
@@ -440,11 +1086,44 @@ int main(int argc, char **argv)
             shmemq = nullptr;
         }
     }
+    else if (strncmp(optIPCMethod, IPC_METHOD_NULL, strlen(IPC_METHOD_NULL)) == 0) {
+        /* nothing opened */
+    }
     else {
         mq_close(mq_descriptor);
         mq_unlink(QUEUE_NAME);
     }
 
+    if (snapshotTrigger.enabled()) {
+        snapshotTrigger.stop();
+        snapshotTrigger.dump();
+    }
+
+    if (optSnapshotSession) {
+        free(optSnapshotSession);
+        optSnapshotSession = nullptr;
+    }
+
+    if (shmStats) {
+        shmstats_destroy(shmStats);
+        shmStats = nullptr;
+    }
+
+    if (sampleFile) {
+        samplefile_close(sampleFile);
+        sampleFile = nullptr;
+    }
+
+    if (optClock) {
+        free(optClock);
+        optClock = nullptr;
+    }
+
+    if (optRecordFile) {
+        free(optRecordFile);
+        optRecordFile = nullptr;
+    }
+
     if (optEncapsulation) {
         free(optEncapsulation);
         optEncapsulation = nullptr;
@@ -456,7 +1135,41 @@ int main(int argc, char **argv)
     }
 
     timeProfiling.process(MEASURE_SAFETY_MARGIN /* remove first and last 100 elements */);
+    TscClock::dump();
+    if (senderCpus) {
+        clockCheck.dump();
+        affinity_destroy(senderCpus);
+        senderCpus = nullptr;
+    }
     timeProfiling.dump();
+    if (endpointStats.empty()) {
+        sequenceTracking.dump();
+    }
+    else {
+        EndpointStatistics::dumpHeader();
+        for (const auto& stats : endpointStats) {
+            stats.dump();
+        }
+    }
+
+    if (staged) {
+        for (int stage = 0; stage < STAGE_MAX; stage++) {
+            std::cout << "Stage " << stageNames[stage] << std::endl;
+            stageProfiling[stage].process(MEASURE_SAFETY_MARGIN);
+            stageProfiling[stage].dump();
+        }
+        StagesCodec::dumpOverlap();
+    }
+
+    if (perfCounters) {
+        perfcounters_dump(perfCounters, receivedMessages);
+        perfcounters_destroy(perfCounters);
+        perfCounters = nullptr;
+    }
+
+    if (outlierCapture.enabled()) {
+        outlierCapture.dump();
+    }
 
     return 0;
 }
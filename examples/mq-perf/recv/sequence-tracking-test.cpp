@@ -0,0 +1,118 @@
+/**
+ * checks of the SequenceTracking accounting
+ * build and run with make test
+ *
+ * usage: sequence-tracking-test
+ */
+
+#include <cstdint>
+#include <cstdio>
+#include <initializer_list>
+#include "SequenceTracking.h"
+
+static int failures = 0;
+
+#define CHECK_EQUAL(what, actual, expected)                                                                     \
+    do {                                                                                                        \
+        if ((uint64_t)(actual) != (uint64_t)(expected)) {                                                       \
+            printf("FAIL %-24s %-12s : %lu, expected %lu\n", what, #actual, (unsigned long)(actual),            \
+                   (unsigned long)(expected));                                                                  \
+            failures++;                                                                                         \
+        }                                                                                                       \
+    } while (0)
+
+static void feed(SequenceTracking& tracking, uint32_t first, uint32_t last)
+{
+    for (uint32_t seq = first; seq <= last; seq++) {
+        tracking.add(seq, seq);
+    }
+}
+
+static void in_order()
+{
+    SequenceTracking tracking;
+
+    feed(tracking, 1, 1000);
+    CHECK_EQUAL("in order", tracking.getReceived(), 1000);
+    CHECK_EQUAL("in order", tracking.getLost(), 0);
+    CHECK_EQUAL("in order", tracking.getGaps(), 0);
+}
+
+static void gap_and_reorder()
+{
+    SequenceTracking tracking;
+
+    /* 4 and 5 late, 8 never */
+    for (uint32_t seq : { 1, 2, 3, 6, 7, 4, 9, 5, 10 }) {
+        tracking.add(seq, seq);
+    }
+    CHECK_EQUAL("gap and reorder", tracking.getReceived(), 9);
+    CHECK_EQUAL("gap and reorder", tracking.getLost(), 1);
+    CHECK_EQUAL("gap and reorder", tracking.getGaps(), 2);
+    CHECK_EQUAL("gap and reorder", tracking.getReordered(), 2);
+    CHECK_EQUAL("gap and reorder", tracking.getDuplicates(), 0);
+}
+
+static void duplicate()
+{
+    SequenceTracking tracking;
+
+    for (uint32_t seq : { 1, 2, 3, 2, 4, 4 }) {
+        tracking.add(seq, seq);
+    }
+    CHECK_EQUAL("duplicate", tracking.getReceived(), 4);
+    CHECK_EQUAL("duplicate", tracking.getDuplicates(), 2);
+    CHECK_EQUAL("duplicate", tracking.getRestarts(), 0);
+}
+
+/* sender restarted before it passed the window */
+static void restart_within_window()
+{
+    SequenceTracking tracking;
+
+    feed(tracking, 1, 1000);
+    feed(tracking, 1, 1500);
+    CHECK_EQUAL("restart within window", tracking.getReceived(), 2500);
+    CHECK_EQUAL("restart within window", tracking.getRestarts(), 1);
+    CHECK_EQUAL("restart within window", tracking.getDuplicates(), 0);
+    CHECK_EQUAL("restart within window", tracking.getReordered(), 0);
+    CHECK_EQUAL("restart within window", tracking.getLost(), 0);
+}
+
+static void restart_beyond_window()
+{
+    SequenceTracking tracking;
+
+    feed(tracking, 1, 3 * SEQUENCE_WINDOW);
+    feed(tracking, 1, 100);
+    CHECK_EQUAL("restart beyond window", tracking.getReceived(), 3 * SEQUENCE_WINDOW + 100);
+    CHECK_EQUAL("restart beyond window", tracking.getRestarts(), 1);
+    CHECK_EQUAL("restart beyond window", tracking.getDuplicates(), 0);
+}
+
+/* a late first message of a sender which was never seen is reordered, not a restart */
+static void late_first()
+{
+    SequenceTracking tracking;
+
+    for (uint32_t seq : { 2, 3, 1, 4 }) {
+        tracking.add(seq, seq);
+    }
+    CHECK_EQUAL("late first", tracking.getReceived(), 4);
+    CHECK_EQUAL("late first", tracking.getReordered(), 1);
+    CHECK_EQUAL("late first", tracking.getRestarts(), 0);
+}
+
+int main()
+{
+    in_order();
+    gap_and_reorder();
+    duplicate();
+    restart_within_window();
+    restart_beyond_window();
+    late_first();
+
+    printf("%s\n", failures ? "FAILED" : "passed");
+
+    return failures ? 1 : 0;
+}
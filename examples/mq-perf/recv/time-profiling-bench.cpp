@@ -0,0 +1,118 @@
+/**
+ * micro benchmark of TimeProfiling::process against the former sort based implementation
+ * build with make bench
+ *
+ * usage: time-profiling-bench [samples ...] (default 1000000 10000000 100000000)
+ */
+
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <random>
+#include <chrono>
+#include <vector>
+#include <map>
+#include <iostream>
+#include "TimeProfiling.h"
+
+#define LEGACY_MAX_SAMPLES  10000000 /* the multimap of the former implementation needs ~100 bytes per sample */
+
+/**
+ * former TimeProfiling::process: multimap histogram, two accumulate passes and a full sort
+ */
+static double legacy_process(const std::vector<int64_t>& sentNs, const std::vector<int64_t>& recvNs)
+{
+    std::multimap<uint32_t, double> histogramMap;
+    std::vector<double> latencyVec;
+    double minLatency = std::numeric_limits<double>::max();
+    double maxLatency = 0.0;
+
+    for (size_t cnt = 0; cnt < sentNs.size(); cnt++) {
+        TimePoint sent(std::chrono::nanoseconds(sentNs[cnt]));
+        TimePoint captured(std::chrono::nanoseconds(recvNs[cnt]));
+        std::chrono::duration<double, std::micro> elapsed = captured - sent;
+        histogramMap.emplace(std::make_pair(nearbyint(elapsed.count()), elapsed.count()));
+        latencyVec.push_back(elapsed.count());
+        minLatency = minLatency > elapsed.count() ? elapsed.count() : minLatency;
+        maxLatency = maxLatency < elapsed.count() ? elapsed.count() : maxLatency;
+    }
+
+    const size_t sz = latencyVec.size();
+    const double mean = std::accumulate(latencyVec.begin(), latencyVec.end(), 0.0) / sz;
+    const double variance = std::accumulate(latencyVec.begin(), latencyVec.end(), 0.0,
+                                            [&mean, &sz](double accumulator, const double& val)
+                                            {
+                                                return accumulator + ((val - mean)*(val - mean) / (sz - 1));
+                                            });
+    (void)variance;
+
+    std::sort(latencyVec.begin(), latencyVec.end(), std::less<double>());
+
+    return latencyVec[sz / 2];
+}
+
+int main(int argc, char **argv)
+{
+    std::vector<uint32_t> sizes;
+    std::mt19937_64 rng(42);
+    /* typical shape: a few us with a long tail */
+    std::lognormal_distribution<double> latencyDist(1.6, 0.5);
+
+    for (int cnt = 1; cnt < argc; cnt++) {
+        sizes.push_back(strtoul(argv[cnt], nullptr, 0));
+    }
+
+    if (sizes.empty()) {
+        sizes = { 1000000, 10000000, 100000000 };
+    }
+
+    /* the parallel backend spawns its worker pool on first use, keep that out of the numbers */
+    std::vector<double> warmup(1 << 20, 1.0);
+    (void)std::reduce(std::execution::par_unseq, warmup.cbegin(), warmup.cend());
+
+    printf("%12s %12s %12s %9s %12s %12s\n", "samples", "legacy ms", "process ms", "speedup", "legacy med", "median");
+
+    for (const uint32_t size : sizes) {
+        TimeProfiling timeProfiling(size);
+        std::vector<int64_t> sentNs;
+        std::vector<int64_t> recvNs;
+
+        timeProfiling.start();
+
+        int64_t now = TimeItem::nowNs() + 1000000000;
+        for (uint32_t cnt = 0; cnt < size; cnt++) {
+            const int64_t latencyNs = (int64_t)(latencyDist(rng) * 1000.0);
+            timeProfiling.add(now, now + latencyNs);
+            if (size <= LEGACY_MAX_SAMPLES) {
+                sentNs.push_back(now);
+                recvNs.push_back(now + latencyNs);
+            }
+            now += 1000;
+        }
+
+        /* process first, tearing down the huge multimap of the former implementation disturbs the allocator */
+        std::cout.setstate(std::ios_base::failbit); /* mute the summary line of process() */
+        const auto processStart = std::chrono::steady_clock::now();
+        timeProfiling.process();
+        const double processMs = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - processStart).count();
+        std::cout.clear();
+
+        double legacyMs = 0.0;
+        double legacyMedian = 0.0;
+        if (size <= LEGACY_MAX_SAMPLES) {
+            const auto legacyStart = std::chrono::steady_clock::now();
+            legacyMedian = legacy_process(sentNs, recvNs);
+            legacyMs = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - legacyStart).count();
+        }
+
+        if (size <= LEGACY_MAX_SAMPLES) {
+            printf("%12u %12.1f %12.1f %8.1fx %12.3f %12.3f\n", size, legacyMs, processMs, legacyMs / processMs,
+                   legacyMedian, timeProfiling.getMedian());
+        }
+        else {
+            printf("%12u %12s %12.1f %9s %12s %12.3f\n", size, "-", processMs, "-", "-", timeProfiling.getMedian());
+        }
+    }
+
+    return 0;
+}
@@ -0,0 +1,396 @@
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/types.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <errno.h>
+#include <stdio.h>
+#include <string.h>
+#include <stdlib.h>
+#include <assert.h>
+#include <atomic>
+#include <thread>
+#include <chrono>
+
+#include "samplefile.h"
+
+#define SAMPLEFILE_MAX_RECORD   30                  /* 2 x 10 bytes int64 + 2 x 5 bytes int32 varints */
+#define SAMPLEFILE_ALIGN        4096
+
+struct _samplefile {
+    int fd;
+    struct samplefile_record* ring;
+    alignas(64) std::atomic<uint64_t> head;        /* written by the receive thread */
+    alignas(64) std::atomic<uint64_t> tail;        /* written by the writer thread  */
+    alignas(64) std::atomic<bool> stop;
+    uint64_t dropped;
+    uint64_t records;
+    char* block;
+    size_t block_bytes;
+    uint32_t block_count;
+    int64_t prev_sent_ns;
+    uint32_t prev_seq;
+    int64_t window_origin_ns;
+    int32_t window_start_sec;
+    int32_t window_duration_sec;
+    std::thread writer;
+};
+
+struct _samplefile_reader {
+    int fd;
+    size_t size;
+    const uint8_t* mem;
+    const struct samplefile_header* header;
+    size_t block_offset;                    /* current block            */
+    uint32_t block_index;                   /* record within the block  */
+    size_t offset;                          /* read position            */
+    int64_t prev_sent_ns;
+    uint32_t prev_seq;
+};
+
+static inline size_t put_varint(uint8_t* out, uint64_t value)
+{
+    size_t len = 0;
+
+    while (value >= 0x80) {
+        out[len++] = (uint8_t)(value | 0x80);
+        value >>= 7;
+    }
+    out[len++] = (uint8_t)value;
+
+    return len;
+}
+
+static inline uint64_t get_varint(const uint8_t* in, size_t* offset)
+{
+    uint64_t value = 0;
+    int shift = 0;
+    uint8_t byte;
+
+    do {
+        byte = in[(*offset)++];
+        value |= (uint64_t)(byte & 0x7f) << shift;
+        shift += 7;
+    } while ((byte & 0x80) && (shift < 64));
+
+    return value;
+}
+
+static inline uint64_t zigzag(int64_t value)
+{
+    return ((uint64_t)value << 1) ^ (uint64_t)(value >> 63);
+}
+
+static inline int64_t unzigzag(uint64_t value)
+{
+    return (int64_t)(value >> 1) ^ -(int64_t)(value & 1);
+}
+
+static void* aligned_buffer(size_t size)
+{
+    void* buffer = nullptr;
+
+    if (posix_memalign(&buffer, SAMPLEFILE_ALIGN, size) != 0) {
+        return nullptr;
+    }
+
+    /* prefault, nothing may page fault later on */
+    memset(buffer, 0, size);
+
+    return buffer;
+}
+
+static void write_all(int fd, const void* buffer, size_t size)
+{
+    const char* ptr = (const char*)buffer;
+
+    while (size > 0) {
+        ssize_t len = write(fd, ptr, size);
+        if (len == -1) {
+            if (errno == EINTR) {
+                continue;
+            }
+            perror("samplefile: write() failed");
+            return;
+        }
+        ptr += len;
+        size -= len;
+    }
+}
+
+static void flush_block(samplefile_t* self)
+{
+    struct samplefile_block* block = (struct samplefile_block*)self->block;
+
+    if (self->block_count == 0) {
+        return;
+    }
+
+    block->magic = SAMPLEFILE_BLOCK_MAGIC;
+    block->count = self->block_count;
+    block->bytes = self->block_bytes - sizeof(struct samplefile_block);
+
+    /* zero the tail, every block is written with full size */
+    memset(self->block + self->block_bytes, 0, SAMPLEFILE_BLOCK_SIZE - self->block_bytes);
+    write_all(self->fd, self->block, SAMPLEFILE_BLOCK_SIZE);
+
+    self->block_bytes = sizeof(struct samplefile_block);
+    self->block_count = 0;
+    self->prev_sent_ns = 0;
+    self->prev_seq = 0;
+}
+
+static void encode(samplefile_t* self, const struct samplefile_record* record)
+{
+    if ((self->block_bytes + SAMPLEFILE_MAX_RECORD) > SAMPLEFILE_BLOCK_SIZE) {
+        flush_block(self);
+    }
+
+    uint8_t* out = (uint8_t*)self->block + self->block_bytes;
+    size_t len = 0;
+
+    len += put_varint(&out[len], zigzag(record->sent_ns - self->prev_sent_ns));
+    len += put_varint(&out[len], zigzag(record->recv_ns - record->sent_ns));
+    len += put_varint(&out[len], zigzag((int32_t)(record->seq - self->prev_seq)));
+    len += put_varint(&out[len], record->cpu);
+
+    self->block_bytes += len;
+    self->block_count++;
+    self->prev_sent_ns = record->sent_ns;
+    self->prev_seq = record->seq;
+    self->records++;
+}
+
+static void writer_func(samplefile_t* self)
+{
+    pthread_setname_np(pthread_self(), "sample_writer");
+
+    for (;;) {
+        uint64_t tail = self->tail.load(std::memory_order_relaxed);
+        uint64_t head = self->head.load(std::memory_order_acquire);
+
+        if (tail == head) {
+            if (self->stop.load(std::memory_order_acquire) &&
+                (self->head.load(std::memory_order_acquire) == tail)) {
+                break;
+            }
+            std::this_thread::sleep_for(std::chrono::milliseconds(1));
+            continue;
+        }
+
+        for (; tail != head; tail++) {
+            encode(self, &self->ring[tail & (SAMPLEFILE_RING_SIZE - 1)]);
+        }
+
+        self->tail.store(tail, std::memory_order_release);
+    }
+
+    flush_block(self);
+}
+
+samplefile_t* samplefile_create(char const* path)
+{
+    samplefile_t* self = new samplefile_t();
+    struct samplefile_header* header;
+
+    self->fd = open(path, O_RDWR | O_CREAT | O_TRUNC, S_IRUSR | S_IWUSR | S_IRGRP | S_IROTH);
+    if (self->fd == -1) {
+        goto FAIL;
+    }
+
+    self->ring = (struct samplefile_record*)aligned_buffer(SAMPLEFILE_RING_SIZE * sizeof(struct samplefile_record));
+    self->block = (char*)aligned_buffer(SAMPLEFILE_BLOCK_SIZE);
+    if ((self->ring == nullptr) || (self->block == nullptr)) {
+        goto FAIL;
+    }
+
+    /* header page, counters are filled in on close */
+    header = (struct samplefile_header*)self->block;
+    header->magic = SAMPLEFILE_MAGIC;
+    header->version = SAMPLEFILE_VERSION;
+    header->block_size = SAMPLEFILE_BLOCK_SIZE;
+    header->pid = getpid();
+    write_all(self->fd, self->block, SAMPLEFILE_HEADER_SIZE);
+    memset(self->block, 0, SAMPLEFILE_HEADER_SIZE);
+
+    self->block_bytes = sizeof(struct samplefile_block);
+    self->writer = std::thread(writer_func, self);
+
+    return self;
+
+FAIL:
+    if (self->fd != -1) {
+        close(self->fd);
+    }
+    free(self->ring);
+    free(self->block);
+    delete self;
+    return NULL;
+}
+
+bool samplefile_append(samplefile_t* self, const struct samplefile_record* record)
+{
+    const uint64_t head = self->head.load(std::memory_order_relaxed);
+
+    if ((head - self->tail.load(std::memory_order_acquire)) >= SAMPLEFILE_RING_SIZE) {
+        self->dropped++;
+        return false;
+    }
+
+    self->ring[head & (SAMPLEFILE_RING_SIZE - 1)] = *record;
+    self->head.store(head + 1, std::memory_order_release);
+
+    return true;
+}
+
+/**
+ * the statistics window of the receiver, lets the analysis select the same samples
+ */
+void samplefile_set_window(samplefile_t* self, int64_t origin_ns, int32_t start_sec, int32_t duration_sec)
+{
+    self->window_origin_ns = origin_ns;
+    self->window_start_sec = start_sec;
+    self->window_duration_sec = duration_sec;
+}
+
+void samplefile_close(samplefile_t* self)
+{
+    struct samplefile_header header;
+
+    self->stop.store(true, std::memory_order_release);
+    if (self->writer.joinable()) {
+        self->writer.join();
+    }
+
+    memset(&header, 0, sizeof(header));
+    header.magic = SAMPLEFILE_MAGIC;
+    header.version = SAMPLEFILE_VERSION;
+    header.block_size = SAMPLEFILE_BLOCK_SIZE;
+    header.pid = getpid();
+    header.records = self->records;
+    header.dropped = self->dropped;
+    header.window_origin_ns = self->window_origin_ns;
+    header.window_start_sec = self->window_start_sec;
+    header.window_duration_sec = self->window_duration_sec;
+    if (pwrite(self->fd, &header, sizeof(header), 0) != sizeof(header)) {
+        perror("samplefile: pwrite() failed");
+    }
+
+    if (self->dropped > 0) {
+        fprintf(stderr, "samplefile: %lu samples dropped, writer could not keep up\n", (unsigned long)self->dropped);
+    }
+
+    close(self->fd);
+    free(self->ring);
+    free(self->block);
+    delete self;
+}
+
+samplefile_reader_t* samplefile_open(char const* path)
+{
+    samplefile_reader_t* self;
+    struct stat st;
+
+    self = (samplefile_reader_t*)malloc(sizeof(samplefile_reader_t));
+    assert(self != nullptr);
+
+    memset(self, 0, sizeof(samplefile_reader_t));
+    self->mem = (const uint8_t*)MAP_FAILED;
+
+    self->fd = open(path, O_RDONLY);
+    if (self->fd == -1) {
+        goto FAIL;
+    }
+
+    if ((fstat(self->fd, &st) == -1) || (st.st_size < SAMPLEFILE_HEADER_SIZE)) {
+        goto FAIL;
+    }
+
+    self->size = st.st_size;
+    self->mem = (const uint8_t*)mmap(NULL, self->size, PROT_READ, MAP_PRIVATE, self->fd, 0);
+    if (self->mem == MAP_FAILED) {
+        goto FAIL;
+    }
+
+    /* read sequentially, once */
+    madvise((void*)self->mem, self->size, MADV_SEQUENTIAL);
+
+    self->header = (const struct samplefile_header*)self->mem;
+    /* version 1 has no window, its fields are 0 within the zeroed header page */
+    if ((self->header->magic != SAMPLEFILE_MAGIC) || (self->header->version < 1) || (self->header->version > SAMPLEFILE_VERSION) ||
+        (self->header->block_size < sizeof(struct samplefile_block))) {
+        errno = EINVAL;
+        goto FAIL;
+    }
+
+    samplefile_rewind(self);
+
+    return self;
+
+FAIL:
+    if (self->mem != MAP_FAILED) {
+        munmap((void*)self->mem, self->size);
+    }
+    if (self->fd != -1) {
+        close(self->fd);
+    }
+    free(self);
+    return NULL;
+}
+
+const struct samplefile_header* samplefile_get_header(samplefile_reader_t* self)
+{
+    return self->header;
+}
+
+void samplefile_rewind(samplefile_reader_t* self)
+{
+    self->block_offset = SAMPLEFILE_HEADER_SIZE;
+    self->block_index = 0;
+    self->offset = self->block_offset + sizeof(struct samplefile_block);
+    self->prev_sent_ns = 0;
+    self->prev_seq = 0;
+}
+
+bool samplefile_next(samplefile_reader_t* self, struct samplefile_record* record)
+{
+    for (;;) {
+        if ((self->block_offset + self->header->block_size) > self->size) {
+            return false;
+        }
+
+        const struct samplefile_block* block = (const struct samplefile_block*)&self->mem[self->block_offset];
+        if (block->magic != SAMPLEFILE_BLOCK_MAGIC) {
+            return false;
+        }
+
+        if (self->block_index < block->count) {
+            break;
+        }
+
+        /* next block, deltas restart */
+        self->block_offset += self->header->block_size;
+        self->block_index = 0;
+        self->offset = self->block_offset + sizeof(struct samplefile_block);
+        self->prev_sent_ns = 0;
+        self->prev_seq = 0;
+    }
+
+    record->sent_ns = self->prev_sent_ns + unzigzag(get_varint(self->mem, &self->offset));
+    record->recv_ns = record->sent_ns + unzigzag(get_varint(self->mem, &self->offset));
+    record->seq = self->prev_seq + (uint32_t)unzigzag(get_varint(self->mem, &self->offset));
+    record->cpu = (uint32_t)get_varint(self->mem, &self->offset);
+
+    self->prev_sent_ns = record->sent_ns;
+    self->prev_seq = record->seq;
+    self->block_index++;
+
+    return true;
+}
+
+void samplefile_reader_close(samplefile_reader_t* self)
+{
+    munmap((void*)self->mem, self->size);
+    close(self->fd);
+    free(self);
+}
@@ -0,0 +1,64 @@
+#pragma once
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <stddef.h>
+
+#define SAMPLEFILE_MAGIC        0x4650514d          /* 'MQPF' */
+#define SAMPLEFILE_BLOCK_MAGIC  0x4250514d          /* 'MQPB' */
+#define SAMPLEFILE_VERSION      2
+#define SAMPLEFILE_HEADER_SIZE  4096                /* file header occupies the first page */
+#define SAMPLEFILE_BLOCK_SIZE   (1024 * 1024)       /* blocks are written whole and aligned */
+#define SAMPLEFILE_RING_SIZE    (1 << 16)           /* records buffered between recv and writer thread */
+
+/**
+ * one raw sample as seen by the receiver
+ */
+struct samplefile_record {
+    int64_t sent_ns;
+    int64_t recv_ns;
+    uint32_t seq;
+    uint32_t cpu;
+};
+
+/**
+ * file layout: header page followed by fixed size blocks. every block starts
+ * with a samplefile_block header, records within a block are delta + zigzag
+ * varint encoded against the previous record of the same block only, so each
+ * block decodes on its own.
+ */
+struct samplefile_header {
+    uint32_t magic;
+    uint32_t version;
+    uint32_t block_size;
+    int32_t pid;
+    uint64_t records;                       /* total, written on close  */
+    uint64_t dropped;                       /* ring overflows           */
+    /* since version 2: --start/--duration window of the receiver, all 0 without */
+    int64_t window_origin_ns;               /* CLOCK_REALTIME the start delay counts from */
+    int32_t window_start_sec;
+    int32_t window_duration_sec;            /* 0 until the end */
+};
+
+struct samplefile_block {
+    uint32_t magic;
+    uint32_t count;
+    uint32_t bytes;                         /* encoded payload length   */
+    uint32_t reserved;
+};
+
+typedef struct _samplefile samplefile_t;
+typedef struct _samplefile_reader samplefile_reader_t;
+
+/* writer side, append is wait free and called from the receive thread only */
+samplefile_t* samplefile_create(char const* path);
+bool samplefile_append(samplefile_t* self, const struct samplefile_record* record);
+void samplefile_set_window(samplefile_t* self, int64_t origin_ns, int32_t start_sec, int32_t duration_sec);
+void samplefile_close(samplefile_t* self);
+
+/* reader side, the file is memory mapped */
+samplefile_reader_t* samplefile_open(char const* path);
+const struct samplefile_header* samplefile_get_header(samplefile_reader_t* self);
+bool samplefile_next(samplefile_reader_t* self, struct samplefile_record* record);
+void samplefile_rewind(samplefile_reader_t* self);
+void samplefile_reader_close(samplefile_reader_t* self);
@@ -0,0 +1,39 @@
+#!/bin/bash
+#
+# usage: mq-perf-instrument-exclude.sh [max bytes] [binary ...]
+#
+# writes the functions of the instrumented binaries (default recv and xmit)
+# which are smaller than max bytes (default 128) to instrument-exclude.list,
+# the Makefiles then build them without -finstrument-functions hooks.
+# remark: gcc matches the list as substrings of the function names, so
+# names containing spaces, commas or template arguments are left out, as
+# are lambdas and the split off cold parts of larger functions. A name
+# is only listed when it is small in all binaries.
+
+cd "$(dirname "$0")/.." || exit 1
+
+MAX_BYTES=${1:-128}
+shift
+BINARIES=${*:-recv/mq-perf-recv xmit/mq-perf-xmit}
+LIST=instrument-exclude.list
+
+for binary in $BINARIES; do
+  if [ ! -x "$binary" ]; then
+    echo "$binary not found, build first" >&2
+    exit 1
+  fi
+done
+
+nm -C -S -t d --defined-only $BINARIES |
+  grep -v -F -e '[clone' -e ')::' |
+  awk -v limit="$MAX_BYTES" '$3 ~ /^[tTwW]$/ {
+    size = $2 + 0; $1 = $2 = $3 = ""; sub(/^ */, ""); sub(/\(.*/, "")
+    if (size > max[$0]) max[$0] = size
+  }
+  END { for (name in max) if (max[name] < limit + 0) print name }' |
+  grep -E '^[A-Za-z_][A-Za-z0-9_:~]*$' |
+  grep -v -E '^(main|_start|_init|_fini|_Z.*|_GLOBAL_.*|__.*|_dl_.*)$' |
+  sort -u > $LIST
+
+echo "$(wc -l < $LIST) functions below $MAX_BYTES bytes written to $(pwd)/$LIST"
+echo "rebuild with: make clean && make"
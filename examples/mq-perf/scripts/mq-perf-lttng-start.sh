@@ -1,17 +1,34 @@
-#!/bin/sh
+#!/bin/bash
+#
+# usage: mq-perf-lttng-start.sh [snapshot]
+#
+# without argument the whole run is written to disk, with snapshot the
+# session only keeps in-memory ring buffers and mq-perf-recv --snapshot-us
+# records a snapshot around each latency spike.
 
 if [ ! -d /tmp/lttng ]; then
   mkdir /tmp/lttng
 fi
 
-# relayd gave too mach latency due to network traffic
-lttng create -o /tmp/lttng/mq-latency-$(date +%s)
-#lttng create mq-latency --set-url=net://192.168.0.139
+if [ "$1" = "snapshot" ]; then
+  # session name must match mq-perf-recv --snapshot-session (default mq-latency)
+  lttng create mq-latency --snapshot -o /tmp/lttng/mq-latency-snapshot-$(date +%s)
+else
+  # relayd gave too mach latency due to network traffic
+  lttng create -o /tmp/lttng/mq-latency-$(date +%s)
+  #lttng create mq-latency --set-url=net://192.168.0.139
+fi
 
 # enable most important kernel trace points
-lttng enable-channel kernel -k
+if [ "$1" = "snapshot" ]; then
+  # a few milli seconds around each spike are enough, keep the ring small
+  lttng enable-channel kernel -k --subbuf-size=1M --num-subbuf=8
+else
+  lttng enable-channel kernel -k
+fi
+
 kernel_events=(
-  "sched_switch,sched_process_*" "lttng_statedump_*"
+  "sched_switch,sched_waking,sched_process_*" "lttng_statedump_*"
   "irq_*" "signal_*" "workqueue_*"
   "kmem_"{mm_page,cache}__{alloc,free} "block_rq_"{issue,complete,requeue}
 )
@@ -24,9 +41,10 @@ lttng enable-event -c kernel -k --syscall -a
 
 #lttng track --kernel --pid=`pidof mq-perf-recv`,`pidof mq-perf-xmit`
 
-# enable all user space tracepoints
-#lttng enable-channel ust -u
-#lttng enable-event -c ust -u -a
+# enable the mq-perf user space tracepoints (binaries built with make LTTNG_UST=1)
+lttng enable-channel ust -u
+lttng enable-event -c ust -u "mq_perf:*"
+lttng add-context -c ust -u -t vpid -t vtid -t procname
 
 # actually start tracing
 lttng start
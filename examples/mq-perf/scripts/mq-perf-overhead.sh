@@ -0,0 +1,90 @@
+#!/bin/bash
+#
+# usage: mq-perf-overhead.sh [csv file] [mq-perf-overhead options]
+#
+# runs overhead/mq-perf-overhead once per configuration and collects the
+# rows in one CSV (default /tmp/mq-perf-overhead-<time>.csv):
+#   plain           nothing attached, every method disabled
+#   <library>       a preloaded library of the examples or of lttng-ust
+#   lttng           mq_perf:* user space events enabled in a session
+#   bpftrace        the USDT probes attached
+# configurations whose tools or libraries are missing are skipped.
+
+cd "$(dirname "$0")/.." || exit 1
+
+CSV=${1:-/tmp/mq-perf-overhead-$(date +%s).csv}
+shift
+BINARY=overhead/mq-perf-overhead
+ARGS=("$@")
+
+if [ ! -x "$BINARY" ]; then
+  echo "$BINARY not found, build with make -C overhead" >&2
+  exit 1
+fi
+
+# label, then environment assignments for the run
+run() {
+  local label=$1
+  shift
+  echo "running $label" >&2
+  env "$@" "$BINARY" -l "$label" -n "${ARGS[@]}" >> "$CSV"
+}
+
+"$BINARY" -m none -i 1 -r 1 | head -1 > "$CSV"
+
+run plain
+
+# preload libraries of the examples, the reports are of no interest here
+EXAMPLES=..
+if [ -f "$EXAMPLES/cyg-collector/libcyg-collector.so" ]; then
+  run cyg-collector LD_PRELOAD="$EXAMPLES/cyg-collector/libcyg-collector.so" CYG_COLLECTOR_FILE=/dev/null
+fi
+if [ -f "$EXAMPLES/mutex-profiler/libmutex-profiler.so" ]; then
+  run mutex-profiler LD_PRELOAD="$EXAMPLES/mutex-profiler/libmutex-profiler.so" MUTEX_PROFILER_FILE=/dev/null
+fi
+if [ -f "$EXAMPLES/alloc-profiler/liballoc-profiler.so" ]; then
+  run alloc-profiler LD_PRELOAD="$EXAMPLES/alloc-profiler/liballoc-profiler.so" ALLOC_PROFILER_FILE=/dev/null
+fi
+
+# lttng-ust helpers, they only record while a session enables their events
+LTTNG_UST_LIBS=$(ldconfig -p 2>/dev/null | awk '{ print $NF }')
+for helper in cyg-profile cyg-profile-fast pthread-wrapper libc-wrapper; do
+  lib=$(echo "$LTTNG_UST_LIBS" | grep -m1 "/liblttng-ust-$helper.so")
+  if [ -n "$lib" ]; then
+    run "ust-$helper" LD_PRELOAD="$lib"
+  fi
+done
+
+# the same helpers and the mq_perf tracepoints with a session recording them
+if command -v lttng > /dev/null; then
+  lttng create mq-perf-overhead -o "/tmp/lttng/mq-perf-overhead-$(date +%s)" > /dev/null
+  lttng enable-channel ust -u > /dev/null
+  for event in "mq_perf:*" "lttng_ust_cyg_profile*" "lttng_ust_pthread:*" "lttng_ust_libc:*"; do
+    lttng enable-event -c ust -u "$event" > /dev/null
+  done
+  lttng start > /dev/null
+
+  run lttng
+  for helper in cyg-profile-fast pthread-wrapper libc-wrapper; do
+    lib=$(echo "$LTTNG_UST_LIBS" | grep -m1 "/liblttng-ust-$helper.so")
+    if [ -n "$lib" ]; then
+      run "lttng-$helper" LD_PRELOAD="$lib"
+    fi
+  done
+
+  lttng stop > /dev/null
+  lttng destroy mq-perf-overhead > /dev/null
+fi
+
+# an attached tracer sets the USDT semaphores, the guarded probe becomes enabled
+if command -v bpftrace > /dev/null && [ "$(id -u)" = 0 ]; then
+  bpftrace -e "usdt:$BINARY:mq_perf:overhead* { @ = count(); }" -c "$BINARY -l bpftrace -n -m usdt-guarded,usdt ${ARGS[*]}" |
+    grep '^bpftrace,' >> "$CSV"
+fi
+
+echo "results in $CSV" >&2
+if command -v column > /dev/null; then
+  column -s, -t < "$CSV"
+else
+  cat "$CSV"
+fi
@@ -12,6 +12,10 @@
 #include <assert.h>
 
 #include "shmemq.h"
+#include "mq-perf-usdt.h"
+
+MQ_PERF_USDT_SEMAPHORE(enqueue)
+MQ_PERF_USDT_SEMAPHORE(dequeue)
 
 struct shmemq_info {
     pthread_mutex_t lock;
@@ -126,6 +130,10 @@ bool shmemq_try_enqueue(shmemq_t* self, void* element, int len)
     memcpy(&self->mem->data[self->mem->write_index % self->max_size], element, len);
     self->mem->write_index += self->element_size;
 
+    if (MQ_PERF_USDT_ENABLED(enqueue)) {
+        MQ_PERF_USDT2(enqueue, len, (self->mem->write_index - self->mem->read_index) / self->element_size);
+    }
+
     pthread_mutex_unlock(&self->mem->lock);
 
     return true;
@@ -149,6 +157,10 @@ bool shmemq_try_enqueue_sema(shmemq_t* self, void* element, int len)
     memcpy(&self->mem->data[self->mem->write_index % self->max_size], element, len);
     self->mem->write_index += self->element_size;
 
+    if (MQ_PERF_USDT_ENABLED(enqueue)) {
+        MQ_PERF_USDT2(enqueue, len, (self->mem->write_index - self->mem->read_index) / self->element_size);
+    }
+
     /**
      * order is important here see:
      * http://stackoverflow.com/questions/4544234/calling-pthread-cond-signal-without-locking-mutex
@@ -162,6 +174,11 @@ bool shmemq_try_enqueue_sema(shmemq_t* self, void* element, int len)
 }
 
 bool shmemq_dequeue(shmemq_t* self, void* element, int len)
+{
+    return shmemq_dequeue_stamped(self, element, len, NULL, NULL);
+}
+
+bool shmemq_dequeue_stamped(shmemq_t* self, void* element, int len, int64_t (*now)(void), int64_t* woken)
 {
     if (len != self->element_size) {
         return false;
@@ -175,6 +192,10 @@ bool shmemq_dequeue(shmemq_t* self, void* element, int len)
         pthread_cond_wait(&self->mem->sema_cond, &self->mem->lock);
     }
 
+    if (now) {
+        *woken = now();
+    }
+
     if (self->mem->read_index >= self->mem->write_index) {
         pthread_mutex_unlock(&self->mem->lock);
         printf("empty should not happen !!!!!\n");
@@ -185,6 +206,10 @@ bool shmemq_dequeue(shmemq_t* self, void* element, int len)
     memcpy(element, &self->mem->data[self->mem->read_index % self->max_size], len);
     self->mem->read_index += self->element_size;
 
+    if (MQ_PERF_USDT_ENABLED(dequeue)) {
+        MQ_PERF_USDT2(dequeue, len, (self->mem->write_index - self->mem->read_index) / self->element_size);
+    }
+
     pthread_mutex_unlock(&self->mem->lock);
 
     return true;
@@ -207,6 +232,10 @@ bool shmemq_try_dequeue(shmemq_t* self, void* element, int len)
     memcpy(element, &self->mem->data[self->mem->read_index % self->max_size], len);
     self->mem->read_index += self->element_size;
 
+    if (MQ_PERF_USDT_ENABLED(dequeue)) {
+        MQ_PERF_USDT2(dequeue, len, (self->mem->write_index - self->mem->read_index) / self->element_size);
+    }
+
     pthread_mutex_unlock(&self->mem->lock);
 
     return true;
@@ -1,6 +1,7 @@
 #pragma once
 
 #include <stdbool.h>
+#include <stdint.h>
 
 typedef struct _shmemq shmemq_t;
 
@@ -10,5 +11,7 @@ bool shmemq_try_dequeue(shmemq_t* self, void* element, int len);
 
 bool shmemq_try_enqueue_sema(shmemq_t* self, void* element, int len);
 bool shmemq_dequeue(shmemq_t* self, void* element, int len);
+/* as shmemq_dequeue, *woken = now() once the element is there and before it is copied */
+bool shmemq_dequeue_stamped(shmemq_t* self, void* element, int len, int64_t (*now)(void), int64_t* woken);
 
 void shmemq_destroy(shmemq_t* self, int unlink);
@@ -0,0 +1,215 @@
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/types.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <errno.h>
+#include <stdio.h>
+#include <string.h>
+#include <stdlib.h>
+#include <time.h>
+#include <assert.h>
+
+#include "shmstats.h"
+
+#define SHMSTATS_SNAPSHOT_RETRIES   1000
+
+struct _shmstats {
+    char* name;
+    int shmem_fd;
+    int owner;
+    struct shmstats_data* mem;
+};
+
+static uint64_t shmstats_now_ns(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_REALTIME, &ts);
+
+    return (uint64_t)ts.tv_sec * 1000000000ull + ts.tv_nsec;
+}
+
+static inline void shmstats_write_begin(struct shmstats_data* mem)
+{
+    __atomic_store_n(&mem->seq, mem->seq + 1, __ATOMIC_RELAXED);
+    __atomic_thread_fence(__ATOMIC_RELEASE);
+}
+
+static inline void shmstats_write_end(struct shmstats_data* mem)
+{
+    __atomic_store_n(&mem->seq, mem->seq + 1, __ATOMIC_RELEASE);
+}
+
+shmstats_t* shmstats_new(char const* ipc)
+{
+    shmstats_t* self;
+    char name[64];
+
+    self = (shmstats_t*)malloc(sizeof(shmstats_t));
+    assert(self != nullptr);
+
+    memset(self, 0, sizeof(shmstats_t));
+    snprintf(name, sizeof(name), "/" SHMSTATS_PREFIX "%d", getpid());
+    self->name = strdup(name);
+    self->owner = 1;
+
+    self->shmem_fd = shm_open(name, O_RDWR | O_CREAT | O_TRUNC, S_IRUSR | S_IWUSR | S_IRGRP | S_IROTH);
+    if (self->shmem_fd == -1) {
+        goto FAIL;
+    }
+
+    if (ftruncate(self->shmem_fd, sizeof(struct shmstats_data)) == -1) {
+        goto FAIL;
+    }
+
+    self->mem = (struct shmstats_data*)mmap(NULL, sizeof(struct shmstats_data), PROT_READ | PROT_WRITE,
+                                            MAP_SHARED | MAP_POPULATE, self->shmem_fd, 0);
+    if (self->mem == MAP_FAILED) {
+        goto FAIL;
+    }
+
+    /* keep the segment resident, the receiver must not fault while publishing */
+    mlock(self->mem, sizeof(struct shmstats_data));
+
+    self->mem->version = SHMSTATS_VERSION;
+    self->mem->pid = getpid();
+    strncpy(self->mem->ipc, ipc, SHMSTATS_IPC_LEN - 1);
+    self->mem->start_ns = self->mem->update_ns = shmstats_now_ns();
+    self->mem->min_ns = INT64_MAX;
+    /* publish the magic last, monitors ignore segments without it */
+    __atomic_store_n(&self->mem->magic, SHMSTATS_MAGIC, __ATOMIC_RELEASE);
+
+    return self;
+
+FAIL:
+    if (self->shmem_fd != -1) {
+        close(self->shmem_fd);
+        shm_unlink(self->name);
+    }
+    free(self->name);
+    free(self);
+    return NULL;
+}
+
+/**
+ * capture_ns is the CLOCK_REALTIME receive stamp the latency was computed from,
+ * taking another one here would cost a clock read per message
+ */
+void shmstats_add(shmstats_t* self, int64_t latency_ns, int64_t capture_ns)
+{
+    struct shmstats_data* mem = self->mem;
+    int64_t bucket = latency_ns / 1000;
+
+    bucket = bucket < 0 ? 0 : (bucket >= SHMSTATS_HIST_BUCKETS ? SHMSTATS_HIST_BUCKETS - 1 : bucket);
+
+    shmstats_write_begin(mem);
+    mem->update_ns = (uint64_t)capture_ns;
+    mem->messages++;
+    mem->sum_ns += latency_ns;
+    mem->min_ns = latency_ns < mem->min_ns ? latency_ns : mem->min_ns;
+    mem->max_ns = latency_ns > mem->max_ns ? latency_ns : mem->max_ns;
+    mem->hist[bucket]++;
+    shmstats_write_end(mem);
+}
+
+void shmstats_timeout(shmstats_t* self)
+{
+    struct shmstats_data* mem = self->mem;
+
+    shmstats_write_begin(mem);
+    mem->update_ns = shmstats_now_ns();
+    mem->timeouts++;
+    shmstats_write_end(mem);
+}
+
+void shmstats_destroy(shmstats_t* self)
+{
+    munmap(self->mem, sizeof(struct shmstats_data));
+    close(self->shmem_fd);
+
+    if (self->owner) {
+        shm_unlink(self->name);
+    }
+
+    free(self->name);
+    free(self);
+}
+
+shmstats_t* shmstats_attach(char const* name)
+{
+    shmstats_t* self;
+
+    self = (shmstats_t*)malloc(sizeof(shmstats_t));
+    assert(self != nullptr);
+
+    memset(self, 0, sizeof(shmstats_t));
+    self->name = strdup(name);
+
+    self->shmem_fd = shm_open(name, O_RDONLY, 0);
+    if (self->shmem_fd == -1) {
+        goto FAIL;
+    }
+
+    self->mem = (struct shmstats_data*)mmap(NULL, sizeof(struct shmstats_data), PROT_READ, MAP_SHARED, self->shmem_fd, 0);
+    if (self->mem == MAP_FAILED) {
+        goto FAIL;
+    }
+
+    if ((__atomic_load_n(&self->mem->magic, __ATOMIC_ACQUIRE) != SHMSTATS_MAGIC) ||
+        (self->mem->version != SHMSTATS_VERSION)) {
+        munmap(self->mem, sizeof(struct shmstats_data));
+        goto FAIL;
+    }
+
+    return self;
+
+FAIL:
+    if (self->shmem_fd != -1) {
+        close(self->shmem_fd);
+    }
+    free(self->name);
+    free(self);
+    return NULL;
+}
+
+bool shmstats_snapshot(shmstats_t* self, struct shmstats_data* data)
+{
+    for (int retry = 0; retry < SHMSTATS_SNAPSHOT_RETRIES; retry++) {
+        uint32_t seq = __atomic_load_n(&self->mem->seq, __ATOMIC_ACQUIRE);
+
+        if (seq & 1) {
+            /* writer is active */
+            continue;
+        }
+
+        memcpy(data, self->mem, sizeof(struct shmstats_data));
+        __atomic_thread_fence(__ATOMIC_ACQUIRE);
+
+        if (__atomic_load_n(&self->mem->seq, __ATOMIC_RELAXED) == seq) {
+            return true;
+        }
+    }
+
+    return false;
+}
+
+void shmstats_detach(shmstats_t* self)
+{
+    shmstats_destroy(self);
+}
+
+uint32_t shmstats_percentile(const struct shmstats_data* data, double percentile)
+{
+    uint64_t rank = (uint64_t)((percentile / 100.0) * data->messages);
+    uint64_t count = 0;
+
+    for (uint32_t bucket = 0; bucket < SHMSTATS_HIST_BUCKETS; bucket++) {
+        count += data->hist[bucket];
+        if (count > rank) {
+            return bucket;
+        }
+    }
+
+    return SHMSTATS_HIST_BUCKETS - 1;
+}
@@ -0,0 +1,48 @@
+#pragma once
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#define SHMSTATS_PREFIX         "mq-perf-stats."    /* segments are named /mq-perf-stats.<pid> */
+#define SHMSTATS_MAGIC          0x6d717073          /* 'mqps' */
+#define SHMSTATS_VERSION        2
+#define SHMSTATS_HIST_BUCKETS   1024                /* 1 us per bucket, last bucket collects the overflow */
+#define SHMSTATS_IPC_LEN        16
+
+/**
+ * layout of the shared memory segment, written by exactly one receiver
+ * and read by any number of monitors. consistency is guaranteed by a
+ * seqlock: the writer makes seq odd while updating, readers retry on
+ * an odd or changed sequence.
+ */
+struct shmstats_data {
+    uint32_t magic;
+    uint32_t version;
+    int32_t pid;
+    char ipc[SHMSTATS_IPC_LEN];
+    uint32_t seq;
+    uint64_t start_ns;                      /* CLOCK_REALTIME at creation   */
+    uint64_t update_ns;                     /* CLOCK_REALTIME capture stamp of the last message or timeout */
+    uint64_t messages;
+    uint64_t timeouts;
+    int64_t min_ns;
+    int64_t max_ns;
+    int64_t sum_ns;
+    uint64_t hist[SHMSTATS_HIST_BUCKETS];
+};
+
+typedef struct _shmstats shmstats_t;
+
+/* writer side (receiver) */
+shmstats_t* shmstats_new(char const* ipc);
+void shmstats_add(shmstats_t* self, int64_t latency_ns, int64_t capture_ns);
+void shmstats_timeout(shmstats_t* self);
+void shmstats_destroy(shmstats_t* self);
+
+/* reader side (monitor) */
+shmstats_t* shmstats_attach(char const* name);
+bool shmstats_snapshot(shmstats_t* self, struct shmstats_data* data);
+void shmstats_detach(shmstats_t* self);
+
+/* helpers working on a snapshot */
+uint32_t shmstats_percentile(const struct shmstats_data* data, double percentile);
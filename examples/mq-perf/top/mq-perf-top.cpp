@@ -0,0 +1,251 @@
+/**
+ * build with g++ -g -O2 -I../shmstats -o mq-perf-top mq-perf-top.cpp ../shmstats/shmstats.cpp -lrt
+ */
+
+/* local includes */
+#include "shmstats.h"
+
+/* global includes */
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <csignal>
+#include <cerrno>
+#include <ctime>
+#include <getopt.h>
+#include <dirent.h>
+#include <unistd.h>
+#include <string>
+#include <map>
+
+#define SHMEM_DIR               "/dev/shm"
+#define PROGRAM                 "mq-perf-top"
+#define PROGRAMVERSION          "0.0.1"
+
+struct Receiver {
+    shmstats_t* stats = nullptr;
+    struct shmstats_data last;
+    uint64_t lastReadNs = 0;
+    bool valid = false;
+};
+
+static volatile sig_atomic_t running = 1;
+static int optInterval = 1000;      /* refresh every second         */
+static int optCount = 0;            /* 0 = run until interrupted    */
+static std::map<std::string, Receiver> receivers;
+
+/**
+ * display version
+ */
+void display_version (void)
+{
+    printf(PROGRAM " " PROGRAMVERSION "\n"
+           "\n"
+           "\n"
+           PROGRAM " comes with NO WARRANTY\n"
+           "to the extent permitted by law.\n"
+           "\n");
+
+    exit(0);
+}
+
+/**
+ * display help
+ */
+void display_help (void)
+{
+    printf("Usage: " PROGRAM " [OPTIONS]\n"
+           "live view of all mq-perf-recv instances started with --stats\n"
+           "\n"
+           "example: " PROGRAM " --interval=500\n"
+           "\n"
+           "  --help                              Show this menu\n"
+           "  --version                           Show version of this application\n"
+           "  -i, --interval                      Refresh interval in milli seconds\n"
+           "  -n, --count                         Number of refreshes (0 = until interrupted)\n");
+    exit(-1);
+}
+
+/**
+ *
+ */
+void process_options(int argc, char *argv[])
+{
+    int error = 0;
+
+    for (;;) {
+        int option_index = 0;
+        static const char *short_options = "i:n:";
+
+        static const struct option long_options[] = {
+                { "help",          no_argument,       0,  0  },
+                { "version",       no_argument,       0,  0  },
+                { "interval",      required_argument, 0, 'i' },
+                { "count",         required_argument, 0, 'n' },
+                { 0,               0,                 0,  0  },
+        };
+
+        int c = getopt_long(argc, argv, short_options,
+                            long_options, &option_index);
+        /* detect the end of the options. */
+        if (c == -1) {
+            break;
+        }
+
+        switch (c) {
+            case 0:
+                switch (option_index) {
+                    case 0:
+                        display_help();
+                        break;
+                    case 1:
+                        display_version();
+                        break;
+                }
+                break;
+            case 'i':
+                optInterval = atoi(optarg);
+                break;
+            case 'n':
+                optCount = atoi(optarg);
+                break;
+            case '?':
+                error = 1;
+                break;
+        }
+    }
+
+    if (((argc - optind) != 0) || (optInterval <= 0)) {
+        error = 1;
+    }
+
+    if (error) {
+        display_help();
+    }
+}
+
+static void signal_handler(int signum)
+{
+    (void)signum;
+    running = 0;
+}
+
+static uint64_t now_ns(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+
+    return (uint64_t)ts.tv_sec * 1000000000ull + ts.tv_nsec;
+}
+
+/**
+ * attach to new segments and forget the ones which are gone
+ */
+static void scan_receivers()
+{
+    DIR* dir = opendir(SHMEM_DIR);
+    struct dirent* entry;
+
+    if (dir == nullptr) {
+        perror("opendir() failed");
+        return;
+    }
+
+    while ((entry = readdir(dir)) != nullptr) {
+        if (strncmp(entry->d_name, SHMSTATS_PREFIX, strlen(SHMSTATS_PREFIX)) != 0) {
+            continue;
+        }
+
+        std::string name = std::string("/") + entry->d_name;
+        if (receivers.find(name) == receivers.end()) {
+            shmstats_t* stats = shmstats_attach(name.c_str());
+            if (stats) {
+                receivers[name].stats = stats;
+            }
+        }
+    }
+
+    closedir(dir);
+
+    for (auto it = receivers.begin(); it != receivers.end(); ) {
+        struct shmstats_data data;
+
+        /* receiver is gone if the segment is unlinked or the process died */
+        if ((access((std::string(SHMEM_DIR) + it->first).c_str(), F_OK) != 0) ||
+            (shmstats_snapshot(it->second.stats, &data) && (kill(data.pid, 0) == -1) && (errno == ESRCH))) {
+            shmstats_detach(it->second.stats);
+            it = receivers.erase(it);
+        }
+        else {
+            ++it;
+        }
+    }
+}
+
+static void render()
+{
+    static struct shmstats_data data;
+
+    printf("\033[H\033[2J");
+    printf(PROGRAM " - %zu receiver(s), refresh %d ms\n\n", receivers.size(), optInterval);
+    printf("%8s %-6s %12s %10s %8s %9s %9s %7s %7s %7s %7s %9s\n",
+           "pid", "ipc", "messages", "msg/s", "timeouts", "min us", "avg us",
+           "p50", "p99", "p99.9", "p99.99", "max us");
+
+    for (auto& entry : receivers) {
+        Receiver& receiver = entry.second;
+        uint64_t readNs = now_ns();
+
+        if (!shmstats_snapshot(receiver.stats, &data)) {
+            printf("%8s %s\n", "?", "inconsistent snapshot, writer too busy");
+            continue;
+        }
+
+        double rate = 0.0;
+        if (receiver.valid && (readNs > receiver.lastReadNs)) {
+            rate = (double)(data.messages - receiver.last.messages) * 1e9 / (readNs - receiver.lastReadNs);
+        }
+
+        if (data.messages > 0) {
+            printf("%8d %-6s %12lu %10.0f %8lu %9.3f %9.3f %7u %7u %7u %7u %9.3f\n",
+                   data.pid, data.ipc, (unsigned long)data.messages, rate, (unsigned long)data.timeouts,
+                   data.min_ns / 1000.0, (double)data.sum_ns / data.messages / 1000.0,
+                   shmstats_percentile(&data, 50.0), shmstats_percentile(&data, 99.0),
+                   shmstats_percentile(&data, 99.9), shmstats_percentile(&data, 99.99),
+                   data.max_ns / 1000.0);
+        }
+        else {
+            printf("%8d %-6s %12lu %10.0f %8lu\n", data.pid, data.ipc, 0ul, rate, (unsigned long)data.timeouts);
+        }
+
+        receiver.last = data;
+        receiver.lastReadNs = readNs;
+        receiver.valid = true;
+    }
+
+    fflush(stdout);
+}
+
+int main(int argc, char **argv)
+{
+    /* parse given cmd line args */
+    process_options(argc, argv);
+
+    signal(SIGINT, signal_handler);
+    signal(SIGTERM, signal_handler);
+
+    for (int cnt = 0; running && ((optCount == 0) || (cnt < optCount)); cnt++) {
+        scan_receivers();
+        render();
+        usleep(optInterval * 1000);
+    }
+
+    for (auto& entry : receivers) {
+        shmstats_detach(entry.second.stats);
+    }
+
+    receivers.clear();
+
+    return 0;
+}
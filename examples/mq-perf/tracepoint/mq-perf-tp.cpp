@@ -0,0 +1,7 @@
+/**
+ * LTTng UST trace point provider of mq-perf
+ */
+#define TRACEPOINT_CREATE_PROBES
+#define TRACEPOINT_DEFINE
+
+#include "mq-perf-tp.h"
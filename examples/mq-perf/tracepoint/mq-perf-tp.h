@@ -0,0 +1,90 @@
+/**
+ * the mq-perf tracepoint provider header file, build with make LTTNG_UST=1.
+ * without HAVE_LTTNG_UST the tracepoint() calls compile to nothing.
+ */
+#ifdef HAVE_LTTNG_UST
+
+#undef TRACEPOINT_PROVIDER
+#define TRACEPOINT_PROVIDER mq_perf
+
+#undef TRACEPOINT_INCLUDE
+#define TRACEPOINT_INCLUDE "./mq-perf-tp.h"
+
+#if !defined(_MQ_PERF_TP_H) || defined(TRACEPOINT_HEADER_MULTI_READ)
+#define _MQ_PERF_TP_H
+
+#include <lttng/tracepoint.h>
+#include <stdint.h>
+
+/* xmit: the send call returned */
+TRACEPOINT_EVENT(
+    mq_perf,
+    message_sent,
+    TP_ARGS(
+        uint32_t, seq,
+        int64_t, timestamp,
+        int, size,
+        int, ret
+    ),
+    TP_FIELDS(
+        ctf_integer(uint32_t, seq, seq)
+        ctf_integer(int64_t, timestamp, timestamp)
+        ctf_integer(int, size, size)
+        ctf_integer(int, ret, ret)
+    )
+)
+
+/* xmit: the queue did not take the message */
+TRACEPOINT_EVENT(
+    mq_perf,
+    queue_full,
+    TP_ARGS(
+        uint32_t, seq,
+        int, error
+    ),
+    TP_FIELDS(
+        ctf_integer(uint32_t, seq, seq)
+        ctf_integer(int, error, error)
+    )
+)
+
+/* recv: the blocking receive call returned */
+TRACEPOINT_EVENT(
+    mq_perf,
+    recv_wakeup,
+    TP_ARGS(
+        int, len
+    ),
+    TP_FIELDS(
+        ctf_integer(int, len, len)
+    )
+)
+
+/* recv: message accounted, latency against the xmit timestamp */
+TRACEPOINT_EVENT(
+    mq_perf,
+    message_received,
+    TP_ARGS(
+        uint32_t, seq,
+        int64_t, latency_ns
+    ),
+    TP_FIELDS(
+        ctf_integer(uint32_t, seq, seq)
+        ctf_integer(int64_t, latency_ns, latency_ns)
+    )
+)
+
+#endif /* _MQ_PERF_TP_H */
+
+#include <lttng/tracepoint-event.h>
+
+#else /* HAVE_LTTNG_UST */
+
+#ifndef _MQ_PERF_TP_H
+#define _MQ_PERF_TP_H
+
+#define tracepoint(provider, name, ...) do { } while (0)
+
+#endif /* _MQ_PERF_TP_H */
+
+#endif /* HAVE_LTTNG_UST */
@@ -0,0 +1,41 @@
+#pragma once
+
+/**
+ * USDT probes of mq-perf with is-enabled semaphores.
+ *
+ * a tracer (perf, bpftrace, systemtap, lttng --userspace-probe) increments the
+ * semaphore when it attaches, so argument marshalling guarded by
+ * MQ_PERF_USDT_ENABLED() costs one load and a not taken branch otherwise.
+ * each semaphore must be defined once per binary with MQ_PERF_USDT_SEMAPHORE().
+ * _SDT_HAS_SEMAPHORES makes every probe reference its semaphore, so a probe
+ * which is never guarded still needs one, it is just never tested.
+ *
+ * example: bpftrace -e 'usdt:./recv/mq-perf-recv:mq_perf:receive { @[arg1 / 1000] = count(); }'
+ */
+#ifdef HAVE_SDT
+
+#define _SDT_HAS_SEMAPHORES 1
+#include <sys/sdt.h>
+
+#define MQ_PERF_USDT_SEMAPHORE(name) \
+    extern "C" { unsigned short mq_perf_##name##_semaphore __attribute__((unused, section(".probes"))); }
+#define MQ_PERF_USDT_DECLARE(name) \
+    extern "C" { extern unsigned short mq_perf_##name##_semaphore; }
+#define MQ_PERF_USDT_ENABLED(name) \
+    __builtin_expect(*(volatile unsigned short*)&mq_perf_##name##_semaphore != 0, 0)
+
+#define MQ_PERF_USDT1(name, a1)                 STAP_PROBE1(mq_perf, name, a1)
+#define MQ_PERF_USDT2(name, a1, a2)             STAP_PROBE2(mq_perf, name, a1, a2)
+#define MQ_PERF_USDT3(name, a1, a2, a3)         STAP_PROBE3(mq_perf, name, a1, a2, a3)
+
+#else /* HAVE_SDT */
+
+#define MQ_PERF_USDT_SEMAPHORE(name)
+#define MQ_PERF_USDT_DECLARE(name)
+#define MQ_PERF_USDT_ENABLED(name)              (0)
+
+#define MQ_PERF_USDT1(name, a1)                 do { } while (0)
+#define MQ_PERF_USDT2(name, a1, a2)             do { } while (0)
+#define MQ_PERF_USDT3(name, a1, a2, a3)         do { } while (0)
+
+#endif /* HAVE_SDT */
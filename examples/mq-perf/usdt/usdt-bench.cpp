@@ -0,0 +1,113 @@
+/**
+ * cost of the mq-perf USDT probes while no tracer is attached
+ * build with make, run detached and then again with a tracer attached e.g.
+ * bpftrace -e 'usdt:./usdt-bench:mq_perf:bench_guarded { @ = count(); }'
+ *
+ * usage: usdt-bench [iterations] (default 10000000)
+ */
+
+#include "mq-perf-usdt.h"
+
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <ctime>
+#include <algorithm>
+
+#define BENCH_RUNS      7
+
+MQ_PERF_USDT_SEMAPHORE(bench_guarded)
+/* referenced by the probe note only, never tested */
+MQ_PERF_USDT_SEMAPHORE(bench_unguarded)
+
+static int64_t sink[1024];
+
+static inline int64_t now_ns(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+
+    return (int64_t)ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+/* stands in for argument marshalling, e.g. computing the latency */
+static inline int64_t marshal(uint64_t cnt)
+{
+    return now_ns() - (int64_t)cnt;
+}
+
+/**
+ * per message work of the receiver: take a timestamp and store a latency
+ */
+template <int Variant>
+static double run(uint64_t iterations)
+{
+    const int64_t start = now_ns();
+
+    for (uint64_t cnt = 0; cnt < iterations; cnt++) {
+        const int64_t latency = now_ns() - start;
+        sink[cnt & 1023] = latency;
+
+        if (Variant == 1) {
+            /* guarded, arguments only computed when a tracer is attached */
+            if (MQ_PERF_USDT_ENABLED(bench_guarded)) {
+                MQ_PERF_USDT2(bench_guarded, cnt, marshal(cnt));
+            }
+        }
+        else if (Variant == 2) {
+            /* unguarded, arguments are always computed */
+            MQ_PERF_USDT2(bench_unguarded, cnt, marshal(cnt));
+        }
+    }
+
+    return (double)(now_ns() - start) / iterations;
+}
+
+template <int Variant>
+static void measure(const char* label, uint64_t iterations, double baselineMin, double noise, double* minOut, double* noiseOut)
+{
+    double results[BENCH_RUNS];
+
+    for (int cnt = 0; cnt < BENCH_RUNS; cnt++) {
+        results[cnt] = run<Variant>(iterations);
+    }
+
+    std::sort(results, results + BENCH_RUNS);
+
+    const double min = results[0];
+    const double median = results[BENCH_RUNS / 2];
+    const double delta = min - baselineMin;
+
+    printf("%-22s %10.2f %10.2f %10.2f  %s\n", label, min, median, Variant == 0 ? 0.0 : delta,
+           Variant == 0 ? "" : (delta < noise ? "below noise" : "measurable"));
+
+    if (minOut) {
+        *minOut = min;
+    }
+    if (noiseOut) {
+        *noiseOut = median - min;
+    }
+}
+
+int main(int argc, char **argv)
+{
+    uint64_t iterations = argc > 1 ? strtoull(argv[1], nullptr, 0) : 10000000;
+    double baselineMin = 0.0;
+    double noise = 0.0;
+
+#ifndef HAVE_SDT
+    printf("built without sys/sdt.h, probes compile to nothing\n");
+#endif
+
+    /* warm up caches and the vDSO */
+    run<0>(iterations / 10);
+
+    printf("%-22s %10s %10s %10s\n", "variant", "min ns", "median ns", "delta ns");
+    measure<0>("no probe", iterations, 0.0, 0.0, &baselineMin, &noise);
+    measure<1>("guarded probe", iterations, baselineMin, noise, nullptr, nullptr);
+    measure<2>("unguarded probe", iterations, baselineMin, noise, nullptr, nullptr);
+    printf("noise (median - min of baseline) : %.2f ns\n", noise);
+
+    return 0;
+}
@@ -0,0 +1,357 @@
+#pragma once
+
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <string>
+#include <vector>
+#include <map>
+#include <unordered_map>
+#include <algorithm>
+
+#define LATENCY_BUCKETS     64      /* bucket n holds [2^(n-1), 2^n) ns */
+
+/**
+ * log2 histogram of durations in ns, constant memory whatever the trace size
+ */
+class LatencyHistogram
+{
+    public:
+        inline void add(uint64_t ns)
+        {
+            m_counts[ns ? std::min(64 - __builtin_clzll(ns), LATENCY_BUCKETS - 1) : 0]++;
+            m_count++;
+            m_sum += ns;
+            m_min = std::min(m_min, ns);
+            m_max = std::max(m_max, ns);
+        }
+
+        uint64_t count() const
+        {
+            return m_count;
+        }
+
+        uint64_t sum() const
+        {
+            return m_sum;
+        }
+
+        /**
+         * upper bound of the bucket holding the percentile, at most the maximum
+         */
+        uint64_t percentile(double percent) const
+        {
+            const uint64_t rank = (uint64_t)(m_count * percent / 100.0);
+            uint64_t seen = 0;
+
+            for (int bucket = 0; bucket < LATENCY_BUCKETS; bucket++) {
+                seen += m_counts[bucket];
+                if (seen > rank) {
+                    return std::min(bucket ? ((uint64_t)1 << bucket) - 1 : 0, m_max);
+                }
+            }
+
+            return m_max;
+        }
+
+        void dump(FILE* file, const char* title) const
+        {
+            char min[24], avg[24], p50[24], p99[24], max[24];
+
+            if (m_count == 0) {
+                fprintf(file, "  %-22s none\n", title);
+                return;
+            }
+
+            fprintf(file, "  %-22s count %lu min %s avg %s p50 %s p99 %s max %s\n", title, (unsigned long)m_count,
+                    format(min, m_min), format(avg, m_sum / m_count), format(p50, percentile(50)), format(p99, percentile(99)),
+                    format(max, m_max));
+
+            const uint64_t peak = *std::max_element(m_counts, m_counts + LATENCY_BUCKETS);
+            for (int bucket = 0; bucket < LATENCY_BUCKETS; bucket++) {
+                if (m_counts[bucket] == 0) {
+                    continue;
+                }
+
+                char lo[24], hi[24], bar[41];
+                const int width = (int)(40 * m_counts[bucket] / peak);
+
+                memset(bar, '@', width);
+                bar[width] = '\0';
+                fprintf(file, "    [%6s, %6s) %10lu |%-40s|\n", format(lo, bucket ? (uint64_t)1 << (bucket - 1) : 0),
+                        format(hi, (uint64_t)1 << bucket), (unsigned long)m_counts[bucket], bar);
+            }
+        }
+
+        static const char* format(char* buffer, uint64_t ns)
+        {
+            if (ns < 10000) {
+                snprintf(buffer, 24, "%luns", (unsigned long)ns);
+            }
+            else if (ns < 10000000) {
+                snprintf(buffer, 24, "%luus", (unsigned long)(ns / 1000));
+            }
+            else {
+                snprintf(buffer, 24, "%lums", (unsigned long)(ns / 1000000));
+            }
+
+            return buffer;
+        }
+
+    private:
+        uint64_t m_counts[LATENCY_BUCKETS] = {};
+        uint64_t m_count = 0;
+        uint64_t m_sum = 0;
+        uint64_t m_min = UINT64_MAX;
+        uint64_t m_max = 0;
+};
+
+/**
+ * Scheduler view of the receive threads from the kernel events of a trace:
+ *   - wakeup latency: sched_waking of the thread until sched_switch to it
+ *   - preemptions: switched out while runnable, by whom and for how long
+ *   - interrupts: hard and soft irqs executed while the thread was on cpu
+ * Threads are matched by their name (comm) so the names set with
+ * pthread_setname_np() select them. Events are fed in time order, one pass.
+ */
+class WakeupLatency
+{
+    public:
+        WakeupLatency(const std::vector<std::string>& names)
+            : m_names(names)
+        {
+        }
+
+        virtual ~WakeupLatency()
+        {
+        }
+
+        inline void waking(uint64_t ts, int64_t tid, const char* comm)
+        {
+            Task* task = getTask(tid, comm);
+
+            /* a wakeup of a runnable thread changes nothing, keep the first one */
+            if ((task != nullptr) && !task->running && !task->waking && !task->preempted) {
+                task->waking = ts;
+            }
+        }
+
+        inline void switchTask(uint64_t ts, uint32_t cpu, int64_t prevTid, const char* prevComm, int64_t prevState,
+                               int64_t nextTid, const char* nextComm)
+        {
+            Cpu& current = getCpu(cpu);
+            Task* prev = getTask(prevTid, prevComm);
+            Task* next = getTask(nextTid, nextComm);
+
+            if (prev != nullptr) {
+                prev->running = false;
+                /* no sleep state bit: switched out while runnable (preempted or yielded) */
+                if ((prevState & 0x7f) == 0) {
+                    prev->preempted = ts;
+                    prev->preempter = nextComm;
+                    prev->group->preemptions++;
+                }
+            }
+
+            if (next != nullptr) {
+                next->running = true;
+                if (next->waking) {
+                    next->group->wakeup.add(ts - next->waking);
+                    next->waking = 0;
+                }
+                if (next->preempted) {
+                    Source& source = next->group->preempters[next->preempter];
+                    source.count++;
+                    source.ns += ts - next->preempted;
+                    next->group->preempted.add(ts - next->preempted);
+                    next->preempted = 0;
+                }
+            }
+
+            current.group = next ? next->group : nullptr;
+        }
+
+        inline void irqEntry(uint64_t ts, uint32_t cpu, const char* name)
+        {
+            Cpu& current = getCpu(cpu);
+
+            current.irqStart = current.group ? ts : 0;
+            if (current.irqStart) {
+                current.irqName = name;
+            }
+        }
+
+        inline void irqExit(uint64_t ts, uint32_t cpu)
+        {
+            Cpu& current = getCpu(cpu);
+
+            if (current.irqStart && current.group) {
+                interrupted(current.group, current.irqName, ts - current.irqStart);
+                /* not part of the softirq it interrupted */
+                current.softirqNested += ts - current.irqStart;
+            }
+            current.irqStart = 0;
+        }
+
+        inline void softirqEntry(uint64_t ts, uint32_t cpu, uint32_t vec)
+        {
+            Cpu& current = getCpu(cpu);
+
+            current.softirqStart = current.group ? ts : 0;
+            current.softirqVec = vec;
+            current.softirqNested = 0;
+        }
+
+        inline void softirqExit(uint64_t ts, uint32_t cpu)
+        {
+            static const char* const names[] = {
+                "softirq:HI", "softirq:TIMER", "softirq:NET_TX", "softirq:NET_RX", "softirq:BLOCK",
+                "softirq:IRQ_POLL", "softirq:TASKLET", "softirq:SCHED", "softirq:HRTIMER", "softirq:RCU"
+            };
+            Cpu& current = getCpu(cpu);
+
+            if (current.softirqStart && current.group) {
+                const uint64_t duration = ts - current.softirqStart;
+                interrupted(current.group, current.softirqVec < 10 ? names[current.softirqVec] : "softirq:?",
+                            duration > current.softirqNested ? duration - current.softirqNested : 0);
+            }
+            current.softirqStart = 0;
+        }
+
+        void discarded(uint64_t count)
+        {
+            m_discarded += count;
+        }
+
+        void dump(FILE* file, size_t top) const
+        {
+            if (m_groups.empty()) {
+                fprintf(file, "no thread named");
+                for (const auto& name : m_names) {
+                    fprintf(file, " %s", name.c_str());
+                }
+                fprintf(file, " in the trace (sched_switch and sched_waking enabled?)\n");
+            }
+            if (m_discarded) {
+                fprintf(file, "warning: %lu events discarded by the tracer, the results are incomplete\n", (unsigned long)m_discarded);
+            }
+
+            for (const auto& entry : m_groups) {
+                const Group& group = entry.second;
+                char total[24];
+
+                fprintf(file, "%s: %zu threads, %lu preemptions, %lu interrupts for %s\n", entry.first.c_str(), group.tids.size(),
+                        (unsigned long)group.preemptions, (unsigned long)group.interrupts.count(),
+                        LatencyHistogram::format(total, group.interrupts.sum()));
+                group.wakeup.dump(file, "wakeup latency");
+                group.preempted.dump(file, "preempted, runnable");
+                dumpSources(file, group.preempters, "preempted by", top);
+                group.interrupts.dump(file, "interrupts");
+                dumpSources(file, group.interruptSources, "interrupted by", top);
+            }
+        }
+
+    private:
+        struct Source
+        {
+            uint64_t count = 0;
+            uint64_t ns = 0;
+        };
+
+        struct Group
+        {
+            std::vector<int64_t> tids;
+            LatencyHistogram wakeup;
+            LatencyHistogram preempted;
+            LatencyHistogram interrupts;
+            std::map<std::string, Source> preempters;
+            std::map<std::string, Source> interruptSources;
+            uint64_t preemptions = 0;
+        };
+
+        struct Task
+        {
+            std::string comm;
+            Group* group = nullptr;     /* not a thread of interest */
+            bool running = false;
+            uint64_t waking = 0;
+            uint64_t preempted = 0;
+            std::string preempter;
+        };
+
+        struct Cpu
+        {
+            Group* group = nullptr;     /* of the thread of interest running on the cpu */
+            uint64_t irqStart = 0;
+            std::string irqName;
+            uint64_t softirqStart = 0;
+            uint64_t softirqNested = 0; /* hard irq time within the softirq */
+            uint32_t softirqVec = 0;
+        };
+
+        /**
+         * the thread of interest with the tid, nullptr otherwise. The name is
+         * checked on every event, threads are named after their creation.
+         */
+        inline Task* getTask(int64_t tid, const char* comm)
+        {
+            auto it = m_tasks.find(tid);
+
+            if ((it == m_tasks.end()) || (it->second.comm != comm)) {
+                Task& task = m_tasks[tid];
+
+                task = Task();
+                task.comm = comm;
+                if (std::find(m_names.begin(), m_names.end(), task.comm) != m_names.end()) {
+                    task.group = &m_groups[task.comm];
+                    task.group->tids.push_back(tid);
+                }
+
+                return task.group ? &task : nullptr;
+            }
+
+            return it->second.group ? &it->second : nullptr;
+        }
+
+        inline Cpu& getCpu(uint32_t cpu)
+        {
+            if (cpu >= m_cpus.size()) {
+                m_cpus.resize(cpu + 1);
+            }
+
+            return m_cpus[cpu];
+        }
+
+        void interrupted(Group* group, const std::string& name, uint64_t ns)
+        {
+            Source& source = group->interruptSources[name];
+
+            source.count++;
+            source.ns += ns;
+            group->interrupts.add(ns);
+        }
+
+        static void dumpSources(FILE* file, const std::map<std::string, Source>& sources, const char* title, size_t top)
+        {
+            std::vector<std::pair<std::string, Source>> order(sources.begin(), sources.end());
+
+            std::sort(order.begin(), order.end(), [](const std::pair<std::string, Source>& a, const std::pair<std::string, Source>& b) {
+                return a.second.ns > b.second.ns;
+            });
+
+            for (size_t cnt = 0; (cnt < order.size()) && (cnt < top); cnt++) {
+                char total[24], avg[24];
+
+                fprintf(file, "    %-20s %-18s %10lu times %8s total %8s avg\n", cnt ? "" : title, order[cnt].first.c_str(),
+                        (unsigned long)order[cnt].second.count, LatencyHistogram::format(total, order[cnt].second.ns),
+                        LatencyHistogram::format(avg, order[cnt].second.ns / order[cnt].second.count));
+            }
+        }
+
+    private:
+        const std::vector<std::string> m_names;
+        std::map<std::string, Group> m_groups;
+        std::unordered_map<int64_t, Task> m_tasks;
+        std::vector<Cpu> m_cpus;
+        uint64_t m_discarded = 0;
+};
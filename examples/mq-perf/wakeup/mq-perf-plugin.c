@@ -0,0 +1,17 @@
+/**
+ * babeltrace2 plugin of mq-perf, the registration macros are C only
+ *
+ * usage: babeltrace2 --plugin-path=wakeup <trace> -c sink.mqperf.wakeup
+ */
+#include "wakeup-sink.h"
+
+BT_PLUGIN_MODULE();
+
+BT_PLUGIN(mqperf);
+BT_PLUGIN_DESCRIPTION("mq-perf trace analyses");
+
+BT_PLUGIN_SINK_COMPONENT_CLASS(wakeup, wakeup_consume);
+BT_PLUGIN_SINK_COMPONENT_CLASS_DESCRIPTION(wakeup, "Wakeup latency, preemptions and interrupts of the mq-perf receive threads");
+BT_PLUGIN_SINK_COMPONENT_CLASS_INITIALIZE_METHOD(wakeup, wakeup_initialize);
+BT_PLUGIN_SINK_COMPONENT_CLASS_GRAPH_IS_CONFIGURED_METHOD(wakeup, wakeup_graph_is_configured);
+BT_PLUGIN_SINK_COMPONENT_CLASS_FINALIZE_METHOD(wakeup, wakeup_finalize);
@@ -0,0 +1,282 @@
+/**
+ * sink.mqperf.wakeup: scheduler latency of the mq-perf receive threads
+ *
+ * needs the kernel events sched_waking, sched_switch, irq_handler_* and
+ * irq_softirq_* (scripts/mq-perf-lttng-start.sh enables them).
+ *
+ * params:  threads="mq_recv,uds_recv,shmem_recv,epoll_recv,null_recv"   thread names to follow
+ *          output="wakeup.txt"                                          report file (default stdout)
+ *          top=10                                                       preempting tasks and irqs listed
+ */
+#include "wakeup-sink.h"
+#include "WakeupLatency.h"
+
+#include <cstdio>
+#include <cstring>
+#include <string>
+#include <vector>
+#include <unordered_map>
+
+#define WAKEUP_DEFAULT_THREADS  "mq_recv,uds_recv,shmem_recv,epoll_recv,null_recv"
+#define WAKEUP_DEFAULT_TOP      10
+
+enum EventKind
+{
+    EVENT_OTHER,
+    EVENT_WAKING,
+    EVENT_SWITCH,
+    EVENT_IRQ_ENTRY,
+    EVENT_IRQ_EXIT,
+    EVENT_SOFTIRQ_ENTRY,
+    EVENT_SOFTIRQ_EXIT
+};
+
+struct WakeupSink
+{
+    WakeupLatency analysis;
+    FILE* output;
+    size_t top;
+    bt_message_iterator* iterator;
+    std::unordered_map<const bt_event_class*, EventKind> kinds;    /* saves the name compare per event */
+};
+
+static WakeupSink* wakeup_sink(bt_self_component_sink* self)
+{
+    return (WakeupSink*)bt_self_component_get_data(bt_self_component_sink_as_self_component(self));
+}
+
+static const char* param_string(const bt_value* params, const char* name, const char* fallback)
+{
+    const bt_value* value = bt_value_map_borrow_entry_value_const(params, name);
+
+    return (value && bt_value_is_string(value)) ? bt_value_string_get(value) : fallback;
+}
+
+static uint64_t param_unsigned(const bt_value* params, const char* name, uint64_t fallback)
+{
+    const bt_value* value = bt_value_map_borrow_entry_value_const(params, name);
+
+    if (value && bt_value_is_unsigned_integer(value)) {
+        return bt_value_integer_unsigned_get(value);
+    }
+    if (value && bt_value_is_signed_integer(value) && (bt_value_integer_signed_get(value) >= 0)) {
+        return (uint64_t)bt_value_integer_signed_get(value);
+    }
+
+    return fallback;
+}
+
+static const bt_field* member(const bt_field* structure, const char* name)
+{
+    return structure ? bt_field_structure_borrow_member_field_by_name_const(structure, name) : NULL;
+}
+
+/**
+ * integer of either signedness, lttng-modules versions differ (prev_state is an enumeration in newer ones)
+ */
+static int64_t member_integer(const bt_field* structure, const char* name)
+{
+    const bt_field* field = member(structure, name);
+
+    if (field == NULL) {
+        return 0;
+    }
+    if (bt_field_class_type_is(bt_field_get_class_type(field), BT_FIELD_CLASS_TYPE_SIGNED_INTEGER)) {
+        return bt_field_integer_signed_get_value(field);
+    }
+
+    return (int64_t)bt_field_integer_unsigned_get_value(field);
+}
+
+static const char* member_string(const bt_field* structure, const char* name)
+{
+    const bt_field* field = member(structure, name);
+
+    return field ? bt_field_string_get_value(field) : "";
+}
+
+static EventKind event_kind(WakeupSink* sink, const bt_event_class* eventClass)
+{
+    auto it = sink->kinds.find(eventClass);
+
+    if (it == sink->kinds.end()) {
+        const char* name = bt_event_class_get_name(eventClass);
+        EventKind kind = EVENT_OTHER;
+
+        if (name == NULL) {
+            kind = EVENT_OTHER;
+        }
+        else if (strcmp(name, "sched_waking") == 0) {
+            kind = EVENT_WAKING;
+        }
+        else if (strcmp(name, "sched_switch") == 0) {
+            kind = EVENT_SWITCH;
+        }
+        else if (strcmp(name, "irq_handler_entry") == 0) {
+            kind = EVENT_IRQ_ENTRY;
+        }
+        else if (strcmp(name, "irq_handler_exit") == 0) {
+            kind = EVENT_IRQ_EXIT;
+        }
+        else if (strcmp(name, "irq_softirq_entry") == 0) {
+            kind = EVENT_SOFTIRQ_ENTRY;
+        }
+        else if (strcmp(name, "irq_softirq_exit") == 0) {
+            kind = EVENT_SOFTIRQ_EXIT;
+        }
+
+        it = sink->kinds.emplace(eventClass, kind).first;
+    }
+
+    return it->second;
+}
+
+static void wakeup_event(WakeupSink* sink, const bt_message* message)
+{
+    const bt_event* event = bt_message_event_borrow_event_const(message);
+    const EventKind kind = event_kind(sink, bt_event_borrow_class_const(event));
+
+    if (kind == EVENT_OTHER) {
+        return;
+    }
+
+    const bt_field* payload = bt_event_borrow_payload_field_const(event);
+    const bt_packet* packet = bt_event_borrow_packet_const(event);
+    const uint32_t cpu = packet ? (uint32_t)member_integer(bt_packet_borrow_context_field_const(packet), "cpu_id") : 0;
+    int64_t ns = 0;
+
+    bt_clock_snapshot_get_ns_from_origin(bt_message_event_borrow_default_clock_snapshot_const(message), &ns);
+
+    switch (kind) {
+        case EVENT_WAKING:
+            sink->analysis.waking(ns, member_integer(payload, "tid"), member_string(payload, "comm"));
+            break;
+        case EVENT_SWITCH:
+            sink->analysis.switchTask(ns, cpu, member_integer(payload, "prev_tid"), member_string(payload, "prev_comm"),
+                                      member_integer(payload, "prev_state"), member_integer(payload, "next_tid"),
+                                      member_string(payload, "next_comm"));
+            break;
+        case EVENT_IRQ_ENTRY:
+            sink->analysis.irqEntry(ns, cpu, member_string(payload, "name"));
+            break;
+        case EVENT_IRQ_EXIT:
+            sink->analysis.irqExit(ns, cpu);
+            break;
+        case EVENT_SOFTIRQ_ENTRY:
+            sink->analysis.softirqEntry(ns, cpu, (uint32_t)member_integer(payload, "vec"));
+            break;
+        case EVENT_SOFTIRQ_EXIT:
+            sink->analysis.softirqExit(ns, cpu);
+            break;
+        default:
+            break;
+    }
+}
+
+bt_component_class_initialize_method_status wakeup_initialize(bt_self_component_sink* self,
+                                                              bt_self_component_sink_configuration* configuration,
+                                                              const bt_value* params, void* data)
+{
+    std::vector<std::string> names;
+    const char* path = param_string(params, "output", NULL);
+    FILE* output = stdout;
+
+    (void)configuration;
+    (void)data;
+
+    std::string threads = param_string(params, "threads", WAKEUP_DEFAULT_THREADS);
+    for (size_t start = 0, end; start <= threads.size(); start = end + 1) {
+        end = threads.find(',', start);
+        if (end == std::string::npos) {
+            end = threads.size();
+        }
+        if (end > start) {
+            names.push_back(threads.substr(start, end - start));
+        }
+    }
+
+    if (bt_self_component_sink_add_input_port(self, "in", NULL, NULL) != BT_SELF_COMPONENT_ADD_PORT_STATUS_OK) {
+        return BT_COMPONENT_CLASS_INITIALIZE_METHOD_STATUS_MEMORY_ERROR;
+    }
+
+    if ((path != NULL) && ((output = fopen(path, "w")) == NULL)) {
+        perror("sink.mqperf.wakeup: fopen() failed");
+        return BT_COMPONENT_CLASS_INITIALIZE_METHOD_STATUS_ERROR;
+    }
+
+    WakeupSink* sink = new WakeupSink{WakeupLatency(names), output, param_unsigned(params, "top", WAKEUP_DEFAULT_TOP), NULL, {}};
+    bt_self_component_set_data(bt_self_component_sink_as_self_component(self), sink);
+
+    return BT_COMPONENT_CLASS_INITIALIZE_METHOD_STATUS_OK;
+}
+
+bt_component_class_sink_graph_is_configured_method_status wakeup_graph_is_configured(bt_self_component_sink* self)
+{
+    WakeupSink* sink = wakeup_sink(self);
+
+    if (bt_message_iterator_create_from_sink_component(self, bt_self_component_sink_borrow_input_port_by_index(self, 0),
+                                                       &sink->iterator) != BT_MESSAGE_ITERATOR_CREATE_FROM_SINK_COMPONENT_STATUS_OK) {
+        return BT_COMPONENT_CLASS_SINK_GRAPH_IS_CONFIGURED_METHOD_STATUS_MEMORY_ERROR;
+    }
+
+    return BT_COMPONENT_CLASS_SINK_GRAPH_IS_CONFIGURED_METHOD_STATUS_OK;
+}
+
+bt_component_class_sink_consume_method_status wakeup_consume(bt_self_component_sink* self)
+{
+    WakeupSink* sink = wakeup_sink(self);
+    bt_message_array_const messages;
+    uint64_t count;
+
+    switch (bt_message_iterator_next(sink->iterator, &messages, &count)) {
+        case BT_MESSAGE_ITERATOR_NEXT_STATUS_OK:
+            break;
+        case BT_MESSAGE_ITERATOR_NEXT_STATUS_END:
+            sink->analysis.dump(sink->output, sink->top);
+            bt_message_iterator_put_ref(sink->iterator);
+            sink->iterator = NULL;
+            return BT_COMPONENT_CLASS_SINK_CONSUME_METHOD_STATUS_END;
+        case BT_MESSAGE_ITERATOR_NEXT_STATUS_AGAIN:
+            return BT_COMPONENT_CLASS_SINK_CONSUME_METHOD_STATUS_AGAIN;
+        case BT_MESSAGE_ITERATOR_NEXT_STATUS_MEMORY_ERROR:
+            return BT_COMPONENT_CLASS_SINK_CONSUME_METHOD_STATUS_MEMORY_ERROR;
+        default:
+            return BT_COMPONENT_CLASS_SINK_CONSUME_METHOD_STATUS_ERROR;
+    }
+
+    for (uint64_t cnt = 0; cnt < count; cnt++) {
+        const bt_message* message = messages[cnt];
+        uint64_t discarded = 0;
+
+        switch (bt_message_get_type(message)) {
+            case BT_MESSAGE_TYPE_EVENT:
+                wakeup_event(sink, message);
+                break;
+            case BT_MESSAGE_TYPE_DISCARDED_EVENTS:
+                if (bt_message_discarded_events_get_count(message, &discarded) == BT_PROPERTY_AVAILABILITY_AVAILABLE) {
+                    sink->analysis.discarded(discarded);
+                }
+                break;
+            default:
+                break;
+        }
+
+        bt_message_put_ref(message);
+    }
+
+    return BT_COMPONENT_CLASS_SINK_CONSUME_METHOD_STATUS_OK;
+}
+
+void wakeup_finalize(bt_self_component_sink* self)
+{
+    WakeupSink* sink = wakeup_sink(self);
+
+    if (sink->iterator != NULL) {
+        bt_message_iterator_put_ref(sink->iterator);
+    }
+    if (sink->output != stdout) {
+        fclose(sink->output);
+    }
+
+    delete sink;
+}
@@ -0,0 +1,21 @@
+#pragma once
+
+/**
+ * sink.mqperf.wakeup component methods, registered by mq-perf-plugin.c
+ */
+#include <babeltrace2/babeltrace.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+bt_component_class_initialize_method_status wakeup_initialize(bt_self_component_sink* self,
+                                                              bt_self_component_sink_configuration* configuration,
+                                                              const bt_value* params, void* data);
+bt_component_class_sink_graph_is_configured_method_status wakeup_graph_is_configured(bt_self_component_sink* self);
+bt_component_class_sink_consume_method_status wakeup_consume(bt_self_component_sink* self);
+void wakeup_finalize(bt_self_component_sink* self);
+
+#ifdef __cplusplus
+}
+#endif
@@ -4,6 +4,11 @@
 
 /* local includes */
 #include "shmemq.h"
+#include "affinity.h"
+#include "perfcounters.h"
+#include "TscClock.h"
+#include "mq-perf-tp.h"
+#include "mq-perf-usdt.h"
 
 /* global includes */
 #include <cstdint>
@@ -25,7 +30,9 @@
 #include <netinet/in.h>
 #include <arpa/inet.h>
 #include <sched.h>
-#include <functional>
+#include <cerrno>
+#include <string>
+#include <vector>
 
 #define SHMEM_NAME              "gugus"
 #define SHMEM_MAX_MESSAGES      100
@@ -37,26 +44,38 @@
 #define MSG_BUFFER_SIZE         MAX_MSG_SIZE + 10
 #define MSG_SEND_SIZE           256                 /* we send 256 bytes */
 #define MSG_HDR_SIZE            (sizeof(int64_t) + sizeof(uint32_t))
+#define CLOCK_SYSTEM            "system"
+#define CLOCK_TSC               "tsc"
+#define MSG_SIZE_MAX_TEXT       "4084"              /* MAX_MSG_SIZE - MSG_HDR_SIZE */
 
 #define MSG_SHMEM_SIZE          512 /* shared mem impl needs a fixed size so we choose 512 bytes */
 
 #define IPC_METHOD_MQ           "mq"
 #define IPC_METHOD_UDS          "uds"
 #define IPC_METHOD_SHMEM        "shmem"
+#define IPC_METHOD_EPOLL        "epoll"             /* --endpoints message queues and as many sockets */
 #define IPC_ENC_RAW             "raw"
+#define IPC_ENC_STAGES          "stages"            /* raw + post send stamp of the previous message */
+#define STAGES_EXT_SIZE         sizeof(int64_t)
 #define PROGRAM 				"mq-perf-xmit"
 #define PROGRAMVERSION 			"0.0.4"
 
 static volatile int running = 1;
 static int optTimeInterval = 6000;  /* 6ms                          */
 static int optBurstCount = 0;       /* no burst                     */
+static int optMsgSize = MSG_SEND_SIZE; /* payload after the header */
 static int optThreadPrio = 40;      /* fifo with prio 40            */
 static char* optIPCMethod = nullptr;
-static unsigned int optAffinityMask = 0;
+static affinity_t* xmitCpus = affinity_new();     /* started affinity if empty */
+static affinity_t* reportCpus = affinity_new();
 static char* optEncapsulation = nullptr;
+static char* optClock = nullptr;    /* system clock                 */
 static uint32_t elementCounter = 0;
-static std::function<void(char**, ssize_t*)> aquireFunc;
-static std::function<void(char**, ssize_t*)> releaseFunc;
+static uint64_t failedMessages = 0;     /* numbered but not sent, the receiver counts them as lost */
+static perfcounters_t* perfCounters = nullptr;
+static int optEndpoints = 1;
+
+MQ_PERF_USDT_SEMAPHORE(send)
 
 /**
  * display version
@@ -85,11 +104,18 @@ void display_help (void)
            "\n"
            "  --help                              Show this menu\n"
            "  --version                           Show version of this application\n"
-           "  -i, --ipc=[mq|uds|shmem]            Use MQ, Unix domain socket or shared memory as IPC\n"
-           "  -m, --mask                          CPU affinity mask\n"
+           "  -i, --ipc=[mq|uds|shmem|epoll]      Use MQ, Unix domain socket or shared memory as IPC, epoll sends to\n"
+           "                                      --endpoints message queues and as many sockets of a fan-in receiver\n"
+           "  --endpoints=<n>                     Message queues or sockets sent to in turn (default 1)\n"
+           "  -e, --encapsulation=[raw|stages]    Message encoding, stages adds per stage latencies\n"
+           "  -m, --mask                          CPU affinity mask of the send thread, hex of any length\n"
+           "  -c, --cpus                          CPU list of the send thread, e.g. 2,4-7 or sibling:2, llc:2, remote:2\n"
+           "  --report-cpus                       CPU list of the main thread\n"
+           "  -z, --size                          Payload bytes per message (default 256, max " MSG_SIZE_MAX_TEXT ")\n"
            "  -b, --burst                         Number of messages as burst (0 = no burst)\n"
            "  -t, --time                          Time interval between messages in micro seconds (0 = no wait)\n"
-           "  -p, --prio                          Thread priority (FIFO scheduling)\n");
+           "  -p, --prio                          Thread priority (FIFO scheduling)\n"
+           "  --clock=[system|tsc]                Stamp with the system clock or calibrated TSC ticks, same on both sides\n");
     exit(-1);
 }
 
@@ -102,16 +128,22 @@ void process_options(int argc, char *argv[])
 
     for (;;) {
         int option_index = 0;
-        static const char *short_options = "m:i:p:b:t:";
+        static const char *short_options = "m:c:i:e:p:b:z:t:";
 
         static const struct option long_options[] = {
                 { "help",          no_argument,       0,  0  },
                 { "version",       no_argument,       0,  0  },
                 { "ipc",           required_argument, 0, 'i' },
+                { "encapsulation", required_argument, 0, 'e' },
                 { "mask",          required_argument, 0, 'm' },
+                { "cpus",          required_argument, 0, 'c' },
+                { "report-cpus",   required_argument, 0,  0  },
                 { "burst",         required_argument, 0, 'b' },
+                { "size",          required_argument, 0, 'z' },
                 { "time",          required_argument, 0, 't' },
                 { "prio",          required_argument, 0, 'p' },
+                { "clock",         required_argument, 0,  0  },
+                { "endpoints",     required_argument, 0,  0  },
                 { 0,               0,                 0,  0	 },
         };
 
@@ -131,14 +163,43 @@ void process_options(int argc, char *argv[])
                     case 1:
                         display_version();
                         break;
+                    default:
+                        if (strcmp(long_options[option_index].name, "clock") == 0) {
+                            optClock = strdup(optarg);
+                            if ((strcmp(optClock, CLOCK_SYSTEM) != 0) && (strcmp(optClock, CLOCK_TSC) != 0)) {
+                                error = 1;
+                            }
+                        }
+                        else if (strcmp(long_options[option_index].name, "report-cpus") == 0) {
+                            if (!affinity_parse_list(reportCpus, optarg)) {
+                                fprintf(stderr, "invalid CPU list %s: %s\n", optarg, strerror(errno));
+                                error = 1;
+                            }
+                        }
+                        else if (strcmp(long_options[option_index].name, "endpoints") == 0) {
+                            optEndpoints = atoi(optarg);
+                        }
+                        break;
                 }
                 break;
             case 'm':
-                optAffinityMask = strtoul(optarg, 0, 16);
+                if (!affinity_parse_mask(xmitCpus, optarg)) {
+                    fprintf(stderr, "invalid CPU mask %s\n", optarg);
+                    error = 1;
+                }
+                break;
+            case 'c':
+                if (!affinity_parse_list(xmitCpus, optarg)) {
+                    fprintf(stderr, "invalid CPU list %s: %s\n", optarg, strerror(errno));
+                    error = 1;
+                }
                 break;
             case 'b':
                 optBurstCount = atoi(optarg);
                 break;
+            case 'z':
+                optMsgSize = atoi(optarg);
+                break;
             case 't':
                 optTimeInterval = atoi(optarg);
                 break;
@@ -148,6 +209,9 @@ void process_options(int argc, char *argv[])
             case 'i':
                 optIPCMethod = strdup(optarg);
                 break;
+            case 'e':
+                optEncapsulation = strdup(optarg);
+                break;
             case '?':
                 error = 1;
                 break;
@@ -158,6 +222,28 @@ void process_options(int argc, char *argv[])
         error = 1;
     }
 
+    /* the header carries timestamp and sequence, a message queue message is limited */
+    if ((optMsgSize < 0) || (optMsgSize > (int)(MAX_MSG_SIZE - MSG_HDR_SIZE))) {
+        error = 1;
+    }
+
+    if (optEncapsulation && (strcmp(optEncapsulation, IPC_ENC_STAGES) == 0) && (optMsgSize < (int)STAGES_EXT_SIZE)) {
+        error = 1;
+    }
+
+    /* fan-out over mq and uds only, stages pair consecutive messages of one endpoint */
+    if (optEndpoints < 1) {
+        error = 1;
+    }
+    if ((optEndpoints > 1) && optIPCMethod && (strcmp(optIPCMethod, IPC_METHOD_MQ) != 0) &&
+        (strcmp(optIPCMethod, IPC_METHOD_UDS) != 0) && (strcmp(optIPCMethod, IPC_METHOD_EPOLL) != 0)) {
+        error = 1;
+    }
+    if (((optEndpoints > 1) || (optIPCMethod && (strcmp(optIPCMethod, IPC_METHOD_EPOLL) == 0))) &&
+        optEncapsulation && (strcmp(optEncapsulation, IPC_ENC_STAGES) == 0)) {
+        error = 1;
+    }
+
     if (error) {
         display_help();
     }
@@ -168,7 +254,8 @@ static int get_one_character(char* c)
     struct termios tmbuf,tmsave;
 
     if (tcgetattr(0,&tmbuf)) {
-        return -1;
+        // not a terminal (e.g. started by mq-perf-bench), plain blocking read
+        return (read(STDIN_FILENO, c, 1) == 1) ? 0 : -1;
     }
 
     // save current state
@@ -196,122 +283,162 @@ static int get_one_character(char* c)
     return 0;
 }
 
-static void configure_cpu_affinity()
+/**
+ * pin the calling thread if CPUs were given and report its placement once
+ */
+static void configure_cpu_affinity(const affinity_t* cpus, const char* who)
 {
-    /* get number of cores */
-    int nproc = sysconf(_SC_NPROCESSORS_ONLN);
-    cpu_set_t cpuset;
-
-    CPU_ZERO(&cpuset);
-
-    if (optAffinityMask > 0) {
-        for (int cnt = 0; cnt < nproc; cnt++) {
-            if ((optAffinityMask & (1 << cnt)) != 0) {
-                /* enable core */
-                CPU_SET(cnt, &cpuset);
-            }
-        }
+    affinity_t* current = affinity_new();
+    char list[1024];
 
-        if (sched_setaffinity(0, sizeof(cpuset), &cpuset) == -1) {
-            perror("sched_setaffinity() failed");
-        }
+    if (!affinity_is_empty(cpus) && (affinity_apply(cpus) == -1)) {
+        perror("sched_setaffinity() failed");
     }
 
-    printf("We have %d CPUs\n", nproc);
-
-    CPU_ZERO(&cpuset);
-    if (sched_getaffinity(0, sizeof(cpuset), &cpuset) != -1) {
-        for (int i = 0; i < nproc; i++) {
-            printf("  CPU %d is %s\n", i, CPU_ISSET(i, &cpuset) ? "enabled" : "disabled");
-        }
+    if (affinity_get(current) != -1) {
+        printf("%s on CPUs %s (%ld online)\n", who, affinity_format(current, list, sizeof(list)), sysconf(_SC_NPROCESSORS_ONLN));
     }
     else {
         perror("sched_getaffinity() failed");
     }
-}
 
-/* start of plain, no protobuf */
-static void aquire_message_0(char** buffer, ssize_t* size)
-{
-    if (*buffer == nullptr) {
-        *size = MSG_SEND_SIZE + MSG_HDR_SIZE;
-        *buffer = (char*)std::malloc(*size);
-    }
-
-    std::chrono::high_resolution_clock::time_point now = std::chrono::high_resolution_clock::now();
-    *(int64_t*)&(*buffer)[0] = (int64_t)std::chrono::duration_cast<std::chrono::nanoseconds>(now.time_since_epoch()).count();
-    *(uint32_t*)&(*buffer)[sizeof(int64_t)] = elementCounter;
+    affinity_destroy(current);
 }
 
-static void release_message_0(char** buffer, ssize_t* size)
+/**
+ * codecs: fill the message to send
+ */
+struct RawCodec
 {
-    buffer = buffer;
-    size = size;
-}
-/* end of plain, no protobuf */
+    static constexpr const char* name = IPC_ENC_RAW;
 
-void xmit_func(mqd_t mq_descriptor)
-{
-    char* xmit_buffer = nullptr;
-    ssize_t xmit_size = 0;
-    int burstCnt = optBurstCount;
-    struct timespec tm;
+    static inline void aquire(char** buffer, ssize_t* size)
+    {
+        if (*buffer == nullptr) {
+            *size = optMsgSize + MSG_HDR_SIZE;
+            *buffer = (char*)std::malloc(*size);
+        }
 
-    std::cout << "start sending mq with interval [" << optTimeInterval << "] burst [" <<
-              burstCnt << "] prio [" << optThreadPrio << "]" << std::endl;
+        *(int64_t*)&(*buffer)[0] = TscClock::now();
+        *(uint32_t*)&(*buffer)[sizeof(int64_t)] = elementCounter;
+    }
 
-    pthread_setname_np(pthread_self(), "mq_xmit");
+    static inline void release(char** buffer, ssize_t* size)
+    {
+        (void)buffer;
+        (void)size;
+    }
+};
 
-    struct sched_param param = { .sched_priority = optThreadPrio };
-    pthread_setschedparam(pthread_self(), SCHED_FIFO, &param);
+/**
+ * stages: raw, the payload starts with the stamp taken when the send call of the
+ * previous message returned, 0 for the first one
+ */
+struct StagesCodec
+{
+    static constexpr const char* name = IPC_ENC_STAGES;
+    static inline int64_t afterSend = 0;
 
-    configure_cpu_affinity();
+    static inline void aquire(char** buffer, ssize_t* size)
+    {
+        RawCodec::aquire(buffer, size);
+        memcpy(&(*buffer)[MSG_HDR_SIZE], &afterSend, sizeof(afterSend));
+    }
 
-    while (running) {
-        if ((burstCnt == 0) && (optTimeInterval > 0)) {
-            std::this_thread::sleep_for(std::chrono::microseconds(optTimeInterval));
-            burstCnt = optBurstCount;
-        }
+    static inline void release(char** buffer, ssize_t* size)
+    {
+        afterSend = TscClock::now();
+        RawCodec::release(buffer, size);
+    }
+};
 
-        burstCnt > 0 ? --burstCnt : burstCnt;
+/**
+ * transports: send one message, -1 with errno set on failure
+ */
+struct MqTransport
+{
+    static constexpr const char* label = "mq";
+    static constexpr const char* threadName = "mq_xmit";
+    mqd_t descriptor;
 
-        elementCounter++;
+    inline int send(const char* buffer, ssize_t size)
+    {
+        struct timespec tm;
 
         clock_gettime(CLOCK_REALTIME, &tm);
         tm.tv_sec += 1;
 
-        aquireFunc(&xmit_buffer, &xmit_size);
+        return mq_timedsend(descriptor, buffer, size, 0, &tm);
+    }
+};
 
-        mq_timedsend(mq_descriptor, xmit_buffer, xmit_size, 0, &tm);
+struct UdsTransport
+{
+    static constexpr const char* label = "UDS";
+    static constexpr const char* threadName = "uds_xmit";
+    int sockfd;
+    struct sockaddr_un address;
+
+    UdsTransport(int fd)
+        : sockfd{fd}
+    {
+        bzero(&address, sizeof(address));
+        address.sun_family = AF_LOCAL;
+        strcpy(address.sun_path, UDS_FILE);
+    }
 
-        releaseFunc(&xmit_buffer, &xmit_size);
+    inline int send(const char* buffer, ssize_t size)
+    {
+        return sendto(sockfd, buffer, size, 0, (struct sockaddr *) &address, sizeof(address));
     }
+};
 
-    if (xmit_buffer) {
-        std::free(xmit_buffer);
+struct ShmemTransport
+{
+    static constexpr const char* label = "shmem";
+    static constexpr const char* threadName = "shmem_xmit";
+    shmemq_t* shmemq;
+
+    inline int send(const char* buffer, ssize_t size)
+    {
+        bool full = false;
+
+        while (!shmemq_try_enqueue_sema(shmemq, (void*)buffer, size)) {
+            if (!full) {
+                tracepoint(mq_perf, queue_full, elementCounter, ENOSPC);
+                full = true;
+            }
+            if (!running)
+                break;
+        }
+
+        /* a full queue is retried until it drains, reported above */
+        return 0;
     }
-}
+};
 
-void xmit_uds_func(int sockfd)
+/**
+ * the send loop, one instance per transport and codec so the per message path inlines
+ */
+template <class Transport, class Codec>
+void xmit_func(Transport transport)
 {
     char* xmit_buffer = nullptr;
     ssize_t xmit_size = 0;
     int burstCnt = optBurstCount;
-    struct sockaddr_un uds_addr;
-
-    bzero(&uds_addr, sizeof(uds_addr));
-    uds_addr.sun_family = AF_LOCAL;
-    strcpy(uds_addr.sun_path, UDS_FILE);
 
-    std::cout << "start sending UDS with interval [" << optTimeInterval << "] burst [" <<
-                 burstCnt << "] prio [" << optThreadPrio << "]" << std::endl;
+    std::cout << "start sending " << Transport::label << " with interval [" << optTimeInterval << "] burst [" <<
+              burstCnt << "] prio [" << optThreadPrio << "]" << std::endl;
 
-    pthread_setname_np(pthread_self(), "uds_xmit");
+    pthread_setname_np(pthread_self(), Transport::threadName);
 
     struct sched_param param = { .sched_priority = optThreadPrio };
     pthread_setschedparam(pthread_self(), SCHED_FIFO, &param);
 
-    configure_cpu_affinity();
+    configure_cpu_affinity(xmitCpus, Transport::threadName);
+
+    perfCounters = perfcounters_new();
+    perfcounters_start(perfCounters);
 
     while (running) {
         if ((burstCnt == 0) && (optTimeInterval > 0)) {
@@ -323,57 +450,116 @@ void xmit_uds_func(int sockfd)
 
         elementCounter++;
 
-        aquireFunc(&xmit_buffer, &xmit_size);
+        Codec::aquire(&xmit_buffer, &xmit_size);
 
-        sendto(sockfd, xmit_buffer, xmit_size, 0, (struct sockaddr *) &uds_addr, sizeof(uds_addr));
+        int ret = transport.send(xmit_buffer, xmit_size);
 
-        releaseFunc(&xmit_buffer, &xmit_size);
+        tracepoint(mq_perf, message_sent, elementCounter, TscClock::toRealtimeNs(*(int64_t*)xmit_buffer), (int)xmit_size, ret);
+        MQ_PERF_USDT3(send, elementCounter, (int)xmit_size, ret);
+        if (ret == -1) {
+            tracepoint(mq_perf, queue_full, elementCounter, errno);
+            failedMessages++;
+        }
+
+        Codec::release(&xmit_buffer, &xmit_size);
     }
 
+    perfcounters_stop(perfCounters);
+
     if (xmit_buffer) {
         std::free(xmit_buffer);
     }
 }
 
-void xmit_shmem_func(shmemq_t* shmemq)
+/**
+ * fan-out to the endpoints of a fan-in receiver in turn, every endpoint
+ * numbers its messages on its own so the receiver sees gaps per endpoint
+ */
+struct FanoutTransport
 {
-    char* xmit_buffer = nullptr;
-    ssize_t xmit_size = 0;
-    int burstCnt = optBurstCount;
+    static constexpr const char* label = "fan-out";
+    static constexpr const char* threadName = "fanout_xmit";
 
-    std::cout << "start sending shmem with interval [" << optTimeInterval << "] burst [" <<
-              burstCnt << "] prio [" << optThreadPrio << "]" << std::endl;
+    struct Endpoint
+    {
+        bool mq;
+        int fd;
+        struct sockaddr_un address;
+        uint32_t seq;
+    };
+    std::vector<Endpoint> endpoints;
+    size_t next = 0;
 
-    pthread_setname_np(pthread_self(), "shmem_xmit");
+    inline int send(char* buffer, ssize_t size)
+    {
+        Endpoint& endpoint = endpoints[next];
 
-    struct sched_param param = { .sched_priority = optThreadPrio };
-    pthread_setschedparam(pthread_self(), SCHED_FIFO, &param);
+        next = (next + 1) % endpoints.size();
+        *(uint32_t*)&buffer[sizeof(int64_t)] = ++endpoint.seq;
 
-    configure_cpu_affinity();
+        if (endpoint.mq) {
+            struct timespec tm;
 
-    while (running) {
-        if ((burstCnt == 0) && (optTimeInterval > 0)) {
-            std::this_thread::sleep_for(std::chrono::microseconds(optTimeInterval));
-            burstCnt = optBurstCount;
-        }
+            clock_gettime(CLOCK_REALTIME, &tm);
+            tm.tv_sec += 1;
 
-        burstCnt > 0 ? --burstCnt : burstCnt;
+            return mq_timedsend(endpoint.fd, buffer, size, 0, &tm);
+        }
 
-        elementCounter++;
+        return sendto(endpoint.fd, buffer, size, 0, (struct sockaddr *) &endpoint.address, sizeof(endpoint.address));
+    }
+};
 
-        aquireFunc(&xmit_buffer, &xmit_size);
+static std::string endpoint_name(const char* base, int index)
+{
+    return index ? std::string(base) + "." + std::to_string(index) : std::string(base);
+}
 
-        while (!shmemq_try_enqueue_sema(shmemq, xmit_buffer, xmit_size)) {
-            if (!running)
-                break;
+/**
+ * the receiver created the queues and sockets, one socket sends to all of them
+ */
+static bool open_endpoints(FanoutTransport& transport, int sockfd)
+{
+    const bool mq = (strcmp(optIPCMethod, IPC_METHOD_UDS) != 0);
+    const bool uds = (strcmp(optIPCMethod, IPC_METHOD_MQ) != 0);
+
+    for (int index = 0; index < optEndpoints; index++) {
+        if (mq) {
+            const std::string name = endpoint_name(QUEUE_NAME, index);
+            const int fd = mq_open(name.c_str(), O_WRONLY);
+            if (fd == -1) {
+                fprintf(stderr, "mq_open(%s) failed: %s\n", name.c_str(), strerror(errno));
+                return false;
+            }
+            transport.endpoints.push_back({ true, fd, {}, 0 });
         }
+        if (uds) {
+            FanoutTransport::Endpoint endpoint = { false, sockfd, {}, 0 };
 
-        releaseFunc(&xmit_buffer, &xmit_size);
+            endpoint.address.sun_family = AF_LOCAL;
+            strncpy(endpoint.address.sun_path, endpoint_name(UDS_FILE, index).c_str(), sizeof(endpoint.address.sun_path) - 1);
+            transport.endpoints.push_back(endpoint);
+        }
     }
 
-    if (xmit_buffer) {
-        std::free(xmit_buffer);
+    return true;
+}
+
+/**
+ * select the codec once at startup
+ */
+template <class Transport>
+std::thread start_xmit_thread(Transport transport)
+{
+    if (strcmp(optEncapsulation, RawCodec::name) == 0) {
+        return std::thread(xmit_func<Transport, RawCodec>, transport);
+    }
+    if (strcmp(optEncapsulation, StagesCodec::name) == 0) {
+        return std::thread(xmit_func<Transport, StagesCodec>, transport);
     }
+
+    fprintf(stderr, "encapsulation %s not supported\n", optEncapsulation);
+    exit(1);
 }
 
 int main(int argc, char **argv)
@@ -387,29 +573,53 @@ int main(int argc, char **argv)
                             .mq_curmsgs = 0 };
     int sockfd;
     shmemq_t* shmemq = nullptr;
+    FanoutTransport fanout;
 
     /* parse given cmd line args */
     process_options(argc, argv);
 
-    optEncapsulation = optEncapsulation ? optEncapsulation : strdup(IPC_ENC_RAW);
+    /* the send thread paces itself, it keeps the started placement unless --cpus */
+    if (affinity_is_empty(xmitCpus)) {
+        affinity_get(xmitCpus);
+    }
+    configure_cpu_affinity(reportCpus, "main");
 
-    aquireFunc = std::function<void(char**, ssize_t*)>(aquire_message_0);
-    releaseFunc = std::function<void(char**, ssize_t*)>(release_message_0);
+    if (optClock && (strcmp(optClock, CLOCK_TSC) == 0)) {
+        std::string reason;
+        if (!TscClock::enable(reason)) {
+            fprintf(stderr, "TSC clock not usable (%s), using the system clock\n", reason.c_str());
+        }
+        else if (!reason.empty()) {
+            fprintf(stderr, "TSC clock: %s\n", reason.c_str());
+        }
+    }
+
+    optEncapsulation = optEncapsulation ? optEncapsulation : strdup(IPC_ENC_RAW);
 
     optIPCMethod = optIPCMethod ? optIPCMethod : strdup(IPC_METHOD_MQ);
 
-    if (strncmp(optIPCMethod, IPC_METHOD_UDS, strlen(IPC_METHOD_UDS)) == 0) {
+    if ((optEndpoints > 1) || (strcmp(optIPCMethod, IPC_METHOD_EPOLL) == 0)) {
         if ((sockfd = socket(AF_LOCAL, SOCK_DGRAM, 0)) < 0) {
             perror("socket() failed");
         }
+        if (!open_endpoints(fanout, sockfd)) {
+            exit(1);
+        }
 
-        xmit_thread = std::thread(xmit_uds_func, sockfd);
+        xmit_thread = start_xmit_thread(fanout);
+    }
+    else if (strncmp(optIPCMethod, IPC_METHOD_UDS, strlen(IPC_METHOD_UDS)) == 0) {
+        if ((sockfd = socket(AF_LOCAL, SOCK_DGRAM, 0)) < 0) {
+            perror("socket() failed");
+        }
+
+        xmit_thread = start_xmit_thread(UdsTransport(sockfd));
     }
     else if (strncmp(optIPCMethod, IPC_METHOD_SHMEM, strlen(IPC_METHOD_SHMEM)) == 0) {
         /* as we have a queue of fixed elements size must match */
-        shmemq = shmemq_new(SHMEM_NAME, SHMEM_MAX_MESSAGES, (MSG_SEND_SIZE + MSG_HDR_SIZE));
+        shmemq = shmemq_new(SHMEM_NAME, SHMEM_MAX_MESSAGES, (optMsgSize + MSG_HDR_SIZE));
 
-        xmit_thread = std::thread(xmit_shmem_func, shmemq);
+        xmit_thread = start_xmit_thread(ShmemTransport{shmemq});
     }
     else {
         if ((mq_descriptor = mq_open(QUEUE_NAME, O_WRONLY /*| O_CREAT*/, QUEUE_PERMISSIONS, &attr)) == -1) {
@@ -417,13 +627,16 @@ int main(int argc, char **argv)
             exit (1);
         }
 
-        xmit_thread = std::thread(xmit_func, mq_descriptor);
+        xmit_thread = start_xmit_thread(MqTransport{mq_descriptor});
     }
 
     while (running == 1) {
         printf("\nEnter command : ");
         fflush(stdout);
-        get_one_character(&ch);
+        if (get_one_character(&ch) == -1) {
+            // stdin closed, same as q
+            ch = 'q';
+        }
         printf("\n");
         switch (ch) {
             case 'h':
@@ -441,7 +654,15 @@ int main(int argc, char **argv)
         xmit_thread.join();
     }
 
-    if (strncmp(optIPCMethod, IPC_METHOD_UDS, strlen(IPC_METHOD_UDS)) == 0) {
+    if (!fanout.endpoints.empty()) {
+        for (const auto& endpoint : fanout.endpoints) {
+            if (endpoint.mq) {
+                mq_close(endpoint.fd);
+            }
+        }
+        close(sockfd);
+    }
+    else if (strncmp(optIPCMethod, IPC_METHOD_UDS, strlen(IPC_METHOD_UDS)) == 0) {
         close(sockfd);
     }
     else if (strncmp(optIPCMethod, IPC_METHOD_SHMEM, strlen(IPC_METHOD_SHMEM)) == 0) {
@@ -456,6 +677,20 @@ int main(int argc, char **argv)
         //mq_unlink(QUEUE_NAME);
     }
 
+    printf("sent messages        : %12lu\n", (unsigned long)(elementCounter - failedMessages));
+    printf("failed sends         : %12lu\n", (unsigned long)failedMessages);
+
+    if (perfCounters) {
+        perfcounters_dump(perfCounters, elementCounter);
+        perfcounters_destroy(perfCounters);
+        perfCounters = nullptr;
+    }
+
+    if (optClock) {
+        free(optClock);
+        optClock = nullptr;
+    }
+
     if (optEncapsulation) {
         free(optEncapsulation);
         optEncapsulation = nullptr;
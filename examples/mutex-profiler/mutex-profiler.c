@@ -0,0 +1,495 @@
+/**
+ * pthread mutex contention profiler, to be preloaded
+ *
+ * Interposes pthread_mutex_lock/trylock/timedlock/unlock and pthread_cond_wait/
+ * timedwait. Every thread aggregates wait and hold times per (mutex, call site)
+ * in its own table, so the profiler itself takes no lock. A ranked report is
+ * printed at exit.
+ *
+ * usage:  LD_PRELOAD=./libmutex-profiler.so <application>
+ * env:    MUTEX_PROFILER_FILE  report file (default stderr)
+ *         MUTEX_PROFILER_TOP   number of call sites in the report (default 20)
+ */
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <errno.h>
+#include <time.h>
+#include <dlfcn.h>
+#include <pthread.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+
+#define MP_TABLE_SIZE           4096        /* (mutex, call site) entries per thread, power of two */
+#define MP_MAX_HELD             64          /* nested locks per thread with hold time */
+#define MP_BUCKETS              40          /* log2 ns buckets, up to ~550s */
+#define MP_DEFAULT_TOP          20
+
+#define MP_UNLIKELY(x)          __builtin_expect(!!(x), 0)
+
+struct mp_entry {
+    const void* mutex;          /* NULL: free slot */
+    const void* caller;
+    uint64_t acquired;
+    uint64_t contended;
+    uint64_t wait_ns;
+    uint64_t wait_max;
+    uint64_t hold_ns;
+    uint64_t hold_max;
+    uint32_t wait_hist[MP_BUCKETS];
+    uint32_t hold_hist[MP_BUCKETS];
+};
+
+struct mp_held {
+    const void* mutex;
+    struct mp_entry* entry;
+    uint64_t since;
+};
+
+struct mp_thread {
+    struct mp_thread* next;
+    uint32_t tid;
+    uint32_t held_count;
+    uint64_t overflow;          /* acquisitions not recorded, table full */
+    struct mp_held held[MP_MAX_HELD];
+    struct mp_entry entries[MP_TABLE_SIZE];
+};
+
+static int (*real_mutex_lock)(pthread_mutex_t*);
+static int (*real_mutex_trylock)(pthread_mutex_t*);
+static int (*real_mutex_timedlock)(pthread_mutex_t*, const struct timespec*);
+static int (*real_mutex_unlock)(pthread_mutex_t*);
+static int (*real_cond_wait)(pthread_cond_t*, pthread_mutex_t*);
+static int (*real_cond_timedwait)(pthread_cond_t*, pthread_mutex_t*, const struct timespec*);
+
+static struct mp_thread* mp_threads;
+static __thread struct mp_thread* mp_tls_thread __attribute__((tls_model("initial-exec")));
+static __thread int mp_tls_busy __attribute__((tls_model("initial-exec")));
+static int mp_active;
+
+static void mp_resolve(void)
+{
+    real_mutex_lock = dlsym(RTLD_NEXT, "pthread_mutex_lock");
+    real_mutex_trylock = dlsym(RTLD_NEXT, "pthread_mutex_trylock");
+    real_mutex_timedlock = dlsym(RTLD_NEXT, "pthread_mutex_timedlock");
+    real_mutex_unlock = dlsym(RTLD_NEXT, "pthread_mutex_unlock");
+    /* versioned, the unversioned lookup may return the old condvar ABI */
+    real_cond_wait = dlvsym(RTLD_NEXT, "pthread_cond_wait", "GLIBC_2.3.2");
+    real_cond_timedwait = dlvsym(RTLD_NEXT, "pthread_cond_timedwait", "GLIBC_2.3.2");
+    if (real_cond_wait == NULL) {
+        real_cond_wait = dlsym(RTLD_NEXT, "pthread_cond_wait");
+    }
+    if (real_cond_timedwait == NULL) {
+        real_cond_timedwait = dlsym(RTLD_NEXT, "pthread_cond_timedwait");
+    }
+}
+
+static inline uint64_t mp_now_ns(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+
+    return (uint64_t)ts.tv_sec * 1000000000ull + ts.tv_nsec;
+}
+
+static inline uint32_t mp_bucket(uint64_t ns)
+{
+    const uint32_t bucket = ns ? 64 - __builtin_clzll(ns) : 0;
+
+    return bucket < MP_BUCKETS ? bucket : MP_BUCKETS - 1;
+}
+
+static struct mp_thread* mp_thread_get(void)
+{
+    struct mp_thread* thread = mp_tls_thread;
+
+    if (MP_UNLIKELY(thread == NULL)) {
+        if (!__atomic_load_n(&mp_active, __ATOMIC_ACQUIRE)) {
+            return NULL;
+        }
+
+        /* no malloc, it may take a mutex itself */
+        thread = mmap(NULL, sizeof(struct mp_thread), PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+        if (thread == MAP_FAILED) {
+            return NULL;
+        }
+
+        thread->tid = (uint32_t)syscall(SYS_gettid);
+        thread->next = __atomic_load_n(&mp_threads, __ATOMIC_RELAXED);
+        while (!__atomic_compare_exchange_n(&mp_threads, &thread->next, thread, 1, __ATOMIC_RELEASE, __ATOMIC_RELAXED));
+
+        mp_tls_thread = thread;
+    }
+
+    return thread;
+}
+
+static inline struct mp_entry* mp_entry_get(struct mp_thread* thread, const void* mutex, const void* caller)
+{
+    uintptr_t hash = ((uintptr_t)mutex ^ ((uintptr_t)caller * 0x9e3779b97f4a7c15ull)) >> 4;
+
+    for (uint32_t probe = 0; probe < MP_TABLE_SIZE; probe++, hash++) {
+        struct mp_entry* entry = &thread->entries[hash & (MP_TABLE_SIZE - 1)];
+
+        if ((entry->mutex == mutex) && (entry->caller == caller)) {
+            return entry;
+        }
+
+        if (entry->mutex == NULL) {
+            entry->mutex = mutex;
+            entry->caller = caller;
+            return entry;
+        }
+    }
+
+    thread->overflow++;
+
+    return NULL;
+}
+
+static inline void mp_acquired(struct mp_thread* thread, const void* mutex, const void* caller, uint64_t wait_ns, int contended)
+{
+    struct mp_entry* entry = mp_entry_get(thread, mutex, caller);
+
+    if (entry == NULL) {
+        return;
+    }
+
+    entry->acquired++;
+    if (contended) {
+        entry->contended++;
+        entry->wait_ns += wait_ns;
+        entry->wait_max = wait_ns > entry->wait_max ? wait_ns : entry->wait_max;
+        entry->wait_hist[mp_bucket(wait_ns)]++;
+    }
+
+    if (thread->held_count < MP_MAX_HELD) {
+        struct mp_held* held = &thread->held[thread->held_count++];
+        held->mutex = mutex;
+        held->entry = entry;
+        held->since = mp_now_ns();
+    }
+}
+
+static inline void mp_released(struct mp_thread* thread, const void* mutex)
+{
+    /* usually the innermost lock */
+    for (uint32_t cnt = thread->held_count; cnt > 0; cnt--) {
+        struct mp_held* held = &thread->held[cnt - 1];
+
+        if (held->mutex == mutex) {
+            struct mp_entry* entry = held->entry;
+            const uint64_t hold_ns = mp_now_ns() - held->since;
+
+            entry->hold_ns += hold_ns;
+            entry->hold_max = hold_ns > entry->hold_max ? hold_ns : entry->hold_max;
+            entry->hold_hist[mp_bucket(hold_ns)]++;
+
+            *held = thread->held[--thread->held_count];
+            return;
+        }
+    }
+}
+
+/**
+ * the uncontended case costs a trylock, only a failed one is timed
+ */
+static inline int mp_lock(pthread_mutex_t* mutex, const struct timespec* abstime, const void* caller)
+{
+    struct mp_thread* thread;
+    int ret;
+
+    if (MP_UNLIKELY(real_mutex_lock == NULL)) {
+        mp_resolve();
+    }
+
+    if (mp_tls_busy || ((thread = mp_thread_get()) == NULL)) {
+        return abstime ? real_mutex_timedlock(mutex, abstime) : real_mutex_lock(mutex);
+    }
+
+    mp_tls_busy = 1;
+
+    if ((ret = real_mutex_trylock(mutex)) == 0) {
+        mp_acquired(thread, mutex, caller, 0, 0);
+    }
+    else if (ret == EBUSY) {
+        const uint64_t start = mp_now_ns();
+
+        ret = abstime ? real_mutex_timedlock(mutex, abstime) : real_mutex_lock(mutex);
+        if (ret == 0) {
+            mp_acquired(thread, mutex, caller, mp_now_ns() - start, 1);
+        }
+    }
+
+    mp_tls_busy = 0;
+
+    return ret;
+}
+
+int pthread_mutex_lock(pthread_mutex_t* mutex)
+{
+    return mp_lock(mutex, NULL, __builtin_return_address(0));
+}
+
+int pthread_mutex_timedlock(pthread_mutex_t* mutex, const struct timespec* abstime)
+{
+    return mp_lock(mutex, abstime, __builtin_return_address(0));
+}
+
+int pthread_mutex_trylock(pthread_mutex_t* mutex)
+{
+    struct mp_thread* thread;
+    int ret;
+
+    if (MP_UNLIKELY(real_mutex_trylock == NULL)) {
+        mp_resolve();
+    }
+
+    ret = real_mutex_trylock(mutex);
+    if ((ret == 0) && !mp_tls_busy && ((thread = mp_thread_get()) != NULL)) {
+        mp_tls_busy = 1;
+        mp_acquired(thread, mutex, __builtin_return_address(0), 0, 0);
+        mp_tls_busy = 0;
+    }
+
+    return ret;
+}
+
+int pthread_mutex_unlock(pthread_mutex_t* mutex)
+{
+    struct mp_thread* thread = mp_tls_thread;
+
+    if (MP_UNLIKELY(real_mutex_unlock == NULL)) {
+        mp_resolve();
+    }
+
+    if (thread && !mp_tls_busy) {
+        mp_released(thread, mutex);
+    }
+
+    return real_mutex_unlock(mutex);
+}
+
+/**
+ * the mutex is released while waiting, the time in the wait is not hold time
+ */
+static int mp_cond_wait(pthread_cond_t* cond, pthread_mutex_t* mutex, const struct timespec* abstime, const void* caller)
+{
+    struct mp_thread* thread = mp_tls_thread;
+    int ret;
+
+    if (MP_UNLIKELY(real_cond_wait == NULL)) {
+        mp_resolve();
+    }
+
+    if (thread && !mp_tls_busy) {
+        mp_released(thread, mutex);
+    }
+
+    ret = abstime ? real_cond_timedwait(cond, mutex, abstime) : real_cond_wait(cond, mutex);
+
+    if (thread && !mp_tls_busy && ((ret == 0) || (ret == ETIMEDOUT))) {
+        mp_acquired(thread, mutex, caller, 0, 0);
+    }
+
+    return ret;
+}
+
+int pthread_cond_wait(pthread_cond_t* cond, pthread_mutex_t* mutex)
+{
+    return mp_cond_wait(cond, mutex, NULL, __builtin_return_address(0));
+}
+
+int pthread_cond_timedwait(pthread_cond_t* cond, pthread_mutex_t* mutex, const struct timespec* abstime)
+{
+    return mp_cond_wait(cond, mutex, abstime, __builtin_return_address(0));
+}
+
+/**
+ * report
+ */
+struct mp_site {
+    const void* mutex;
+    const void* caller;
+    uint64_t acquired;
+    uint64_t contended;
+    uint64_t wait_ns;
+    uint64_t wait_max;
+    uint64_t hold_ns;
+    uint64_t hold_max;
+    uint64_t wait_hist[MP_BUCKETS];
+    uint64_t hold_hist[MP_BUCKETS];
+    uint32_t threads;
+};
+
+static int mp_site_compare(const void* a, const void* b)
+{
+    const struct mp_site* sa = a;
+    const struct mp_site* sb = b;
+
+    if (sa->wait_ns != sb->wait_ns) {
+        return sa->wait_ns < sb->wait_ns ? 1 : -1;
+    }
+
+    return sa->hold_ns < sb->hold_ns ? 1 : (sa->hold_ns > sb->hold_ns ? -1 : 0);
+}
+
+/* upper bound of the bucket holding the percentile */
+static uint64_t mp_percentile(const uint64_t* hist, uint64_t count, double percentile)
+{
+    const uint64_t rank = (uint64_t)(count * percentile / 100.0);
+    uint64_t sum = 0;
+
+    for (uint32_t bucket = 0; bucket < MP_BUCKETS; bucket++) {
+        sum += hist[bucket];
+        if (sum > rank) {
+            return bucket ? (1ull << bucket) - 1 : 0;
+        }
+    }
+
+    return UINT64_MAX;
+}
+
+static void mp_caller_name(const void* caller, char* name, size_t size)
+{
+    Dl_info info;
+
+    if (dladdr(caller, &info) && info.dli_fname) {
+        const char* base = strrchr(info.dli_fname, '/');
+
+        base = base ? base + 1 : info.dli_fname;
+        if (info.dli_sname) {
+            snprintf(name, size, "%s+0x%lx (%s)", info.dli_sname, (unsigned long)((uintptr_t)caller - (uintptr_t)info.dli_saddr), base);
+        }
+        else {
+            /* offset for addr2line -e <file> */
+            snprintf(name, size, "%s+0x%lx", base, (unsigned long)((uintptr_t)caller - (uintptr_t)info.dli_fbase));
+        }
+    }
+    else {
+        snprintf(name, size, "%p", caller);
+    }
+}
+
+static void mp_report(FILE* out, uint32_t top)
+{
+    struct mp_site* sites;
+    uint32_t count = 0;
+    uint32_t capacity = 0;
+    uint32_t threads = 0;
+    uint64_t overflow = 0;
+    uint64_t acquired = 0;
+    uint64_t contended = 0;
+    uint64_t wait_ns = 0;
+
+    for (struct mp_thread* thread = __atomic_load_n(&mp_threads, __ATOMIC_ACQUIRE); thread; thread = thread->next) {
+        capacity += MP_TABLE_SIZE;
+    }
+
+    if ((capacity == 0) || ((sites = calloc(capacity, sizeof(struct mp_site))) == NULL)) {
+        return;
+    }
+
+    /* merge the thread tables, tables are small enough for a linear search per thread entry */
+    for (struct mp_thread* thread = __atomic_load_n(&mp_threads, __ATOMIC_ACQUIRE); thread; thread = thread->next) {
+        threads++;
+        overflow += thread->overflow;
+
+        for (uint32_t index = 0; index < MP_TABLE_SIZE; index++) {
+            const struct mp_entry* entry = &thread->entries[index];
+            struct mp_site* site = NULL;
+
+            if (entry->mutex == NULL) {
+                continue;
+            }
+
+            for (uint32_t cnt = 0; cnt < count; cnt++) {
+                if ((sites[cnt].mutex == entry->mutex) && (sites[cnt].caller == entry->caller)) {
+                    site = &sites[cnt];
+                    break;
+                }
+            }
+
+            if (site == NULL) {
+                site = &sites[count++];
+                site->mutex = entry->mutex;
+                site->caller = entry->caller;
+            }
+
+            site->threads++;
+            site->acquired += entry->acquired;
+            site->contended += entry->contended;
+            site->wait_ns += entry->wait_ns;
+            site->wait_max = entry->wait_max > site->wait_max ? entry->wait_max : site->wait_max;
+            site->hold_ns += entry->hold_ns;
+            site->hold_max = entry->hold_max > site->hold_max ? entry->hold_max : site->hold_max;
+            for (uint32_t bucket = 0; bucket < MP_BUCKETS; bucket++) {
+                site->wait_hist[bucket] += entry->wait_hist[bucket];
+                site->hold_hist[bucket] += entry->hold_hist[bucket];
+            }
+
+            acquired += entry->acquired;
+            contended += entry->contended;
+            wait_ns += entry->wait_ns;
+        }
+    }
+
+    qsort(sites, count, sizeof(struct mp_site), mp_site_compare);
+
+    fprintf(out, "\nmutex contention of pid %d : %u threads, %u call sites, %lu acquisitions, %lu contended, %.3f ms waited\n",
+            getpid(), threads, count, (unsigned long)acquired, (unsigned long)contended, wait_ns / 1e6);
+    if (overflow) {
+        fprintf(out, "%lu acquisitions not recorded, raise MP_TABLE_SIZE\n", (unsigned long)overflow);
+    }
+
+    fprintf(out, "%-18s %10s %7s %12s %10s %10s %10s %12s %10s %10s  %s\n", "mutex", "acquired", "cont %", "wait ms",
+            "wait avg", "wait p99", "wait max", "hold ms", "hold avg", "hold max", "call site (ns)");
+
+    for (uint32_t cnt = 0; (cnt < count) && (cnt < top); cnt++) {
+        const struct mp_site* site = &sites[cnt];
+        char name[256];
+
+        mp_caller_name(site->caller, name, sizeof(name));
+
+        fprintf(out, "%-18p %10lu %7.2f %12.3f %10lu %10lu %10lu %12.3f %10lu %10lu  %s\n", site->mutex,
+                (unsigned long)site->acquired, 100.0 * site->contended / site->acquired, site->wait_ns / 1e6,
+                (unsigned long)(site->contended ? site->wait_ns / site->contended : 0),
+                (unsigned long)(site->contended ? mp_percentile(site->wait_hist, site->contended, 99.0) : 0),
+                (unsigned long)site->wait_max, site->hold_ns / 1e6,
+                (unsigned long)(site->acquired ? site->hold_ns / site->acquired : 0), (unsigned long)site->hold_max, name);
+    }
+
+    free(sites);
+}
+
+static __attribute__((constructor)) void mp_init(void)
+{
+    mp_resolve();
+    __atomic_store_n(&mp_active, 1, __ATOMIC_RELEASE);
+}
+
+static __attribute__((destructor)) void mp_fini(void)
+{
+    const char* path = getenv("MUTEX_PROFILER_FILE");
+    const char* top = getenv("MUTEX_PROFILER_TOP");
+    FILE* out = stderr;
+
+    /* the report itself locks, e.g. in stdio */
+    mp_tls_busy = 1;
+    __atomic_store_n(&mp_active, 0, __ATOMIC_RELEASE);
+
+    if (path && ((out = fopen(path, "w")) == NULL)) {
+        perror("mutex-profiler: fopen() failed");
+        out = stderr;
+    }
+
+    mp_report(out, top ? (uint32_t)strtoul(top, NULL, 0) : MP_DEFAULT_TOP);
+
+    if (out != stderr) {
+        fclose(out);
+    }
+}